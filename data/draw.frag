@@ -1,14 +1,16 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding = 1) uniform sampler2D texSampler;
+// Must match MAX_MODEL_MATERIALS
+layout(binding = 1) uniform sampler2D texSamplers[16];
 
-layout(location = 0) in vec3 fragColor;
+layout(location = 0) in vec3 fragNormal;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in int fragMaterial;
 
 layout(location = 0) out vec4 outColor;
 
 void main() 
 {
-    outColor = texture(texSampler, fragTexCoord);
+    outColor = texture(texSamplers[fragMaterial], fragTexCoord);
 }
\ No newline at end of file
@@ -8,16 +8,32 @@ layout(binding = 0) uniform UniformBufferObject
     mat4 proj;
 } ubo;
 
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
+layout(push_constant) uniform PushConstants
+{
+    vec4 posScale;
+    vec4 posOffset;
+} pc;
+
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inNormal;
 layout(location = 2) in vec2 inTexCoord;
 
-layout(location = 0) out vec3 fragColor;
+layout(location = 0) out vec3 fragNormal;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out int fragMaterial;
 
 void main() 
 {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-    fragColor = inColor;
+    vec3 position = inPosition.xyz * pc.posScale.xyz + pc.posOffset.xyz;
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(position, 1.0);
+
+    // Octahedral decoding
+    vec3 normal = vec3(inNormal, 1.0 - abs(inNormal.x) - abs(inNormal.y));
+    float t = clamp(-normal.z, 0.0, 1.0);
+    normal.xy += mix(vec2(t), vec2(-t), greaterThanEqual(normal.xy, vec2(0.0)));
+    fragNormal = normalize(normal);
     fragTexCoord = inTexCoord;
+
+    // Material index is passed as the first instance of every draw
+    fragMaterial = gl_InstanceIndex;
 }
@@ -1,9 +1,13 @@
 #!/bin/sh
 
+set -e
+
 cd "`dirname "$0"`"
 
-glslangValidator -V draw.vert
-mv vert.spv draw_vert.spv
+glslangValidator -V draw.vert -o draw_vert.spv
+glslangValidator -V draw.frag -o draw_frag.spv
+glslangValidator -V cull.comp -o cull_comp.spv
 
-glslangValidator -V draw.frag
-mv frag.spv draw_frag.spv
+spirv-val draw_vert.spv
+spirv-val draw_frag.spv
+spirv-val cull_comp.spv
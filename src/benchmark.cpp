@@ -0,0 +1,409 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "benchmark.hpp"
+#include "camera.hpp"
+#include "device_manager.hpp"
+#include "file_manager.hpp"
+#include "gpu_profiler.hpp"
+#include "renderer.hpp"
+#include "vulkan_context.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <sstream>
+
+Benchmark* Benchmark::m_benchmark = nullptr;
+
+Benchmark::Benchmark(unsigned int frames_count)
+{
+    m_frames_count = std::max(frames_count, BENCHMARK_WARMUP_FRAMES + 1);
+    m_current_frame = 0;
+    m_frame = {};
+    m_load_time = 0.0f;
+    m_frame_start_time = 0;
+    m_phase_start_time = 0;
+
+    createDefaultPath();
+
+    m_benchmark = this;
+}
+
+Benchmark::~Benchmark()
+{
+    m_benchmark = nullptr;
+}
+
+void Benchmark::createDefaultPath()
+{
+    // Single orbit around data/model.obj, looking at its center
+    const glm::vec3 center(-35.0f, 5.0f, -12.0f);
+    const float radius = 60.0f;
+    const float height = 20.0f;
+    const unsigned int keyframes_count = 9;
+
+    m_path.clear();
+
+    for (unsigned int i = 0; i < keyframes_count; i++)
+    {
+        float angle = 2.0f * (float)M_PI * i / (keyframes_count - 1);
+
+        BenchmarkKeyframe keyframe;
+        keyframe.position = center + glm::vec3(radius * sinf(angle), height,
+                                               radius * cosf(angle));
+        keyframe.horizontal_angle = angle + (float)M_PI;
+        keyframe.vertical_angle = -atanf(height / radius);
+
+        m_path.push_back(keyframe);
+    }
+}
+
+// Text file with one keyframe per line: x y z horizontal vertical, where
+// angles are in degrees. Lines starting with # are ignored.
+bool Benchmark::loadPath(std::string filename)
+{
+    FileManager* file_manager = FileManager::getFileManager();
+    File* file = file_manager->loadFile(filename);
+
+    if (file == nullptr)
+        return false;
+
+    std::string text(file->data, file->length);
+    file_manager->closeFile(file);
+
+    std::vector<BenchmarkKeyframe> path;
+    std::istringstream stream(text);
+    std::string line;
+
+    while (std::getline(stream, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        BenchmarkKeyframe keyframe;
+        float horizontal_angle = 0.0f;
+        float vertical_angle = 0.0f;
+
+        int count = sscanf(line.c_str(), "%f %f %f %f %f",
+                           &keyframe.position.x, &keyframe.position.y,
+                           &keyframe.position.z, &horizontal_angle,
+                           &vertical_angle);
+
+        if (count != 5)
+        {
+            printf("Warning: Ignoring invalid keyframe in %s: %s\n",
+                   filename.c_str(), line.c_str());
+            continue;
+        }
+
+        keyframe.horizontal_angle = glm::radians(horizontal_angle);
+        keyframe.vertical_angle = glm::radians(vertical_angle);
+        path.push_back(keyframe);
+    }
+
+    if (path.size() < 2)
+    {
+        printf("Error: Benchmark path needs at least 2 keyframes: %s\n",
+               filename.c_str());
+        return false;
+    }
+
+    m_path.swap(path);
+
+    return true;
+}
+
+template<typename T>
+static T catmullRom(T p0, T p1, T p2, T p3, float t)
+{
+    float t2 = t * t;
+    float t3 = t2 * t;
+
+    return 0.5f * ((2.0f * p1) + (p2 - p0) * t +
+                   (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+                   (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+}
+
+BenchmarkKeyframe Benchmark::getKeyframe(float t)
+{
+    float segment_pos = t * (m_path.size() - 1);
+    unsigned int segment = std::min((unsigned int)segment_pos,
+                                    (unsigned int)m_path.size() - 2);
+    float local_t = segment_pos - segment;
+
+    // End points are repeated, so that the camera stops at the first and the
+    // last keyframe
+    const BenchmarkKeyframe& k0 = m_path[segment > 0 ? segment - 1 : 0];
+    const BenchmarkKeyframe& k1 = m_path[segment];
+    const BenchmarkKeyframe& k2 = m_path[segment + 1];
+    const BenchmarkKeyframe& k3 = m_path[std::min(segment + 2,
+                                         (unsigned int)m_path.size() - 1)];
+
+    BenchmarkKeyframe keyframe;
+    keyframe.position = catmullRom(k0.position, k1.position, k2.position,
+                                   k3.position, local_t);
+    keyframe.horizontal_angle = catmullRom(k0.horizontal_angle,
+                                           k1.horizontal_angle,
+                                           k2.horizontal_angle,
+                                           k3.horizontal_angle, local_t);
+    keyframe.vertical_angle = catmullRom(k0.vertical_angle,
+                                         k1.vertical_angle,
+                                         k2.vertical_angle,
+                                         k3.vertical_angle, local_t);
+
+    return keyframe;
+}
+
+void Benchmark::beginFrame()
+{
+    Device* device = DeviceManager::getDeviceManager()->getDevice();
+
+    if (m_frame_start_time == 0)
+    {
+        m_frame_start_time = device->getMicroTickCount();
+    }
+
+    float t = (float)m_current_frame / (m_frames_count - 1);
+    BenchmarkKeyframe keyframe = getKeyframe(t);
+
+    Camera* camera = Camera::getCamera();
+    camera->setPosition(keyframe.position);
+    camera->setRotation(keyframe.horizontal_angle, keyframe.vertical_angle);
+
+    m_frame = {};
+}
+
+void Benchmark::endFrame()
+{
+    Device* device = DeviceManager::getDeviceManager()->getDevice();
+    unsigned long now = device->getMicroTickCount();
+
+    m_frame.frame_time = (now - m_frame_start_time) / 1000.0f;
+    Renderer* renderer = Renderer::getRenderer();
+    const RenderStats& render_stats = renderer->getRenderStats();
+
+    m_frame.draws = render_stats.draws;
+    m_frame.triangles = render_stats.triangles;
+    m_frame.vertex_invocations = render_stats.vertex_invocations;
+    m_frame.clipping_primitives = render_stats.clipping_primitives;
+    m_frame.overdraw = renderer->getOverdraw();
+    m_frame_start_time = now;
+
+    if (m_current_frame >= BENCHMARK_WARMUP_FRAMES)
+    {
+        m_frames.push_back(m_frame);
+    }
+
+    GpuProfiler* gpu_profiler = GpuProfiler::getGpuProfiler();
+
+    // Results are read when the frame slot is reused and not every frame has
+    // them, so only new ones are recorded
+    for (const GpuProfilerScope& scope : gpu_profiler->getScopes())
+    {
+        uint64_t& samples_count = m_gpu_scope_samples[scope.name];
+
+        if (scope.samples_count == samples_count)
+            continue;
+
+        samples_count = scope.samples_count;
+
+        if (m_current_frame >= BENCHMARK_WARMUP_FRAMES)
+        {
+            m_gpu_scope_times[scope.name].push_back(scope.last_time);
+        }
+    }
+
+    m_current_frame++;
+}
+
+void Benchmark::beginPhase()
+{
+    Device* device = DeviceManager::getDeviceManager()->getDevice();
+    m_phase_start_time = device->getMicroTickCount();
+}
+
+void Benchmark::endPhase(BenchmarkPhase phase)
+{
+    Device* device = DeviceManager::getDeviceManager()->getDevice();
+    unsigned long now = device->getMicroTickCount();
+
+    m_frame.phase_times[phase] += (now - m_phase_start_time) / 1000.0f;
+}
+
+static float getPercentile(const std::vector<float>& sorted_times, 
+                           float percentile)
+{
+    if (sorted_times.empty())
+        return 0.0f;
+
+    // Nearest rank
+    unsigned int rank = (unsigned int)ceilf(percentile / 100.0f * 
+                                            sorted_times.size());
+    rank = std::max(rank, 1u);
+
+    return sorted_times[std::min(rank, (unsigned int)sorted_times.size()) - 1];
+}
+
+static void writeTimes(FILE* file, const char* name, std::vector<float> times,
+                       bool last)
+{
+    std::sort(times.begin(), times.end());
+
+    double sum = 0.0;
+
+    for (float time : times)
+    {
+        sum += time;
+    }
+
+    float average = times.empty() ? 0.0f : (float)(sum / times.size());
+    float min = times.empty() ? 0.0f : times.front();
+    float max = times.empty() ? 0.0f : times.back();
+
+    fprintf(file, "    \"%s\": {\"average\": %.3f, \"min\": %.3f, "
+            "\"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f}%s\n",
+            name, average, min, getPercentile(times, 50.0f),
+            getPercentile(times, 95.0f), getPercentile(times, 99.0f), max,
+            last ? "" : ",");
+}
+
+bool Benchmark::writeReport(std::string filename)
+{
+    VulkanContext* vulkan_context = VulkanContext::getVulkanContext();
+    Renderer* renderer = Renderer::getRenderer();
+
+    FILE* file = fopen(filename.c_str(), "w");
+
+    if (file == nullptr)
+    {
+        printf("Error: Couldn't open benchmark report: %s\n", 
+               filename.c_str());
+        return false;
+    }
+
+    std::vector<float> frame_times;
+    std::vector<float> gpu_times;
+    std::vector<float> phase_times[BENCHMARK_PHASE_COUNT];
+
+    // Whole command buffers are measured as "frame" scope
+    auto gpu_frame_times = m_gpu_scope_times.find("frame");
+
+    if (gpu_frame_times != m_gpu_scope_times.end())
+    {
+        gpu_times = gpu_frame_times->second;
+    }
+
+    for (BenchmarkFrame& frame : m_frames)
+    {
+        frame_times.push_back(frame.frame_time);
+
+        for (unsigned int i = 0; i < BENCHMARK_PHASE_COUNT; i++)
+        {
+            phase_times[i].push_back(frame.phase_times[i]);
+        }
+    }
+
+    double total_time = 0.0;
+
+    for (float frame_time : frame_times)
+    {
+        total_time += frame_time;
+    }
+
+    // Averages of render counters
+    double draws = 0.0;
+    double triangles = 0.0;
+    double vertex_invocations = 0.0;
+    double clipping_primitives = 0.0;
+    double overdraw = 0.0;
+
+    for (BenchmarkFrame& frame : m_frames)
+    {
+        draws += frame.draws;
+        triangles += frame.triangles;
+        vertex_invocations += frame.vertex_invocations;
+        clipping_primitives += frame.clipping_primitives;
+        overdraw += frame.overdraw;
+    }
+
+    double frames_count = std::max((double)m_frames.size(), 1.0);
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"device\": \"%s\",\n", 
+            vulkan_context->getDeviceProperties().deviceName);
+    fprintf(file, "  \"width\": %u,\n", 
+            vulkan_context->getSwapChainExtent().width);
+    fprintf(file, "  \"height\": %u,\n", 
+            vulkan_context->getSwapChainExtent().height);
+    fprintf(file, "  \"frames\": %u,\n", (unsigned int)m_frames.size());
+    fprintf(file, "  \"warmup_frames\": %u,\n", BENCHMARK_WARMUP_FRAMES);
+    fprintf(file, "  \"draw_calls\": %u,\n", renderer->getDrawCallsCount());
+    fprintf(file, "  \"load_time\": %.3f,\n", m_load_time);
+    fprintf(file, "  \"total_time\": %.3f,\n", total_time);
+    fprintf(file, "  \"fps\": %.2f,\n", 
+            total_time > 0.0 ? m_frames.size() * 1000.0 / total_time : 0.0);
+    fprintf(file, "  \"counters\": {\"draws\": %.1f, \"triangles\": %.1f, "
+            "\"vertex_invocations\": %.1f, \"clipping_primitives\": %.1f, "
+            "\"overdraw\": %.3f},\n", draws / frames_count, 
+            triangles / frames_count, vertex_invocations / frames_count,
+            clipping_primitives / frames_count, overdraw / frames_count);
+    const float mb = 1024.0f * 1024.0f;
+    MemoryStats memory_stats = vulkan_context->getTotalMemoryStats();
+
+    fprintf(file, "  \"memory\": {\"total\": %.2f, \"peak\": %.2f", 
+            memory_stats.size / mb, memory_stats.peak_size / mb);
+
+    for (unsigned int i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+    {
+        MemoryCategory category = (MemoryCategory)i;
+        fprintf(file, ", \"%s\": %.2f", 
+                VulkanContext::getMemoryCategoryName(category),
+                vulkan_context->getMemoryStats(category).size / mb);
+    }
+
+    fprintf(file, "},\n");
+    fprintf(file, "  \"times\": {\n");
+    writeTimes(file, "frame", frame_times, false);
+    writeTimes(file, "gpu", gpu_times, false);
+    writeTimes(file, "events", phase_times[BENCHMARK_PHASE_EVENTS], false);
+    writeTimes(file, "update", phase_times[BENCHMARK_PHASE_UPDATE], false);
+    writeTimes(file, "draw", phase_times[BENCHMARK_PHASE_DRAW], true);
+    fprintf(file, "  },\n");
+    fprintf(file, "  \"gpu_scopes\": {\n");
+
+    for (auto it = m_gpu_scope_times.begin(); it != m_gpu_scope_times.end(); 
+         it++)
+    {
+        writeTimes(file, it->first.c_str(), it->second, 
+                   std::next(it) == m_gpu_scope_times.end());
+    }
+
+    fprintf(file, "  }\n");
+    fprintf(file, "}\n");
+
+    fclose(file);
+
+    std::sort(frame_times.begin(), frame_times.end());
+
+    printf("Benchmark: %u frames, %.2f ms average, p99 %.2f ms, "
+           "report written to %s\n", (unsigned int)m_frames.size(),
+           m_frames.empty() ? 0.0f : (float)(total_time / m_frames.size()),
+           getPercentile(frame_times, 99.0f), filename.c_str());
+
+    return true;
+}
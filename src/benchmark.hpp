@@ -0,0 +1,99 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+
+enum BenchmarkPhase
+{
+    BENCHMARK_PHASE_EVENTS = 0,
+    BENCHMARK_PHASE_UPDATE,
+    BENCHMARK_PHASE_DRAW,
+    BENCHMARK_PHASE_COUNT
+};
+
+struct BenchmarkKeyframe
+{
+    glm::vec3 position;
+    float horizontal_angle;
+    float vertical_angle;
+};
+
+// Times in milliseconds
+struct BenchmarkFrame
+{
+    float frame_time;
+    float phase_times[BENCHMARK_PHASE_COUNT];
+    unsigned int draws;
+    unsigned int triangles;
+    uint64_t vertex_invocations;
+    uint64_t clipping_primitives;
+    float overdraw;
+};
+
+const unsigned int BENCHMARK_DEFAULT_FRAMES = 1000;
+const unsigned int BENCHMARK_WARMUP_FRAMES = 10;
+
+// Moves the camera along a Catmull-Rom spline through keyframes, driven by the
+// frame number and not by time, so that every run renders the same frames.
+// The path is traversed once over all frames. Warmup frames are rendered but
+// not included in the report.
+class Benchmark
+{
+private:
+    unsigned int m_frames_count;
+    unsigned int m_current_frame;
+    std::vector<BenchmarkKeyframe> m_path;
+    std::vector<BenchmarkFrame> m_frames;
+    std::map<std::string, std::vector<float> > m_gpu_scope_times;
+    std::map<std::string, uint64_t> m_gpu_scope_samples;
+    BenchmarkFrame m_frame;
+    float m_load_time;
+    unsigned long m_frame_start_time;
+    unsigned long m_phase_start_time;
+
+    static Benchmark* m_benchmark;
+
+    void createDefaultPath();
+    BenchmarkKeyframe getKeyframe(float t);
+
+public:
+    Benchmark(unsigned int frames_count);
+    ~Benchmark();
+
+    bool loadPath(std::string filename);
+    void beginFrame();
+    void endFrame();
+    void beginPhase();
+    void endPhase(BenchmarkPhase phase);
+    bool writeReport(std::string filename);
+
+    void setLoadTime(float load_time) {m_load_time = load_time;}
+    bool isFinished() {return m_current_frame >= m_frames_count;}
+
+    static Benchmark* getBenchmark() {return m_benchmark;}
+};
+
+#endif
@@ -30,9 +30,14 @@ Camera::Camera(unsigned int width, unsigned int height)
     m_up = glm::vec3(0.0f, 1.0f, 0.0f);
     m_horizontal_angle = M_PI/2;
     m_vertical_angle = 0;
+    m_fov = glm::radians(50.0f);
+    m_near = 0.1f;
+    m_far = 100.0f;
     
     m_original_width = width;
     m_original_height = height;
+    m_viewport_width = width;
+    m_viewport_height = height;
 
     rotate(0, 0);
     update(width, height);
@@ -58,6 +63,14 @@ void Camera::rotate(float horizontal, float vertical)
     m_up = glm::cross(m_right, m_direction);
 }
 
+void Camera::setRotation(float horizontal, float vertical)
+{
+    m_horizontal_angle = horizontal;
+    m_vertical_angle = vertical;
+
+    rotate(0, 0);
+}
+
 void Camera::moveForward(float value)
 {
     m_position.x += m_direction.x * value;
@@ -84,10 +97,13 @@ void Camera::moveLeft(float value)
 
 void Camera::update(unsigned int width, unsigned int height)
 {
+    m_viewport_width = width;
+    m_viewport_height = height;
+
     float ratio = ((float)width * m_original_height) / 
                   ((float)height * m_original_width);
 
-    m_proj_matrix = glm::perspective(glm::radians(50.0f), ratio, 0.1f, 100.0f);
+    m_proj_matrix = glm::perspective(m_fov, ratio, m_near, m_far);
     m_proj_matrix[1][1] *= -1;
     
     m_view_matrix = glm::lookAt(glm::vec3(m_position.x,
@@ -99,4 +115,34 @@ void Camera::update(unsigned int width, unsigned int height)
                                 glm::vec3(m_up.x,
                                           m_up.y,
                                           m_up.z));
+
+    updateFrustumPlanes();
+}
+
+void Camera::updateFrustumPlanes()
+{
+    glm::mat4 m = glm::transpose(m_proj_matrix * m_view_matrix);
+
+    m_frustum_planes[0] = m[3] + m[0];
+    m_frustum_planes[1] = m[3] - m[0];
+    m_frustum_planes[2] = m[3] + m[1];
+    m_frustum_planes[3] = m[3] - m[1];
+    m_frustum_planes[4] = m[2];
+    m_frustum_planes[5] = m[3] - m[2];
+
+    for (glm::vec4& plane : m_frustum_planes)
+    {
+        plane /= glm::length(glm::vec3(plane));
+    }
+}
+
+bool Camera::isSphereVisible(glm::vec3 center, float radius)
+{
+    for (glm::vec4& plane : m_frustum_planes)
+    {
+        if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+            return false;
+    }
+
+    return true;
 }
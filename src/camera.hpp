@@ -35,9 +35,17 @@ private:
     glm::vec3 m_up;
     float m_horizontal_angle;
     float m_vertical_angle;
+    float m_fov;
+    float m_near;
+    float m_far;
+    glm::vec4 m_frustum_planes[6];
     
     unsigned int m_original_width;
     unsigned int m_original_height;
+    unsigned int m_viewport_width;
+    unsigned int m_viewport_height;
+
+    void updateFrustumPlanes();
 
     static Camera* m_camera;
 
@@ -50,12 +58,21 @@ public:
     void moveBackward(float amount);
     void moveLeft(float amount);
     void moveRight(float amount);
+    void setPosition(glm::vec3 position) {m_position = position;}
+    void setRotation(float horizontal, float vertical);
 
     void update(unsigned int width, unsigned int height);
+    bool isSphereVisible(glm::vec3 center, float radius);
 
     glm::vec3 getCameraPos() {return m_position;}
     glm::mat4 getViewMatrix() {return m_view_matrix;}
     glm::mat4 getProjMatrix() {return m_proj_matrix;}
+    const glm::vec4* getFrustumPlanes() {return m_frustum_planes;}
+    float getHorizontalAngle() {return m_horizontal_angle;}
+    float getVerticalAngle() {return m_vertical_angle;}
+    float getFov() {return m_fov;}
+    unsigned int getViewportWidth() {return m_viewport_width;}
+    unsigned int getViewportHeight() {return m_viewport_height;}
 
     static Camera* getCamera() {return m_camera;}
 };
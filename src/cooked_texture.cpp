@@ -0,0 +1,132 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "cooked_texture.hpp"
+
+#include <algorithm>
+
+std::string CookedTexture::getCookedPath(std::string filename)
+{
+    std::string cooked_path = "cooked/" + filename;
+
+    std::size_t pos = cooked_path.rfind(".");
+
+    if (pos != std::string::npos && pos > cooked_path.rfind("/"))
+    {
+        cooked_path = cooked_path.substr(0, pos);
+    }
+
+    return cooked_path + ".tex";
+}
+
+uint64_t CookedTexture::computeHash(const char* data, int length)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+bool CookedTexture::checkHeader(const CookedTextureHeader* header, int length)
+{
+    if (length < (int)sizeof(CookedTextureHeader))
+        return false;
+
+    if (header->magic != COOKED_TEXTURE_MAGIC ||
+        header->version != COOKED_TEXTURE_VERSION)
+        return false;
+
+    if (header->mip_levels < 1 || header->mip_levels > COOKED_TEXTURE_MAX_MIPS)
+        return false;
+
+    if (header->channels < 1 || header->channels > 4)
+        return false;
+
+    for (unsigned int i = 0; i < header->mip_levels; i++)
+    {
+        const CookedTextureMip& mip = header->mips[i];
+
+        if (mip.offset % getMipAlignment(header->channels) != 0 ||
+            (uint64_t)mip.offset + mip.size > (uint64_t)length)
+            return false;
+
+        if (mip.size != mip.width * mip.height * header->channels)
+            return false;
+    }
+
+    return true;
+}
+
+unsigned int CookedTexture::getMipAlignment(unsigned int channels)
+{
+    // 3 bytes per texel, lcm(3, 16)
+    if (channels == 3)
+        return COOKED_TEXTURE_ALIGNMENT * 3;
+
+    return COOKED_TEXTURE_ALIGNMENT;
+}
+
+unsigned int CookedTexture::getMipLevelsCount(unsigned int width,
+                                              unsigned int height)
+{
+    unsigned int size = std::max(width, height);
+    unsigned int levels = 1;
+
+    while (size > 1 && levels < COOKED_TEXTURE_MAX_MIPS)
+    {
+        size /= 2;
+        levels++;
+    }
+
+    return levels;
+}
+
+void CookedTexture::generateMip(const unsigned char* src,
+                                unsigned int src_width,
+                                unsigned int src_height,
+                                unsigned int channels, unsigned char* dst)
+{
+    unsigned int dst_width = std::max(src_width / 2, 1u);
+    unsigned int dst_height = std::max(src_height / 2, 1u);
+
+    for (unsigned int y = 0; y < dst_height; y++)
+    {
+        unsigned int y0 = std::min(y * 2, src_height - 1);
+        unsigned int y1 = std::min(y * 2 + 1, src_height - 1);
+
+        for (unsigned int x = 0; x < dst_width; x++)
+        {
+            unsigned int x0 = std::min(x * 2, src_width - 1);
+            unsigned int x1 = std::min(x * 2 + 1, src_width - 1);
+
+            for (unsigned int c = 0; c < channels; c++)
+            {
+                unsigned int sum = src[(y0 * src_width + x0) * channels + c] +
+                                   src[(y0 * src_width + x1) * channels + c] +
+                                   src[(y1 * src_width + x0) * channels + c] +
+                                   src[(y1 * src_width + x1) * channels + c];
+
+                dst[(y * dst_width + x) * channels + c] = (sum + 2) / 4;
+            }
+        }
+    }
+}
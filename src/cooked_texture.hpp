@@ -0,0 +1,69 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COOKED_TEXTURE_HPP
+#define COOKED_TEXTURE_HPP
+
+#include <cstdint>
+#include <string>
+
+// Cooked texture is a single blob that can be read (or mapped) straight into
+// a staging buffer. The header is followed by a full mip chain with 8 bits per
+// channel and the same channels count as the source image, every level 
+// starting at an offset aligned to getMipAlignment() from the beginning of the
+// file. Differences between mip offsets are used as buffer offsets for image
+// copies, so they must be multiples of both 4 and the texel size.
+
+const uint32_t COOKED_TEXTURE_MAGIC = 0x58455456; // "VTEX"
+const uint32_t COOKED_TEXTURE_VERSION = 3;
+const unsigned int COOKED_TEXTURE_MAX_MIPS = 16;
+const unsigned int COOKED_TEXTURE_ALIGNMENT = 16;
+
+struct CookedTextureMip
+{
+    uint32_t offset;
+    uint32_t size;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct CookedTextureHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_hash;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t mip_levels;
+    CookedTextureMip mips[COOKED_TEXTURE_MAX_MIPS];
+};
+
+class CookedTexture
+{
+public:
+    static std::string getCookedPath(std::string filename);
+    static uint64_t computeHash(const char* data, int length);
+    static bool checkHeader(const CookedTextureHeader* header, int length);
+    static unsigned int getMipAlignment(unsigned int channels);
+    static unsigned int getMipLevelsCount(unsigned int width,
+                                          unsigned int height);
+    static void generateMip(const unsigned char* src, unsigned int src_width,
+                            unsigned int src_height, unsigned int channels,
+                            unsigned char* dst);
+};
+
+#endif
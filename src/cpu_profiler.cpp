@@ -0,0 +1,140 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "cpu_profiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <time.h>
+
+CpuProfiler* CpuProfiler::m_cpu_profiler = nullptr;
+
+// Thread buffer is looked up again when a new profiler is created
+static thread_local CpuProfilerThread* g_profiler_thread = nullptr;
+static thread_local CpuProfiler* g_profiler_thread_owner = nullptr;
+
+CpuProfiler::CpuProfiler()
+{
+    m_enabled = false;
+
+    m_cpu_profiler = this;
+}
+
+CpuProfiler::~CpuProfiler()
+{
+    m_cpu_profiler = nullptr;
+
+    for (CpuProfilerThread* thread : m_threads)
+    {
+        delete thread;
+    }
+}
+
+uint64_t CpuProfiler::getNanoTickCount()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+CpuProfilerThread* CpuProfiler::getThread()
+{
+    if (g_profiler_thread_owner == this)
+        return g_profiler_thread;
+
+    CpuProfilerThread* thread = new CpuProfilerThread();
+    thread->write_pos = 0;
+
+    std::lock_guard<std::mutex> lock(m_threads_mutex);
+    thread->thread_id = (unsigned int)m_threads.size() + 1;
+    m_threads.push_back(thread);
+
+    g_profiler_thread = thread;
+    g_profiler_thread_owner = this;
+
+    return thread;
+}
+
+void CpuProfiler::addEvent(const char* name, uint64_t begin_time, 
+                           uint64_t end_time)
+{
+    CpuProfilerThread* thread = getThread();
+
+    uint64_t pos = thread->write_pos.load(std::memory_order_relaxed);
+
+    CpuProfilerEvent& event = thread->events[pos % CPU_PROFILER_BUFFER_SIZE];
+    event.name = name;
+    event.begin_time = begin_time;
+    event.end_time = end_time;
+
+    thread->write_pos.store(pos + 1, std::memory_order_release);
+}
+
+// Chrome trace event format, can be opened in chrome://tracing or Perfetto
+bool CpuProfiler::writeTrace(std::string filename)
+{
+    FILE* file = fopen(filename.c_str(), "w");
+
+    if (file == nullptr)
+    {
+        printf("Error: Couldn't open trace file: %s\n", filename.c_str());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_threads_mutex);
+
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    bool first = true;
+    unsigned int events_count = 0;
+
+    for (CpuProfilerThread* thread : m_threads)
+    {
+        uint64_t write_pos = thread->write_pos.load(std::memory_order_acquire);
+
+        // Oldest events may be overwritten while they are read, so leave
+        // some margin
+        uint64_t margin = CPU_PROFILER_BUFFER_SIZE / 16;
+        uint64_t read_pos = write_pos > CPU_PROFILER_BUFFER_SIZE - margin ? 
+                            write_pos - (CPU_PROFILER_BUFFER_SIZE - margin) : 0;
+
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                "\"tid\":%u,\"args\":{\"name\":\"Thread %u\"}}", 
+                first ? "" : ",\n", thread->thread_id, thread->thread_id);
+        first = false;
+
+        for (uint64_t i = read_pos; i < write_pos; i++)
+        {
+            const CpuProfilerEvent& event = 
+                                thread->events[i % CPU_PROFILER_BUFFER_SIZE];
+
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                    "\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", event.name, 
+                    thread->thread_id, event.begin_time / 1000.0, 
+                    (event.end_time - event.begin_time) / 1000.0);
+            events_count++;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    printf("Trace with %u events written to %s\n", events_count, 
+           filename.c_str());
+
+    return true;
+}
@@ -0,0 +1,107 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CPU_PROFILER_HPP
+#define CPU_PROFILER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Names must be string literals, only the pointer is stored
+struct CpuProfilerEvent
+{
+    const char* name;
+    uint64_t begin_time;
+    uint64_t end_time;
+};
+
+const unsigned int CPU_PROFILER_BUFFER_SIZE = 65536;
+
+// Ring buffer written only by its own thread. The write position is
+// published after the event, so the buffer can be read while recording.
+struct CpuProfilerThread
+{
+    unsigned int thread_id;
+    std::atomic<uint64_t> write_pos;
+    CpuProfilerEvent events[CPU_PROFILER_BUFFER_SIZE];
+};
+
+// Records scopes marked with CPU_PROFILER_SCOPE into per thread ring
+// buffers, so recording doesn't take any locks after the first event of a
+// thread. Timestamps are in nanoseconds from CLOCK_MONOTONIC, the same clock
+// as Device::getMicroTickCount(). Without a profiler object, or when it's
+// disabled, scopes cost a single check.
+class CpuProfiler
+{
+private:
+    std::atomic<bool> m_enabled;
+    std::mutex m_threads_mutex;
+    std::vector<CpuProfilerThread*> m_threads;
+
+    static CpuProfiler* m_cpu_profiler;
+
+    CpuProfilerThread* getThread();
+
+public:
+    CpuProfiler();
+    ~CpuProfiler();
+
+    void addEvent(const char* name, uint64_t begin_time, uint64_t end_time);
+    bool writeTrace(std::string filename);
+
+    void setEnabled(bool enabled) {m_enabled = enabled;}
+    bool isEnabled() {return m_enabled;}
+
+    static uint64_t getNanoTickCount();
+    static CpuProfiler* getCpuProfiler() {return m_cpu_profiler;}
+};
+
+class CpuProfilerScope
+{
+private:
+    const char* m_name;
+    uint64_t m_begin_time;
+
+public:
+    CpuProfilerScope(const char* name)
+    {
+        CpuProfiler* cpu_profiler = CpuProfiler::getCpuProfiler();
+        m_name = (cpu_profiler != nullptr && cpu_profiler->isEnabled()) ? 
+                 name : nullptr;
+        m_begin_time = m_name ? CpuProfiler::getNanoTickCount() : 0;
+    }
+
+    ~CpuProfilerScope()
+    {
+        CpuProfiler* cpu_profiler = CpuProfiler::getCpuProfiler();
+
+        if (m_name == nullptr || cpu_profiler == nullptr)
+            return;
+
+        cpu_profiler->addEvent(m_name, m_begin_time, 
+                               CpuProfiler::getNanoTickCount());
+    }
+};
+
+#define CPU_PROFILER_CONCAT_(a, b) a##b
+#define CPU_PROFILER_CONCAT(a, b) CPU_PROFILER_CONCAT_(a, b)
+#define CPU_PROFILER_SCOPE(name) \
+    CpuProfilerScope CPU_PROFILER_CONCAT(cpu_profiler_scope_, __LINE__)(name)
+
+#endif
@@ -0,0 +1,40 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "device_headless.hpp"
+
+DeviceHeadless::DeviceHeadless()
+{
+    m_close = false;
+    m_cursor_x = 0;
+    m_cursor_y = 0;
+}
+
+bool DeviceHeadless::initDevice(const CreationParams& creation_params)
+{
+    m_creation_params = creation_params;
+
+    if (creation_params.window_width <= 0 || creation_params.window_height <= 0)
+        return false;
+
+    m_window_width = creation_params.window_width;
+    m_window_height = creation_params.window_height;
+    m_video_desktop = VideoMode(m_window_width, m_window_height, 32);
+    m_video_modes.push_back(m_video_desktop);
+
+    return true;
+}
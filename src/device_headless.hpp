@@ -0,0 +1,62 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef DEVICE_HEADLESS_HPP
+#define DEVICE_HEADLESS_HPP
+
+#include "device.hpp"
+
+// Device without a window and input, used for offscreen rendering
+class DeviceHeadless : public Device
+{
+private:
+    bool m_close;
+    int m_cursor_x;
+    int m_cursor_y;
+
+public:
+    DeviceHeadless();
+    ~DeviceHeadless() {};
+
+    bool initDevice(const CreationParams& creation_params);
+    void closeDevice() {m_close = true;}
+    bool processEvents() {return !m_close;}
+    void clearSystemMessages() {};
+
+    void setWindowCaption(const char* text) {};
+    void setWindowClass(const char* text) {};
+    void setWindowFullscreen(bool fullscreen) {};
+    void setWindowResizable(bool resizable) {};
+    bool isWindowActive() {return true;}
+    bool isWindowFocused() {return true;}
+    bool isWindowMinimized() {return false;}
+    bool isWindowFullscreen() {return false;}
+    bool setWindowPosition(int x, int y) {return false;}
+    bool getWindowPosition(int* x, int* y) {return false;}
+    void setWindowMinimized() {};
+    void setWindowMaximized() {};
+
+    std::string getClipboardContent() {return "";}
+    void setClipboardContent(std::string text) {};
+
+    void setCursorVisible(bool visible) {};
+    bool isCursorVisible() {return false;}
+    void setCursorPosition(int x, int y) {m_cursor_x = x; m_cursor_y = y;}
+    void getCursorPosition(int* x, int* y) {*x = m_cursor_x; *y = m_cursor_y;}
+};
+
+#endif
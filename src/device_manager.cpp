@@ -15,6 +15,7 @@
 //    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "device_android.hpp"
+#include "device_headless.hpp"
 #include "device_linux.hpp"
 #include "device_manager.hpp"
 
@@ -30,6 +31,14 @@ DeviceManager::DeviceManager()
     m_device_manager = this;
     m_device = nullptr;
     m_vulkan_context = nullptr;
+    m_frames_in_flight = 2;
+    m_headless = false;
+
+    m_swap_chain_params.vsync = true;
+    m_swap_chain_params.low_latency = false;
+    m_swap_chain_params.force_present_mode = false;
+    m_swap_chain_params.present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    m_swap_chain_params.images_count = 0;
 }
 
 DeviceManager::~DeviceManager()
@@ -67,7 +76,7 @@ bool DeviceManager::initWindow()
     params.window_width = 1280;
     params.window_height = 720;
     params.fullscreen = false;
-    params.vsync = true;
+    params.vsync = m_swap_chain_params.vsync;
     params.handle_srgb = false;
     params.alpha_channel = false;
     params.force_legacy_device = false;
@@ -80,13 +89,20 @@ bool DeviceManager::initWindow()
 #endif
     params.joystick_support = false;
 
+    if (m_headless)
+    {
+        m_device = new DeviceHeadless();
+    }
+    else
+    {
 #if (defined(__linux__) || defined(__CYGWIN__)) && !defined(ANDROID)
-    m_device = new DeviceLinux();
+        m_device = new DeviceLinux();
 #elif defined(ANDROID)
-    m_device = new DeviceAndroid();
+        m_device = new DeviceAndroid();
 #else
-    #error Unsupported architecture
+        #error Unsupported architecture
 #endif
+    }
 
     bool success = m_device->initDevice(params);
 
@@ -104,23 +120,33 @@ bool DeviceManager::initWindow()
 
 bool DeviceManager::initVulkanContext()
 {
+    if (m_headless)
+    {
+        m_vulkan_context = new VulkanContext(m_device->getWindowWidth(),
+                                             m_device->getWindowHeight());
+    }
+    else
+    {
 #if (defined(__linux__) || defined(__CYGWIN__)) && !defined(ANDROID)
-    DeviceLinux* device_linux = (DeviceLinux*)m_device;
+        DeviceLinux* device_linux = (DeviceLinux*)m_device;
 
-    m_vulkan_context = new VulkanContext(device_linux->getDisplay(),
-                                         device_linux->getWindow(),
-                                         device_linux->getWindowWidth(),
-                                         device_linux->getWindowHeight());
+        m_vulkan_context = new VulkanContext(device_linux->getDisplay(),
+                                             device_linux->getWindow(),
+                                             device_linux->getWindowWidth(),
+                                             device_linux->getWindowHeight());
 #elif defined(ANDROID)
-    DeviceAndroid* device_android = (DeviceAndroid*)m_device;
-    
-    m_vulkan_context = new VulkanContext(g_android_app->window,
-                                         device_android->getWindowWidth(),
-                                         device_android->getWindowHeight());
+        DeviceAndroid* device_android = (DeviceAndroid*)m_device;
+
+        m_vulkan_context = new VulkanContext(g_android_app->window,
+                                             device_android->getWindowWidth(),
+                                             device_android->getWindowHeight());
 #else
-    #error Unsupported architecture
+        #error Unsupported architecture
 #endif
+    }
 
+    m_vulkan_context->setSwapChainParams(m_swap_chain_params);
+    m_vulkan_context->setFramesInFlight(m_frames_in_flight);
     bool success = m_vulkan_context->init();
 
     return success;
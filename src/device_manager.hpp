@@ -26,6 +26,9 @@ private:
     static Device* m_device;
     VulkanContext* m_vulkan_context;
     static DeviceManager* m_device_manager;
+    SwapChainParams m_swap_chain_params;
+    unsigned int m_frames_in_flight;
+    bool m_headless;
     
     bool initWindow();
     bool initVulkanContext();
@@ -38,6 +41,9 @@ public:
     Device* getDevice() {return m_device;}
     VulkanContext* getVulkanContext() { return m_vulkan_context;}
     void printDeviceInfo();
+    void setSwapChainParams(const SwapChainParams& params) {m_swap_chain_params = params;}
+    void setFramesInFlight(unsigned int frames_in_flight) {m_frames_in_flight = frames_in_flight;}
+    void setHeadless(bool headless) {m_headless = headless;}
     
     static DeviceManager* getDeviceManager() {return m_device_manager;}
 };
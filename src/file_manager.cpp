@@ -14,6 +14,7 @@
 //    You should have received a copy of the GNU General Public License
 //    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include "cpu_profiler.hpp"
 #include "file_manager.hpp"
 
 #include <cstdlib>
@@ -89,6 +90,8 @@ bool FileManager::createAssetsList()
 
 File* FileManager::loadFile(std::string filename)
 {
+    CPU_PROFILER_SCOPE("FileManager::loadFile");
+
     std::string file_path = data_dir + filename;
     
     File* file = loadFileFromAssets(file_path);
@@ -185,6 +188,153 @@ void FileManager::closeFile(File* file)
     delete file;
 }
 
+int FileManager::getFileLength(std::string filename)
+{
+    std::string file_path = data_dir + filename;
+    
+    int length = getFileLengthFromAssets(file_path);
+    
+    if (length >= 0)
+        return length;
+    
+    struct stat stat_info;
+    int err = stat(file_path.c_str(), &stat_info);
+    
+    if (err != 0 || !S_ISREG(stat_info.st_mode))
+        return -1;
+    
+    return (int)stat_info.st_size;
+}
+
+bool FileManager::readFile(std::string filename, void* data, int length,
+                           int offset)
+{
+    std::string file_path = data_dir + filename;
+    
+    bool success = readFileFromAssets(file_path, data, length, offset);
+    
+    if (success)
+        return true;
+    
+    std::ifstream is;
+    is.open(file_path.c_str(), std::ios::binary);
+    
+    if (!is.good())
+    {
+        printf("Error: Could not open file %s\n", file_path.c_str());
+        is.close();
+        return false;
+    }
+    
+    is.seekg(offset, std::ios::beg);
+    is.read((char*)data, length);
+    success = (is.gcount() == length);
+    is.close();
+    
+    if (!success)
+    {
+        printf("Error: Could not read file %s\n", file_path.c_str());
+    }
+    
+    return success;
+}
+
+bool FileManager::writeFile(std::string filename, const void* data, 
+                            int length)
+{
+    std::string file_path = data_dir + filename;
+    std::string dir_path = getDirectoryPath(file_path);
+    
+    bool success = createDirectoryRecursive(dir_path);
+    
+    if (!success)
+    {
+        printf("Error: Couldn't create directory: %s\n", dir_path.c_str());
+        return false;
+    }
+
+    std::fstream out_file(file_path, std::ios::out | std::ios::binary);
+    
+    if (!out_file.good())
+    {
+        printf("Error: Couldn't open file: %s\n", file_path.c_str());
+        return false;
+    }
+    
+    out_file.write((const char*)data, length);
+
+    if (out_file.fail())
+    {
+        printf("Error: Couldn't write to file: %s\n", file_path.c_str());
+        success = false;
+    }
+
+    out_file.close();
+    
+    return success;
+}
+
+int FileManager::getFileLengthFromAssets(std::string file_path)
+{
+#ifdef ANDROID
+    if (g_android_app == nullptr)
+        return -1;
+    
+    AAssetManager* asset_manager = g_android_app->activity->assetManager;
+    
+    if (asset_manager == nullptr)
+        return -1;
+    
+    AAsset* asset = AAssetManager_open(asset_manager, file_path.c_str(),
+                                       AASSET_MODE_UNKNOWN);
+
+    if (asset == nullptr)
+        return -1;
+    
+    int length = AAsset_getLength(asset);
+    AAsset_close(asset);
+    
+    return length;
+    
+#else
+    return -1;
+#endif
+}
+
+bool FileManager::readFileFromAssets(std::string file_path, void* data, 
+                                     int length, int offset)
+{
+#ifdef ANDROID
+    if (g_android_app == nullptr)
+        return false;
+    
+    AAssetManager* asset_manager = g_android_app->activity->assetManager;
+    
+    if (asset_manager == nullptr)
+        return false;
+    
+    AAsset* asset = AAssetManager_open(asset_manager, file_path.c_str(),
+                                       AASSET_MODE_STREAMING);
+
+    if (asset == nullptr)
+        return false;
+    
+    if (AAsset_seek(asset, offset, SEEK_SET) != offset)
+    {
+        AAsset_close(asset);
+        return false;
+    }
+    
+    int read_length = AAsset_read(asset, data, length);
+    AAsset_close(asset);
+    
+    return (read_length == length);
+    
+#else
+    return false;
+#endif
+}
+
 
 void FileManager::getFileList(std::string dir_name, 
                               std::vector<std::string>& file_list)
@@ -34,6 +34,9 @@ private:
     
     bool createAssetsList();
     File* loadFileFromAssets(std::string file_path);
+    int getFileLengthFromAssets(std::string file_path);
+    bool readFileFromAssets(std::string file_path, void* data, int length,
+                            int offset);
     void getFileList(std::string dir_name, std::vector<std::string>& file_list);
     
 public:
@@ -43,6 +46,10 @@ public:
     bool init();
     File* loadFile(std::string filename);
     void closeFile(File* file);
+    int getFileLength(std::string filename);
+    bool readFile(std::string filename, void* data, int length, 
+                  int offset = 0);
+    bool writeFile(std::string filename, const void* data, int length);
     bool extractFromAssets(std::string filename, std::string base_dir, 
                            std::string dest_dir);
     std::vector<std::string>& getAssetsList() {return m_assets_list;}
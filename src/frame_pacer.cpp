@@ -0,0 +1,362 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "device_manager.hpp"
+#include "frame_pacer.hpp"
+#include "gpu_profiler.hpp"
+#include "metrics.hpp"
+#include "renderer.hpp"
+#include "vulkan_context.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sched.h>
+
+FramePacer* FramePacer::m_frame_pacer = nullptr;
+
+FramePacer::FramePacer()
+{
+    m_target_fps = 0.0f;
+    m_print_stats = false;
+    m_low_latency = false;
+    m_frame_start_time = 0;
+    m_next_frame_time = 0;
+    m_cpu_time = 0.0f;
+    m_gpu_time = 0.0f;
+    m_present_latency = 0.0f;
+    m_frame_times_pos = 0;
+    m_input_latencies_pos = 0;
+    m_stats = {};
+
+    Metrics* metrics = Metrics::getMetrics();
+    m_frames_metric = metrics->getCounter("renderer_frames_total", 
+                                          "Rendered frames");
+    m_frame_time_metric = metrics->getHistogram("renderer_frame_time_ms",
+                                "Time between frame starts in milliseconds",
+                                {2, 4, 8, 12, 16.7, 20, 25, 33.3, 50, 100, 250});
+    m_fps_metric = metrics->getGauge("renderer_fps", 
+                                "Frames per second over the last frames");
+    m_cpu_time_metric = metrics->getGauge("renderer_cpu_time_ms",
+                                "Average CPU time of the last frames");
+    m_gpu_time_metric = metrics->getGauge("renderer_gpu_time_ms",
+                                "Average GPU time of the last frames");
+    m_input_latency_metric = metrics->getGauge("renderer_input_latency_ms",
+                                "Average input to present latency");
+
+    m_frame_pacer = this;
+}
+
+FramePacer::~FramePacer()
+{
+    m_frame_pacer = nullptr;
+}
+
+void FramePacer::setTargetFps(float target_fps)
+{
+    m_target_fps = std::max(target_fps, 0.0f);
+    m_next_frame_time = 0;
+}
+
+void FramePacer::waitUntil(unsigned long time)
+{
+    Device* device = DeviceManager::getDeviceManager()->getDevice();
+
+    // Sleep is not precise, so the last millisecond is spent yielding
+    while (true)
+    {
+        unsigned long now = device->getMicroTickCount();
+
+        if (now >= time)
+            break;
+
+        if (time - now > 2000)
+        {
+            device->sleep((unsigned int)((time - now - 1000) / 1000));
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+}
+
+void FramePacer::waitForPresent()
+{
+    Device* device = DeviceManager::getDeviceManager()->getDevice();
+    VulkanContext* vulkan_context = VulkanContext::getVulkanContext();
+
+    // Allow one frame in the presentation queue, so that the GPU doesn't run
+    // dry while the CPU prepares the next frame
+    uint64_t present_id = vulkan_context->getPresentId();
+
+    if (!m_low_latency && present_id > 0)
+    {
+        present_id--;
+    }
+
+    if (present_id == 0)
+        return;
+
+    bool success = vulkan_context->waitForPresent(present_id, 100000000);
+
+    if (!success)
+        return;
+
+    unsigned long now = device->getMicroTickCount();
+    unsigned int presented_count = 0;
+
+    for (PendingPresent& pending_present : m_pending_presents)
+    {
+        if (pending_present.present_id > present_id)
+            break;
+
+        addInputLatency((now - pending_present.input_time) / 1000.0f);
+        presented_count++;
+    }
+
+    m_pending_presents.erase(m_pending_presents.begin(), 
+                             m_pending_presents.begin() + presented_count);
+}
+
+void FramePacer::addInputLatency(float latency)
+{
+    if (m_input_latencies.size() < FRAME_PACER_WINDOW)
+    {
+        m_input_latencies.push_back(latency);
+    }
+    else
+    {
+        m_input_latencies[m_input_latencies_pos] = latency;
+    }
+
+    m_input_latencies_pos = (m_input_latencies_pos + 1) % FRAME_PACER_WINDOW;
+}
+
+void FramePacer::beginFrame()
+{
+    Device* device = DeviceManager::getDeviceManager()->getDevice();
+
+    waitForPresent();
+
+    if (m_target_fps > 0.0f)
+    {
+        unsigned long period = (unsigned long)(1000000.0f / m_target_fps);
+        unsigned long now = device->getMicroTickCount();
+
+        // Don't try to catch up after a long frame
+        if (m_next_frame_time == 0 || now > m_next_frame_time + period)
+        {
+            m_next_frame_time = now;
+        }
+        else
+        {
+            waitUntil(m_next_frame_time);
+        }
+
+        m_next_frame_time += period;
+    }
+
+    unsigned long now = device->getMicroTickCount();
+
+    if (m_frame_start_time > 0)
+    {
+        FrameTimes frame_times;
+        frame_times.frame_time = (now - m_frame_start_time) / 1000.0f;
+        frame_times.cpu_time = m_cpu_time;
+        frame_times.gpu_time = m_gpu_time;
+        frame_times.present_latency = m_present_latency;
+
+        if (m_frame_times.size() < FRAME_PACER_WINDOW)
+        {
+            m_frame_times.push_back(frame_times);
+        }
+        else
+        {
+            m_frame_times[m_frame_times_pos] = frame_times;
+        }
+
+        m_frame_times_pos = (m_frame_times_pos + 1) % FRAME_PACER_WINDOW;
+
+        m_frames_metric->add(1);
+        m_frame_time_metric->observe(frame_times.frame_time);
+
+        updateStats();
+
+        if (m_print_stats && m_frame_times_pos == 0)
+        {
+            printStats();
+        }
+    }
+
+    m_frame_start_time = now;
+}
+
+void FramePacer::endFrame()
+{
+    Device* device = DeviceManager::getDeviceManager()->getDevice();
+    VulkanContext* vulkan_context = VulkanContext::getVulkanContext();
+    Renderer* renderer = Renderer::getRenderer();
+
+    unsigned long now = device->getMicroTickCount();
+    unsigned long acquire_time = renderer->getAcquireTime();
+
+    m_cpu_time = (now - m_frame_start_time) / 1000.0f;
+    m_gpu_time = renderer->getGpuFrameTime();
+
+    // Nothing was presented if the swap chain is out of date
+    if (acquire_time < m_frame_start_time)
+        return;
+
+    m_present_latency = (now - acquire_time) / 1000.0f;
+
+    if (!vulkan_context->isPresentWaitSupported())
+    {
+        addInputLatency((now - m_frame_start_time) / 1000.0f);
+        return;
+    }
+
+    PendingPresent pending_present;
+    pending_present.present_id = vulkan_context->getPresentId();
+    pending_present.input_time = m_frame_start_time;
+    m_pending_presents.push_back(pending_present);
+
+    // Presents that timed out are never going to be reported
+    if (m_pending_presents.size() > FRAME_PACER_WINDOW)
+    {
+        m_pending_presents.erase(m_pending_presents.begin());
+    }
+}
+
+// Pending presents belong to the old swap chain and will never be reported
+void FramePacer::resetPresents()
+{
+    m_pending_presents.clear();
+}
+
+static FrameTimeStats computeStats(const std::vector<float>& times)
+{
+    FrameTimeStats stats = {};
+
+    if (times.empty())
+        return stats;
+
+    stats.min = *std::min_element(times.begin(), times.end());
+    stats.max = *std::max_element(times.begin(), times.end());
+
+    double sum = 0.0;
+
+    for (float time : times)
+    {
+        sum += time;
+    }
+
+    stats.average = (float)(sum / times.size());
+
+    double variance = 0.0;
+
+    for (float time : times)
+    {
+        variance += (time - stats.average) * (time - stats.average);
+    }
+
+    stats.deviation = (float)std::sqrt(variance / times.size());
+
+    return stats;
+}
+
+void FramePacer::updateStats()
+{
+    std::vector<float> frame_times;
+    std::vector<float> cpu_times;
+    std::vector<float> gpu_times;
+    std::vector<float> present_latencies;
+
+    for (FrameTimes& times : m_frame_times)
+    {
+        frame_times.push_back(times.frame_time);
+        cpu_times.push_back(times.cpu_time);
+        gpu_times.push_back(times.gpu_time);
+        present_latencies.push_back(times.present_latency);
+    }
+
+    m_stats.frame_time = computeStats(frame_times);
+    m_stats.cpu_time = computeStats(cpu_times);
+    m_stats.gpu_time = computeStats(gpu_times);
+    m_stats.present_latency = computeStats(present_latencies);
+    m_stats.input_latency = computeStats(m_input_latencies);
+    m_stats.frames_count = (unsigned int)m_frame_times.size();
+
+    if (m_stats.frame_time.average > 0.0f)
+    {
+        m_fps_metric->set(1000.0f / m_stats.frame_time.average);
+    }
+
+    m_cpu_time_metric->set(m_stats.cpu_time.average);
+    m_gpu_time_metric->set(m_stats.gpu_time.average);
+    m_input_latency_metric->set(m_stats.input_latency.average);
+}
+
+void FramePacer::printStats()
+{
+    printf("Frame: %.2f ms (deviation %.2f, min %.2f, max %.2f), "
+           "CPU: %.2f ms, GPU: %.2f ms\n", m_stats.frame_time.average,
+           m_stats.frame_time.deviation, m_stats.frame_time.min,
+           m_stats.frame_time.max, m_stats.cpu_time.average,
+           m_stats.gpu_time.average);
+    printf("Latency: acquire to present %.2f ms, input to present %.2f ms "
+           "(max %.2f)\n", m_stats.present_latency.average,
+           m_stats.input_latency.average, m_stats.input_latency.max);
+
+    Renderer* renderer = Renderer::getRenderer();
+    const RenderStats& render_stats = renderer->getRenderStats();
+
+    printf("Draws: %u, binds: %u, triangles: %u", render_stats.draws, 
+           render_stats.binds, render_stats.triangles);
+
+    if (render_stats.fragment_invocations > 0)
+    {
+        printf(", vertex invocations: %llu, clipped primitives: %llu, "
+               "overdraw: %.2f", 
+               (unsigned long long)render_stats.vertex_invocations,
+               (unsigned long long)render_stats.clipping_primitives,
+               renderer->getOverdraw());
+    }
+
+    printf("\n");
+
+    MemoryStats memory_stats = 
+                VulkanContext::getVulkanContext()->getTotalMemoryStats();
+
+    printf("GPU memory: %.2f MB (peak %.2f MB)\n", 
+           memory_stats.size / (1024.0f * 1024.0f), 
+           memory_stats.peak_size / (1024.0f * 1024.0f));
+
+    GpuProfiler* gpu_profiler = GpuProfiler::getGpuProfiler();
+
+    if (gpu_profiler == nullptr || gpu_profiler->getScopes().empty())
+        return;
+
+    printf("GPU scopes:");
+
+    for (const GpuProfilerScope& scope : gpu_profiler->getScopes())
+    {
+        printf(" %s %.2f ms", scope.name.c_str(), scope.average_time);
+    }
+
+    printf("\n");
+}
@@ -0,0 +1,118 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef FRAME_PACER_HPP
+#define FRAME_PACER_HPP
+
+#include <cstdint>
+#include <vector>
+
+struct FrameTimeStats
+{
+    float average;
+    float deviation;
+    float min;
+    float max;
+};
+
+// Times in milliseconds over the last FRAME_PACER_WINDOW frames. Present
+// latency is measured from image acquire to queue present and input latency
+// from the input sampling to the moment when present wait reports the frame
+// as presented (or to queue present when present wait is not available).
+struct FramePacerStats
+{
+    FrameTimeStats frame_time;
+    FrameTimeStats cpu_time;
+    FrameTimeStats gpu_time;
+    FrameTimeStats present_latency;
+    FrameTimeStats input_latency;
+    unsigned int frames_count;
+};
+
+struct FrameTimes
+{
+    float frame_time;
+    float cpu_time;
+    float gpu_time;
+    float present_latency;
+};
+
+struct PendingPresent
+{
+    uint64_t present_id;
+    unsigned long input_time;
+};
+
+class Metric;
+
+const unsigned int FRAME_PACER_WINDOW = 120;
+
+// Starts frames at a fixed rate instead of sleeping for a fixed time after
+// every frame, so that only the remaining part of the frame budget is spent
+// waiting. With target fps set to 0 frames are paced by the display, using
+// present wait when it's available. In low latency mode the next frame isn't
+// started until the previous one is presented.
+class FramePacer
+{
+private:
+    float m_target_fps;
+    bool m_print_stats;
+    bool m_low_latency;
+    unsigned long m_frame_start_time;
+    unsigned long m_next_frame_time;
+    float m_cpu_time;
+    float m_gpu_time;
+    float m_present_latency;
+    std::vector<FrameTimes> m_frame_times;
+    unsigned int m_frame_times_pos;
+    std::vector<PendingPresent> m_pending_presents;
+    std::vector<float> m_input_latencies;
+    unsigned int m_input_latencies_pos;
+    FramePacerStats m_stats;
+    Metric* m_frames_metric;
+    Metric* m_frame_time_metric;
+    Metric* m_fps_metric;
+    Metric* m_cpu_time_metric;
+    Metric* m_gpu_time_metric;
+    Metric* m_input_latency_metric;
+
+    static FramePacer* m_frame_pacer;
+
+    void waitUntil(unsigned long time);
+    void waitForPresent();
+    void addInputLatency(float latency);
+    void updateStats();
+    void printStats();
+
+public:
+    FramePacer();
+    ~FramePacer();
+
+    void beginFrame();
+    void endFrame();
+    void resetPresents();
+
+    void setTargetFps(float target_fps);
+    float getTargetFps() {return m_target_fps;}
+    void setPrintStats(bool print_stats) {m_print_stats = print_stats;}
+    void setLowLatency(bool low_latency) {m_low_latency = low_latency;}
+    const FramePacerStats& getStats() {return m_stats;}
+
+    static FramePacer* getFramePacer() {return m_frame_pacer;}
+};
+
+#endif
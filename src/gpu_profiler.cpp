@@ -0,0 +1,228 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "gpu_profiler.hpp"
+#include "vulkan_context.hpp"
+
+#include <cstdio>
+
+GpuProfiler* GpuProfiler::m_gpu_profiler = nullptr;
+
+GpuProfiler::GpuProfiler()
+{
+    m_gpu_profiler = this;
+
+    m_vulkan_context = VulkanContext::getVulkanContext();
+    m_vulkan_device = m_vulkan_context->getDevice();
+    m_query_pool = VK_NULL_HANDLE;
+    m_frame = 0;
+    m_frame_query = -1;
+}
+
+GpuProfiler::~GpuProfiler()
+{
+    vkDestroyQueryPool(m_vulkan_device, m_query_pool, nullptr);
+
+    m_gpu_profiler = nullptr;
+}
+
+bool GpuProfiler::init()
+{
+    if (!m_vulkan_context->isTimestampSupported())
+    {
+        printf("Warning: Timestamp queries are not supported, GPU profiler "
+               "is disabled\n");
+        return true;
+    }
+
+    unsigned int frames_count = m_vulkan_context->getFramesInFlight();
+    m_frame_queries.resize(frames_count);
+
+    VkQueryPoolCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    create_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    create_info.queryCount = frames_count * GPU_PROFILER_MAX_QUERIES;
+
+    VkResult result = vkCreateQueryPool(m_vulkan_device, &create_info, nullptr,
+                                        &m_query_pool);
+
+    return (result == VK_SUCCESS);
+}
+
+unsigned int GpuProfiler::getScopeId(std::string name)
+{
+    auto it = m_scope_ids.find(name);
+
+    if (it != m_scope_ids.end())
+        return it->second;
+
+    GpuProfilerScope scope = {};
+    scope.name = name;
+
+    unsigned int id = (unsigned int)m_scopes.size();
+    m_scopes.push_back(scope);
+    m_scope_ids[name] = id;
+
+    return id;
+}
+
+void GpuProfiler::readResults(unsigned int frame)
+{
+    std::vector<GpuProfilerQuery>& queries = m_frame_queries[frame];
+
+    if (queries.empty())
+        return;
+
+    unsigned int first_query = frame * GPU_PROFILER_MAX_QUERIES;
+    unsigned int queries_count = queries.back().end_query + 1 - first_query;
+
+    // Value and availability for every query
+    std::vector<uint64_t> data(queries_count * 2);
+
+    vkGetQueryPoolResults(m_vulkan_device, m_query_pool, first_query, 
+                          queries_count, data.size() * sizeof(uint64_t), 
+                          &data[0], 2 * sizeof(uint64_t), 
+                          VK_QUERY_RESULT_64_BIT | 
+                          VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    float period = m_vulkan_context->getTimestampPeriod();
+
+    for (GpuProfilerQuery& query : queries)
+    {
+        unsigned int begin = (query.begin_query - first_query) * 2;
+        unsigned int end = (query.end_query - first_query) * 2;
+
+        // Not available if command buffer wasn't submitted
+        if (data[begin + 1] == 0 || data[end + 1] == 0 || 
+            data[end] < data[begin])
+            continue;
+
+        addTime(query.scope, (float)(data[end] - data[begin]) * period / 
+                             1000000.0f);
+    }
+
+    queries.clear();
+}
+
+void GpuProfiler::addTime(unsigned int scope, float time)
+{
+    GpuProfilerScope& profiler_scope = m_scopes[scope];
+
+    if (profiler_scope.times.size() < GPU_PROFILER_WINDOW)
+    {
+        profiler_scope.times.push_back(time);
+    }
+    else
+    {
+        profiler_scope.times[profiler_scope.times_pos] = time;
+    }
+
+    profiler_scope.times_pos = (profiler_scope.times_pos + 1) % 
+                               GPU_PROFILER_WINDOW;
+    profiler_scope.last_time = time;
+    profiler_scope.samples_count++;
+
+    float sum = 0.0f;
+
+    for (float scope_time : profiler_scope.times)
+    {
+        sum += scope_time;
+    }
+
+    profiler_scope.average_time = sum / profiler_scope.times.size();
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer command_buffer, 
+                             unsigned int frame)
+{
+    m_frame = frame;
+    m_frame_query = -1;
+
+    if (m_query_pool == VK_NULL_HANDLE)
+        return;
+
+    readResults(frame);
+
+    vkCmdResetQueryPool(command_buffer, m_query_pool, 
+                        frame * GPU_PROFILER_MAX_QUERIES, 
+                        GPU_PROFILER_MAX_QUERIES);
+
+    m_frame_query = beginScope(command_buffer, "frame");
+}
+
+void GpuProfiler::endFrame(VkCommandBuffer command_buffer)
+{
+    endScope(command_buffer, m_frame_query);
+}
+
+int GpuProfiler::beginScope(VkCommandBuffer command_buffer, std::string name)
+{
+    if (m_query_pool == VK_NULL_HANDLE)
+        return -1;
+
+    std::vector<GpuProfilerQuery>& queries = m_frame_queries[m_frame];
+
+    unsigned int first_query = m_frame * GPU_PROFILER_MAX_QUERIES;
+    unsigned int next_query = queries.empty() ? first_query : 
+                              queries.back().end_query + 1;
+
+    if (next_query + 2 > first_query + GPU_PROFILER_MAX_QUERIES)
+        return -1;
+
+    // End query is reserved here, so that queries of a frame are contiguous
+    GpuProfilerQuery query;
+    query.scope = getScopeId(name);
+    query.begin_query = next_query;
+    query.end_query = next_query + 1;
+    queries.push_back(query);
+
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        m_query_pool, query.begin_query);
+
+    return (int)queries.size() - 1;
+}
+
+void GpuProfiler::endScope(VkCommandBuffer command_buffer, int query)
+{
+    if (m_query_pool == VK_NULL_HANDLE || query < 0)
+        return;
+
+    GpuProfilerQuery& profiler_query = m_frame_queries[m_frame][query];
+
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        m_query_pool, profiler_query.end_query);
+}
+
+float GpuProfiler::getScopeTime(std::string name)
+{
+    auto it = m_scope_ids.find(name);
+
+    if (it == m_scope_ids.end())
+        return 0.0f;
+
+    return m_scopes[it->second].average_time;
+}
+
+// Last measured frame, rolling average is available with getScopeTime()
+float GpuProfiler::getFrameTime()
+{
+    auto it = m_scope_ids.find("frame");
+
+    if (it == m_scope_ids.end())
+        return 0.0f;
+
+    return m_scopes[it->second].last_time;
+}
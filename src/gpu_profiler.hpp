@@ -0,0 +1,91 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GPU_PROFILER_HPP
+#define GPU_PROFILER_HPP
+
+#include <vulkan/vulkan.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class VulkanContext;
+
+struct GpuProfilerQuery
+{
+    unsigned int scope;
+    unsigned int begin_query;
+    unsigned int end_query;
+};
+
+// Times in milliseconds, average over the last GPU_PROFILER_WINDOW frames
+// in which the scope was recorded. Samples count grows with every result, so
+// that callers can tell a new last time from the previous one.
+struct GpuProfilerScope
+{
+    std::string name;
+    std::vector<float> times;
+    unsigned int times_pos;
+    float last_time;
+    float average_time;
+    uint64_t samples_count;
+};
+
+const unsigned int GPU_PROFILER_MAX_QUERIES = 64;
+const unsigned int GPU_PROFILER_WINDOW = 60;
+
+// Wraps parts of the command buffer with timestamp queries. Every frame in
+// flight has its own range of queries, which is read back when the frame
+// slot is reused, so the fence has been already waited and reading results
+// never stalls. The whole command buffer is measured as "frame" scope.
+class GpuProfiler
+{
+private:
+    VulkanContext* m_vulkan_context;
+    VkDevice m_vulkan_device;
+    VkQueryPool m_query_pool;
+    unsigned int m_frame;
+    int m_frame_query;
+    std::vector<std::vector<GpuProfilerQuery> > m_frame_queries;
+    std::vector<GpuProfilerScope> m_scopes;
+    std::map<std::string, unsigned int> m_scope_ids;
+
+    static GpuProfiler* m_gpu_profiler;
+
+    unsigned int getScopeId(std::string name);
+    void readResults(unsigned int frame);
+    void addTime(unsigned int scope, float time);
+
+public:
+    GpuProfiler();
+    ~GpuProfiler();
+
+    bool init();
+    void beginFrame(VkCommandBuffer command_buffer, unsigned int frame);
+    void endFrame(VkCommandBuffer command_buffer);
+    int beginScope(VkCommandBuffer command_buffer, std::string name);
+    void endScope(VkCommandBuffer command_buffer, int query);
+
+    float getFrameTime();
+    float getScopeTime(std::string name);
+    const std::vector<GpuProfilerScope>& getScopes() {return m_scopes;}
+    bool isEnabled() {return m_query_pool != VK_NULL_HANDLE;}
+
+    static GpuProfiler* getGpuProfiler() {return m_gpu_profiler;}
+};
+
+#endif
@@ -14,30 +14,126 @@
 //    You should have received a copy of the GNU General Public License
 //    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include "cpu_profiler.hpp"
 #include "file_manager.hpp"
 #include "image_loader.hpp"
 #include "image_loader_png.hpp"
 
-Image* ImageLoader::loadImage(std::string filename)
+#include <cstdio>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define IMAGE_LOADER_NEON
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define IMAGE_LOADER_SSSE3
+#endif
+
+std::unique_ptr<Image> ImageLoader::loadImage(std::string filename)
+{
+    std::unique_ptr<Image> image(new Image());
+    Image* image_ptr = image.get();
+
+    bool success = loadImage(filename, 
+                             [image_ptr](int width, int height, int channels)
+    {
+        image_ptr->width = width;
+        image_ptr->height = height;
+        image_ptr->channels = channels;
+        image_ptr->data.resize(width * height * channels);
+        return &image_ptr->data[0];
+    });
+
+    if (!success)
+        return nullptr;
+
+    return image;
+}
+
+bool ImageLoader::loadImage(std::string filename, 
+                            const ImageAllocator& allocator, bool rgb_to_rgba)
 {
-    Image* image = nullptr;
+    CPU_PROFILER_SCOPE("ImageLoader::loadImage");
 
     FileManager* file_manager = FileManager::getFileManager();
     std::string extension = file_manager->getExtension(filename);
 
-    if (extension == ".png")
+    if (extension != ".png")
+        return false;
+
+    File* file = file_manager->loadFile(filename);
+
+    if (file == nullptr)
+        return false;
+
+    ImageLoaderPNG loader;
+    bool success = loader.decode(file->data, file->length, allocator, 
+                                 rgb_to_rgba);
+
+    file_manager->closeFile(file);
+
+    if (!success)
     {
-        image = ImageLoaderPNG::loadImage(filename);
+        printf("Error: Couldn't decode image: %s\n", filename.c_str());
     }
 
-    return image;
+    return success;
 }
 
-void ImageLoader::closeImage(Image* image)
+#ifdef IMAGE_LOADER_SSSE3
+__attribute__((target("ssse3")))
+static unsigned int convertToRGBASSSE3(const unsigned char* src,
+                                       unsigned int pixels, unsigned char* dst)
 {
-    if (image == nullptr)
-        return;
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                          6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
 
-    delete[] image->data;
-    delete image;
+    unsigned int i = 0;
+
+    // Every load reads 16 bytes, but only 4 pixels (12 bytes) are used
+    for (; i + 6 <= pixels; i += 4)
+    {
+        __m128i rgb = _mm_loadu_si128((const __m128i*)(src + i * 3));
+        __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha);
+        _mm_storeu_si128((__m128i*)(dst + i * 4), rgba);
+    }
+
+    return i;
+}
+#endif
+
+void ImageLoader::convertToRGBA(const unsigned char* src, 
+                                unsigned int src_length, unsigned char* dst)
+{
+    unsigned int pixels = src_length / 3;
+    unsigned int i = 0;
+
+#if defined(IMAGE_LOADER_NEON)
+    for (; i + 16 <= pixels; i += 16)
+    {
+        uint8x16x3_t rgb = vld3q_u8(src + i * 3);
+        uint8x16x4_t rgba;
+        rgba.val[0] = rgb.val[0];
+        rgba.val[1] = rgb.val[1];
+        rgba.val[2] = rgb.val[2];
+        rgba.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst + i * 4, rgba);
+    }
+#elif defined(IMAGE_LOADER_SSSE3)
+    static bool has_ssse3 = __builtin_cpu_supports("ssse3");
+
+    if (has_ssse3)
+    {
+        i = convertToRGBASSSE3(src, pixels, dst);
+    }
+#endif
+
+    for (; i < pixels; i++)
+    {
+        dst[i*4]   = src[i*3];
+        dst[i*4+1] = src[i*3+1];
+        dst[i*4+2] = src[i*3+2];
+        dst[i*4+3] = 255;
+    }
 }
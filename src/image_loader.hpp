@@ -17,22 +17,32 @@
 #ifndef IMAGE_LOADER_HPP
 #define IMAGE_LOADER_HPP
 
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 struct Image
 {
     int width;
     int height;
     int channels;
-    int data_length;
-    unsigned char* data;
+    std::vector<unsigned char> data;
 };
 
+// Called when the image size is known, returns memory for tightly packed
+// pixels (width * height * channels bytes) that the image is decoded into
+typedef std::function<unsigned char*(int width, int height, int channels)> 
+        ImageAllocator;
+
 class ImageLoader
 {
 public:
-    static Image* loadImage(std::string filename);
-    static void closeImage(Image* image);
+    static std::unique_ptr<Image> loadImage(std::string filename);
+    static bool loadImage(std::string filename, const ImageAllocator& allocator,
+                          bool rgb_to_rgba = false);
+    static void convertToRGBA(const unsigned char* src, unsigned int src_length,
+                              unsigned char* dst);
 };
 
 #endif
@@ -14,121 +14,262 @@
 //    You should have received a copy of the GNU General Public License
 //    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+
+#include "cpu_profiler.hpp"
 #include "image_loader_png.hpp"
-#include "file_manager.hpp"
 
 #include <cstdio>
 #include <cstring>
 #include <vector>
 
-int ImageLoaderPNG::m_read_pos = 0;
+ImageLoaderPNG::ImageLoaderPNG()
+{
+    m_png_ptr = nullptr;
+    m_info_ptr = nullptr;
+    m_data = nullptr;
+    m_data_length = 0;
+    m_read_pos = 0;
+    m_rgb_to_rgba = false;
+    m_pixels = nullptr;
+    m_width = 0;
+    m_height = 0;
+    m_channels = 0;
+    m_pitch = 0;
+    m_failed = false;
+    m_finished = false;
+}
 
-void ImageLoaderPNG::readFromMemory(png_structp png_ptr, png_bytep data, 
-                               png_size_t length)
+ImageLoaderPNG::~ImageLoaderPNG()
 {
-    char* png_data = (char*)png_get_io_ptr(png_ptr);
-    memcpy(data, &png_data[m_read_pos], length);
-    m_read_pos += length;
+    if (m_png_ptr != nullptr)
+    {
+        png_destroy_read_struct(&m_png_ptr, 
+                                m_info_ptr ? &m_info_ptr : nullptr, nullptr);
+    }
 }
 
-Image* ImageLoaderPNG::loadImage(std::string filename)
+bool ImageLoaderPNG::createReadStruct()
 {
-    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, 
-                                                 nullptr, nullptr);
+    if (m_png_ptr != nullptr)
+        return false;
+
+    m_png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, this, 
+                                       onError, onWarning);
 
-    if (!png_ptr)
+    if (!m_png_ptr)
     {
         printf("Error: png_create_read_struct failed\n");
-        return nullptr;
+        return false;
     }
 
-    png_infop info_ptr = png_create_info_struct(png_ptr);
+    m_info_ptr = png_create_info_struct(m_png_ptr);
     
-    if (!info_ptr)
+    if (!m_info_ptr)
     {
         printf("Error: png_create_info_struct failed\n");
-        png_destroy_read_struct(&png_ptr, nullptr, nullptr);
-        return nullptr;
+        return false;
     }
-    
-    FileManager* file_manager = FileManager::getFileManager();
-    File* file = file_manager->loadFile(filename);
-    
-    if (file == nullptr)
+
+    return true;
+}
+
+void ImageLoaderPNG::onError(png_structp png_ptr, png_const_charp message)
+{
+    printf("Error: libpng: %s\n", message);
+    png_longjmp(png_ptr, 1);
+}
+
+void ImageLoaderPNG::onWarning(png_structp png_ptr, png_const_charp message)
+{
+    // Warnings are about ancillary chunks that are ignored anyway
+}
+
+void ImageLoaderPNG::readFromMemory(png_structp png_ptr, png_bytep data, 
+                                    png_size_t length)
+{
+    ImageLoaderPNG* loader = (ImageLoaderPNG*)png_get_io_ptr(png_ptr);
+
+    if (loader->m_read_pos + length > loader->m_data_length)
     {
-        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-        return nullptr;
+        png_error(png_ptr, "Unexpected end of data");
     }
-    
-    m_read_pos = 0;
-    
-    png_set_read_fn(png_ptr, file->data, readFromMemory);
-    png_read_info(png_ptr, info_ptr);
 
-    png_byte color_type = png_get_color_type(png_ptr, info_ptr);
-    png_byte bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+    memcpy(data, &loader->m_data[loader->m_read_pos], length);
+    loader->m_read_pos += length;
+}
+
+bool ImageLoaderPNG::readInfo()
+{
+    png_byte color_type = png_get_color_type(m_png_ptr, m_info_ptr);
+    png_byte bit_depth = png_get_bit_depth(m_png_ptr, m_info_ptr);
+    bool has_trns = png_get_valid(m_png_ptr, m_info_ptr, PNG_INFO_tRNS);
     
-    if (color_type != PNG_COLOR_TYPE_RGB && color_type != PNG_COLOR_TYPE_RGBA)
+    if (color_type == PNG_COLOR_TYPE_PALETTE)
+    {
+        png_set_palette_to_rgb(m_png_ptr);
+    }
+    else if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+    {
+        png_set_expand_gray_1_2_4_to_8(m_png_ptr);
+    }
+    else if (color_type != PNG_COLOR_TYPE_GRAY &&
+             color_type != PNG_COLOR_TYPE_GRAY_ALPHA &&
+             color_type != PNG_COLOR_TYPE_RGB && 
+             color_type != PNG_COLOR_TYPE_RGBA)
     {
-        printf("Error: Unsupported png format. It must be RGB or RGBA\n");
-        file_manager->closeFile(file);
-        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-        return nullptr;
+        printf("Error: Unsupported png format\n");
+        return false;
+    }
+
+    if (has_trns)
+    {
+        png_set_tRNS_to_alpha(m_png_ptr);
     }
     
     // Force 8 bit per channel
     if (bit_depth < 8)
     {
-        png_set_packing(png_ptr);
+        png_set_packing(m_png_ptr);
     }
     else if (bit_depth == 16)
     {
-        png_set_strip_16(png_ptr);
+        png_set_strip_16(m_png_ptr);
     }
+
+    bool is_rgb = (color_type == PNG_COLOR_TYPE_RGB || 
+                   color_type == PNG_COLOR_TYPE_PALETTE) && !has_trns;
+
+    // Let libpng add alpha while decoding rows instead of converting the 
+    // whole image afterwards
+    if (m_rgb_to_rgba && is_rgb)
+    {
+        png_set_filler(m_png_ptr, 0xff, PNG_FILLER_AFTER);
+    }
+
+    png_set_interlace_handling(m_png_ptr);
+    png_read_update_info(m_png_ptr, m_info_ptr);
     
-    png_read_update_info(png_ptr, info_ptr);
-    
-    int width = png_get_image_width(png_ptr, info_ptr);
-    int height = png_get_image_height(png_ptr, info_ptr);
-    int pitch = png_get_rowbytes(png_ptr, info_ptr);
-    int channels = png_get_channels(png_ptr, info_ptr);
+    m_width = png_get_image_width(m_png_ptr, m_info_ptr);
+    m_height = png_get_image_height(m_png_ptr, m_info_ptr);
+    m_pitch = png_get_rowbytes(m_png_ptr, m_info_ptr);
+    m_channels = png_get_channels(m_png_ptr, m_info_ptr);
+
+    if (m_pitch != m_width * m_channels)
+        return false;
 
-    int dest_size = height * pitch;
+    m_pixels = m_allocator(m_width, m_height, m_channels);
+
+    return (m_pixels != nullptr);
+}
+
+bool ImageLoaderPNG::decode(const char* data, size_t length, 
+                            const ImageAllocator& allocator, bool rgb_to_rgba)
+{
+    CPU_PROFILER_SCOPE("ImageLoaderPNG::decode");
+
+    bool success = createReadStruct();
+
+    if (!success)
+        return false;
+
+    m_data = data;
+    m_data_length = length;
+    m_read_pos = 0;
+    m_allocator = allocator;
+    m_rgb_to_rgba = rgb_to_rgba;
+
+    // Objects with destructors must not be created below, as libpng errors
+    // longjmp back here
+    if (setjmp(png_jmpbuf(m_png_ptr)))
+    {
+        m_failed = true;
+        return false;
+    }
     
-    Image* image = new Image();
-    image->width = width;
-    image->height = height;
-    image->channels = channels;
-    image->data_length = dest_size;
-    image->data = new (std::nothrow) unsigned char[dest_size]();
+    png_set_read_fn(m_png_ptr, this, readFromMemory);
+    png_read_info(m_png_ptr, m_info_ptr);
 
-    if (image->data == nullptr)
+    if (m_failed || !readInfo())
     {
-        printf("Error: Decompress error for file: %s\n", filename.c_str());
-        delete image;
-        file_manager->closeFile(file);
-        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-        return nullptr;
+        m_failed = true;
+        return false;
     }
 
-    std::vector<unsigned char*> rows;
+    m_rows.resize(m_height);
     
-    for (int i = 0; i < height; i++)
+    for (int i = 0; i < m_height; i++)
     {
-        rows.push_back(new unsigned char[pitch]);
+        m_rows[i] = m_pixels + i * m_pitch;
     }
 
-    png_read_image(png_ptr, &rows[0]);
+    png_read_image(m_png_ptr, &m_rows[0]);
+
+    m_finished = !m_failed;
     
-    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    return m_finished;
+}
+
+bool ImageLoaderPNG::beginProgressive(const ImageAllocator& allocator, 
+                                      bool rgb_to_rgba)
+{
+    bool success = createReadStruct();
+
+    if (!success)
+        return false;
 
-    for (unsigned int i = 0; i < rows.size(); i++)
+    m_allocator = allocator;
+    m_rgb_to_rgba = rgb_to_rgba;
+
+    png_set_progressive_read_fn(m_png_ptr, this, onInfo, onRow, onEnd);
+
+    return true;
+}
+
+bool ImageLoaderPNG::processData(const char* data, size_t length)
+{
+    if (m_png_ptr == nullptr || m_failed)
+        return false;
+
+    if (m_finished)
+        return true;
+
+    if (setjmp(png_jmpbuf(m_png_ptr)))
     {
-        memcpy(&image->data[i * pitch], rows[i], pitch);
-        delete[] rows[i];
+        m_failed = true;
+        return false;
     }
-    
-    file_manager->closeFile(file);
-    
-    return image;
+
+    png_process_data(m_png_ptr, m_info_ptr, (png_bytep)data, length);
+
+    return !m_failed;
+}
+
+void ImageLoaderPNG::onInfo(png_structp png_ptr, png_infop info_ptr)
+{
+    ImageLoaderPNG* loader = (ImageLoaderPNG*)png_get_progressive_ptr(png_ptr);
+
+    if (!loader->readInfo())
+    {
+        loader->m_failed = true;
+    }
+}
+
+void ImageLoaderPNG::onRow(png_structp png_ptr, png_bytep new_row, 
+                           png_uint_32 row_num, int pass)
+{
+    ImageLoaderPNG* loader = (ImageLoaderPNG*)png_get_progressive_ptr(png_ptr);
+
+    if (loader->m_failed || row_num >= (png_uint_32)loader->m_height)
+        return;
+
+    // For interlaced images the row is combined with pixels from the previous
+    // passes, new_row is null when this pass doesn't change the row
+    png_bytep row = loader->m_pixels + row_num * loader->m_pitch;
+    png_progressive_combine_row(png_ptr, row, new_row);
+}
+
+void ImageLoaderPNG::onEnd(png_structp png_ptr, png_infop info_ptr)
+{
+    ImageLoaderPNG* loader = (ImageLoaderPNG*)png_get_progressive_ptr(png_ptr);
+    loader->m_finished = !loader->m_failed;
 }
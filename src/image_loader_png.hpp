@@ -17,23 +17,60 @@
 #ifndef IMAGE_LOADER_PNG_HPP
 #define IMAGE_LOADER_PNG_HPP
 
-#define PNG_SETJMP_NOT_SUPPORTED
 #include <png.h>
 #include <string>
+#include <vector>
 
 #include "image_loader.hpp"
 
+// Decoder keeps all its state in the object, so different images can be
+// decoded on different threads at the same time. Every object decodes one
+// image, either from a complete buffer with decode() or from partial buffers
+// passed to processData() after beginProgressive(). Corrupt or truncated
+// data makes the decode fail, libpng errors jump back to the decode call.
 class ImageLoaderPNG
 {
 private:
-    static int m_read_pos;
-    
+    png_structp m_png_ptr;
+    png_infop m_info_ptr;
+
+    const char* m_data;
+    size_t m_data_length;
+    size_t m_read_pos;
+
+    std::vector<png_bytep> m_rows;
+    ImageAllocator m_allocator;
+    bool m_rgb_to_rgba;
+    unsigned char* m_pixels;
+    int m_width;
+    int m_height;
+    int m_channels;
+    int m_pitch;
+    bool m_failed;
+    bool m_finished;
+
+    bool createReadStruct();
+    bool readInfo();
+
+    static void onError(png_structp png_ptr, png_const_charp message);
+    static void onWarning(png_structp png_ptr, png_const_charp message);
     static void readFromMemory(png_structp png_ptr, png_bytep data, 
                                png_size_t length);
+    static void onInfo(png_structp png_ptr, png_infop info_ptr);
+    static void onRow(png_structp png_ptr, png_bytep new_row, 
+                      png_uint_32 row_num, int pass);
+    static void onEnd(png_structp png_ptr, png_infop info_ptr);
 
 public:
-    static Image* loadImage(std::string filename);
+    ImageLoaderPNG();
+    ~ImageLoaderPNG();
+
+    bool decode(const char* data, size_t length, 
+                const ImageAllocator& allocator, bool rgb_to_rgba);
+
+    bool beginProgressive(const ImageAllocator& allocator, bool rgb_to_rgba);
+    bool processData(const char* data, size_t length);
+    bool isFinished() {return m_finished;}
 };
 
 #endif
-
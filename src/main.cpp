@@ -14,17 +14,28 @@
 //    You should have received a copy of the GNU General Public License
 //    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include "benchmark.hpp"
 #include "camera.hpp"
+#include "cpu_profiler.hpp"
 #include "device_manager.hpp"
 #include "file_manager.hpp"
+#include "frame_pacer.hpp"
+#include "metrics.hpp"
 #include "image_loader.hpp"
 #include "model_manager.hpp"
 #include "renderer.hpp"
 #include "texture_manager.hpp"
+#include "texture_streamer.hpp"
+#include "upload_budget.hpp"
 #include "vulkan_context.hpp"
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
 #include <memory>
+#include <string>
+#include <vector>
 
 #ifdef ANDROID
 #include "device_android.hpp"
@@ -34,6 +45,43 @@ struct android_app* g_android_app;
 
 static int mouse_pos_x = 0;
 static int mouse_pos_y = 0;
+static std::string cpu_trace;
+
+// Phases overlap, so every one is timed separately and reported as it ends
+static void printStartupPhase(const char* name, uint64_t begin_time)
+{
+    double time = (CpuProfiler::getNanoTickCount() - begin_time) / 1e9;
+
+    printf("Startup: %s %.2f ms\n", name, time * 1000.0);
+
+    Metrics::getMetrics()->getGauge(
+                    "renderer_startup_seconds{phase=\"" + std::string(name) + 
+                    "\"}", "Duration of startup phases")->set(time);
+}
+
+// Adds textures and models that were loaded in the background
+static bool updateAssets(UploadBudget* upload_budget)
+{
+    upload_budget->beginFrame();
+
+    bool success = TextureManager::getTextureManager()->update(upload_budget);
+
+    if (!success)
+    {
+        printf("Error: Couldn't update texture manager.\n");
+        return false;
+    }
+
+    success = ModelManager::getModelManager()->update(upload_budget);
+
+    if (!success)
+    {
+        printf("Error: Couldn't update model manager.\n");
+        return false;
+    }
+
+    return true;
+}
 
 static void onEvent(Event event)
 {
@@ -78,6 +126,15 @@ static void onEvent(Event event)
             case KC_KEY_S:
                 camera->rotate(0, 0.05f);
                 break;
+            case KC_KEY_M:
+                VulkanContext::getVulkanContext()->printMemoryReport();
+                break;
+            case KC_KEY_T:
+                if (!cpu_trace.empty())
+                {
+                    CpuProfiler::getCpuProfiler()->writeTrace(cpu_trace);
+                }
+                break;
             case KC_KEY_ESCAPE:
             case KC_KEY_Q:
             {
@@ -92,9 +149,304 @@ static void onEvent(Event event)
     }
 }
 
+static bool getPresentMode(const char* name, VkPresentModeKHR* present_mode)
+{
+    if (strcmp(name, "fifo") == 0)
+    {
+        *present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    }
+    else if (strcmp(name, "fifo-relaxed") == 0)
+    {
+        *present_mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    }
+    else if (strcmp(name, "mailbox") == 0)
+    {
+        *present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+    }
+    else if (strcmp(name, "immediate") == 0)
+    {
+        *present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+// Binary PPM of the last rendered offscreen image
+static bool saveScreenshot(std::string filename)
+{
+    VulkanContext* vulkan_context = VulkanContext::getVulkanContext();
+
+    std::vector<unsigned char> data;
+    bool success = vulkan_context->readOffscreenImage(
+                                    vulkan_context->getImageIndex(), data);
+
+    if (!success)
+        return false;
+
+    unsigned int width = vulkan_context->getSwapChainExtent().width;
+    unsigned int height = vulkan_context->getSwapChainExtent().height;
+
+    FILE* file = fopen(filename.c_str(), "wb");
+
+    if (file == nullptr)
+        return false;
+
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+
+    std::vector<unsigned char> row(width * 3);
+
+    for (unsigned int y = 0; y < height; y++)
+    {
+        // Offscreen images are BGRA
+        for (unsigned int x = 0; x < width; x++)
+        {
+            unsigned char* pixel = &data[(y * width + x) * 4];
+            row[x * 3 + 0] = pixel[2];
+            row[x * 3 + 1] = pixel[1];
+            row[x * 3 + 2] = pixel[0];
+        }
+
+        fwrite(&row[0], 1, row.size(), file);
+    }
+
+    fclose(file);
+
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
+    unsigned int texture_budget = 256;
+    bool mesh_report = false;
+    bool cluster_culling = true;
+    bool static_batching = true;
+    bool progressive_startup = true;
+    unsigned int upload_budget_size = 8;
+    float upload_time = 2.0f;
+    bool pipeline_stats = false;
+    bool memory_report = false;
+    unsigned int metrics_port = 0;
+    float target_fps = 0.0f;
+    bool frame_stats = false;
+    unsigned int frames_in_flight = 2;
+    bool headless = false;
+    unsigned int frames_limit = 0;
+    std::string screenshot;
+    bool benchmark_mode = false;
+    std::string benchmark_path;
+    std::string benchmark_report = "benchmark.json";
+
+    SwapChainParams swap_chain_params = {};
+    swap_chain_params.vsync = true;
+    swap_chain_params.present_mode = VK_PRESENT_MODE_FIFO_KHR;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+        {
+            texture_budget = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--mesh-report") == 0)
+        {
+            mesh_report = true;
+        }
+        else if (strcmp(argv[i], "--no-cluster-culling") == 0)
+        {
+            cluster_culling = false;
+        }
+        else if (strcmp(argv[i], "--no-static-batching") == 0)
+        {
+            static_batching = false;
+        }
+        else if (strcmp(argv[i], "--no-progressive-startup") == 0)
+        {
+            progressive_startup = false;
+        }
+        else if (strcmp(argv[i], "--upload-budget") == 0 && i + 1 < argc)
+        {
+            upload_budget_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--upload-time") == 0 && i + 1 < argc)
+        {
+            upload_time = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--pipeline-stats") == 0)
+        {
+            pipeline_stats = true;
+        }
+        else if (strcmp(argv[i], "--memory-report") == 0)
+        {
+            memory_report = true;
+        }
+        else if (strcmp(argv[i], "--metrics-port") == 0 && i + 1 < argc)
+        {
+            metrics_port = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+        {
+            target_fps = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--frame-stats") == 0)
+        {
+            frame_stats = true;
+        }
+        else if (strcmp(argv[i], "--no-vsync") == 0)
+        {
+            swap_chain_params.vsync = false;
+        }
+        else if (strcmp(argv[i], "--low-latency") == 0)
+        {
+            swap_chain_params.low_latency = true;
+        }
+        else if (strcmp(argv[i], "--headless") == 0)
+        {
+            headless = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            frames_limit = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--screenshot") == 0 && i + 1 < argc)
+        {
+            screenshot = argv[++i];
+        }
+        else if (strcmp(argv[i], "--benchmark") == 0)
+        {
+            benchmark_mode = true;
+        }
+        else if (strcmp(argv[i], "--benchmark-path") == 0 && i + 1 < argc)
+        {
+            benchmark_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--benchmark-report") == 0 && i + 1 < argc)
+        {
+            benchmark_report = argv[++i];
+        }
+        else if (strcmp(argv[i], "--cpu-trace") == 0 && i + 1 < argc)
+        {
+            cpu_trace = argv[++i];
+        }
+        else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+        {
+            frames_in_flight = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--swapchain-images") == 0 && i + 1 < argc)
+        {
+            swap_chain_params.images_count = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc &&
+                 getPresentMode(argv[i + 1], &swap_chain_params.present_mode))
+        {
+            swap_chain_params.force_present_mode = true;
+            i++;
+        }
+        else
+        {
+            printf("Usage: %s [--texture-budget <MB>] [--mesh-report] "
+                   "[--no-cluster-culling] [--no-static-batching] "
+                   "[--no-progressive-startup] [--upload-budget <MB>] "
+                   "[--upload-time <ms>] "
+                   "[--pipeline-stats] [--memory-report] "
+                   "[--metrics-port <port>] "
+                   "[--fps <N>] [--frame-stats] [--no-vsync] [--low-latency] "
+                   "[--frames-in-flight <N>] [--swapchain-images <N>] "
+                   "[--present-mode fifo|fifo-relaxed|mailbox|immediate] "
+                   "[--headless] [--frames <N>] [--screenshot <file.ppm>] "
+                   "[--benchmark] [--benchmark-path <file>] "
+                   "[--benchmark-report <file.json>] "
+                   "[--cpu-trace <file.json>]\n",
+                   argv[0]);
+            return 1;
+        }
+    }
+
+    // Trace can be also written at any time with T key
+    std::unique_ptr<CpuProfiler> cpu_profiler(new CpuProfiler());
+    cpu_profiler->setEnabled(!cpu_trace.empty());
+
+    // Metrics are always collected, serving them is optional
+    std::unique_ptr<Metrics> metrics(new Metrics());
+
+    if (metrics_port > 0)
+    {
+        bool success = metrics->startServer(metrics_port);
+
+        if (!success)
+        {
+            printf("Error: Couldn't start metrics server on port %u.\n",
+                   metrics_port);
+            return 1;
+        }
+    }
+
+    // Benchmark runs as fast as possible
+    if (benchmark_mode)
+    {
+        target_fps = 0.0f;
+        swap_chain_params.vsync = false;
+
+        if (frames_limit == 0)
+        {
+            frames_limit = BENCHMARK_DEFAULT_FRAMES;
+        }
+    }
+
+    // Headless runs render a fixed number of frames, so they wait for all
+    // assets like the benchmark does
+    if (benchmark_mode || headless)
+    {
+        progressive_startup = false;
+    }
+
+    uint64_t startup_time = CpuProfiler::getNanoTickCount();
+
     std::unique_ptr<DeviceManager> device_manager(new DeviceManager());
+    std::unique_ptr<FileManager> file_manager(new FileManager());
+    std::unique_ptr<TextureManager> texture_manager(new TextureManager());
+    std::unique_ptr<ModelManager> model_manager(new ModelManager());
+    model_manager->setMeshReport(mesh_report);
+    model_manager->setStaticBatching(static_batching);
+
+    // Assets are scanned, decoded and parsed while the window and Vulkan
+    // device are created. Only the scan is needed to start rendering, the
+    // rest is uploaded between frames as it becomes ready.
+    std::promise<bool> assets_scanned;
+    std::future<void> assets_loaded = std::async(std::launch::async, [&]()
+    {
+        uint64_t begin_time = CpuProfiler::getNanoTickCount();
+        bool success = file_manager->init();
+        assets_scanned.set_value(success);
+
+        if (!success)
+            return;
+
+        printStartupPhase("scan_assets", begin_time);
+
+        std::future<void> textures_decoded = std::async(std::launch::async,
+                                                        [&]()
+        {
+            uint64_t begin_time = CpuProfiler::getNanoTickCount();
+            texture_manager->decodeTextures();
+            printStartupPhase("decode_textures", begin_time);
+        });
+
+        begin_time = CpuProfiler::getNanoTickCount();
+        model_manager->load();
+        printStartupPhase("parse_models", begin_time);
+
+        textures_decoded.wait();
+        printStartupPhase("load_assets", startup_time);
+    });
+
+    uint64_t begin_time = CpuProfiler::getNanoTickCount();
+
+    device_manager->setSwapChainParams(swap_chain_params);
+    device_manager->setFramesInFlight(frames_in_flight);
+    device_manager->setHeadless(headless);
     bool success = device_manager->init();
     
     if (!success)
@@ -103,11 +455,15 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    printStartupPhase("create_device", begin_time);
+
     Device* device = device_manager->getDevice();
     device->setEventReceiver(onEvent);
 
-    std::unique_ptr<FileManager> file_manager(new FileManager());
-    success = file_manager->init();
+    // Same clock as Device::getMicroTickCount()
+    unsigned long load_start_time = startup_time / 1000;
+
+    success = assets_scanned.get_future().get();
     
     if (!success)
     {
@@ -115,7 +471,10 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    std::unique_ptr<TextureManager> texture_manager(new TextureManager());
+    std::unique_ptr<TextureStreamer> texture_streamer(
+                        new TextureStreamer(texture_budget * 1024ULL * 1024ULL));
+
+    begin_time = CpuProfiler::getNanoTickCount();
     success = texture_manager->init();
     
     if (!success)
@@ -124,10 +483,16 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    printStartupPhase("create_textures", begin_time);
+
     std::unique_ptr<Camera> camera(new Camera(device->getWindowWidth(), 
                                                device->getWindowHeight()));
 
+    begin_time = CpuProfiler::getNanoTickCount();
+
     std::unique_ptr<Renderer> renderer(new Renderer());
+    renderer->setClusterCulling(cluster_culling);
+    renderer->setPipelineStatistics(pipeline_stats);
     success = renderer->init();
     
     if (!success)
@@ -136,27 +501,112 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    std::unique_ptr<ModelManager> model_manager(new ModelManager());
-    success = model_manager->init();
+    printStartupPhase("create_renderer", begin_time);
+
+    success = texture_streamer->init();
     
     if (!success)
     {
-        printf("Error: Couldn't create model manager.\n");
+        printf("Error: Couldn't create texture streamer.\n");
         return 1;
     }
 
+    // Measurements and screenshots need the complete scene
+    if (!progressive_startup)
+    {
+        begin_time = CpuProfiler::getNanoTickCount();
+        assets_loaded.wait();
+        printStartupPhase("wait_for_assets", begin_time);
+    }
+
+    std::unique_ptr<UploadBudget> upload_budget(new UploadBudget());
+
+    // Without progressive startup everything is uploaded at once before the
+    // first frame
+    if (progressive_startup)
+    {
+        upload_budget->setMaxBytes(upload_budget_size * 1024ULL * 1024ULL);
+        upload_budget->setMaxTime(upload_time);
+    }
+
+    begin_time = CpuProfiler::getNanoTickCount();
+    success = updateAssets(upload_budget.get());
+
+    if (!success)
+        return 1;
+
+    printStartupPhase("upload_assets", begin_time);
+    printStartupPhase("total", startup_time);
+
     VulkanContext* vulkan_context = device_manager->getVulkanContext();
+
+    metrics->getGauge("renderer_load_time_seconds", 
+                      "Time from start until the first frame")->set(
+                      (device->getMicroTickCount() - load_start_time) / 1e6);
+
+    if (memory_report)
+    {
+        vulkan_context->printMemoryReport();
+    }
+
+    std::unique_ptr<FramePacer> frame_pacer(new FramePacer());
+    frame_pacer->setTargetFps(target_fps);
+    frame_pacer->setPrintStats(frame_stats);
+    frame_pacer->setLowLatency(swap_chain_params.low_latency);
+
+    std::unique_ptr<Benchmark> benchmark;
+
+    if (benchmark_mode)
+    {
+        benchmark.reset(new Benchmark(frames_limit));
+        benchmark->setLoadTime((device->getMicroTickCount() - 
+                                load_start_time) / 1000.0f);
+
+        if (!benchmark_path.empty())
+        {
+            success = benchmark->loadPath(benchmark_path);
+
+            if (!success)
+            {
+                printf("Error: Couldn't load benchmark path.\n");
+                return 1;
+            }
+        }
+    }
     
     bool recreate_swapchain = false;
     bool quit = false;
+    unsigned int frames_count = 0;
 
     while (!quit)
     {
+        if (benchmark ? benchmark->isFinished() : 
+            (frames_limit > 0 && frames_count >= frames_limit))
+            break;
+
+        frames_count++;
+
+        CPU_PROFILER_SCOPE("Frame");
+
+        frame_pacer->beginFrame();
+
+        if (benchmark)
+        {
+            benchmark->beginFrame();
+            benchmark->beginPhase();
+        }
+
         bool quit = !device->processEvents();
 
         if (quit)
             break;
 
+        if (benchmark)
+        {
+            benchmark->endPhase(BENCHMARK_PHASE_EVENTS);
+            benchmark->beginPhase();
+        }
+
         unsigned int w = device->getWindowWidth();
         unsigned int h = device->getWindowHeight();
 
@@ -172,22 +622,85 @@ int main(int argc, char *argv[])
                 printf("Error: Couldn't recreate swap chain");
                 return 1;
             }
+
+            frame_pacer->resetPresents();
         }
 
         camera->update(w, h);
 
+        success = updateAssets(upload_budget.get());
+
+        if (!success)
+            return 1;
+
+        success = texture_streamer->update();
+
+        if (!success)
+        {
+            printf("Error: Couldn't update texture streamer.\n");
+            return 1;
+        }
+
+        if (benchmark)
+        {
+            benchmark->endPhase(BENCHMARK_PHASE_UPDATE);
+            benchmark->beginPhase();
+        }
+
         bool success = renderer->drawFrame();
         
         if (!success)
         {
             recreate_swapchain = true;
         }
-        
-        device->sleep(10);
+
+        if (benchmark)
+        {
+            benchmark->endPhase(BENCHMARK_PHASE_DRAW);
+        }
+
+        frame_pacer->endFrame();
+
+        if (benchmark)
+        {
+            benchmark->endFrame();
+        }
     }
 
     vulkan_context->waitIdle();
 
+    if (memory_report)
+    {
+        vulkan_context->printMemoryReport();
+    }
+
+    if (benchmark)
+    {
+        success = benchmark->writeReport(benchmark_report);
+
+        if (!success)
+            return 1;
+    }
+
+    if (!cpu_trace.empty())
+    {
+        success = cpu_profiler->writeTrace(cpu_trace);
+
+        if (!success)
+            return 1;
+    }
+
+    if (!screenshot.empty())
+    {
+        success = saveScreenshot(screenshot);
+
+        if (!success)
+        {
+            printf("Error: Couldn't save screenshot: %s\n", screenshot.c_str());
+            return 1;
+        }
+    }
+
     return 0;
 }
 
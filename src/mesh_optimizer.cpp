@@ -0,0 +1,504 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "mesh_optimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+
+// Clusters are reordered for overdraw only when vertex cache efficiency 
+// doesn't get worse than this
+static const float OVERDRAW_ACMR_THRESHOLD = 1.05f;
+
+void MeshOptimizer::optimize(std::vector<Vertex>& vertices,
+                             std::vector<uint32_t>& indices,
+                             const std::vector<SubMesh>& submeshes)
+{
+    if (indices.size() < 3 || vertices.empty())
+        return;
+
+    for (const SubMesh& submesh : submeshes)
+    {
+        std::vector<uint32_t> submesh_indices(
+                    indices.begin() + submesh.first_index,
+                    indices.begin() + submesh.first_index + submesh.index_count);
+
+        if (submesh_indices.size() < 3)
+            continue;
+
+        std::vector<uint32_t> optimized;
+        std::vector<unsigned int> clusters;
+        optimizeVertexCache(submesh_indices, vertices.size(), optimized, 
+                            clusters);
+
+        std::vector<uint32_t> overdraw_optimized = optimized;
+        optimizeOverdraw(vertices, overdraw_optimized, clusters);
+
+        float acmr = analyzeVertexCache(optimized, vertices.size()).acmr;
+        float overdraw_acmr = analyzeVertexCache(overdraw_optimized, 
+                                                 vertices.size()).acmr;
+
+        if (overdraw_acmr <= acmr * OVERDRAW_ACMR_THRESHOLD)
+        {
+            optimized.swap(overdraw_optimized);
+        }
+
+        std::copy(optimized.begin(), optimized.end(), 
+                  indices.begin() + submesh.first_index);
+    }
+
+    optimizeVertexFetch(vertices, indices);
+}
+
+// Tipsify, "Fast Triangle Reordering for Vertex Locality and Reduced 
+// Overdraw", Sander et al. 2007
+void MeshOptimizer::optimizeVertexCache(const std::vector<uint32_t>& indices,
+                                        unsigned int vertex_count,
+                                        std::vector<uint32_t>& result,
+                                        std::vector<unsigned int>& clusters)
+{
+    const unsigned int cache_size = VERTEX_CACHE_SIZE;
+    unsigned int triangle_count = indices.size() / 3;
+
+    // Triangles adjacent to every vertex
+    std::vector<unsigned int> live_triangles(vertex_count, 0);
+
+    for (unsigned int i = 0; i < triangle_count * 3; i++)
+    {
+        live_triangles[indices[i]]++;
+    }
+
+    std::vector<unsigned int> adjacency_offsets(vertex_count + 1, 0);
+
+    for (unsigned int i = 0; i < vertex_count; i++)
+    {
+        adjacency_offsets[i + 1] = adjacency_offsets[i] + live_triangles[i];
+    }
+
+    std::vector<unsigned int> adjacency(adjacency_offsets[vertex_count]);
+    std::vector<unsigned int> fill_offsets(adjacency_offsets.begin(),
+                                           adjacency_offsets.end() - 1);
+
+    for (unsigned int i = 0; i < triangle_count * 3; i++)
+    {
+        adjacency[fill_offsets[indices[i]]++] = i / 3;
+    }
+
+    std::vector<unsigned int> cache_time(vertex_count, 0);
+    std::vector<bool> emitted(triangle_count, false);
+    std::vector<uint32_t> dead_end;
+    std::vector<uint32_t> candidates;
+
+    unsigned int time = cache_size + 1;
+    unsigned int cursor = 0;
+    int fanning = 0;
+
+    result.clear();
+    result.reserve(triangle_count * 3);
+    clusters.clear();
+    clusters.push_back(0);
+
+    while (fanning >= 0)
+    {
+        candidates.clear();
+
+        for (unsigned int i = adjacency_offsets[fanning]; 
+             i < adjacency_offsets[fanning + 1]; i++)
+        {
+            unsigned int triangle = adjacency[i];
+
+            if (emitted[triangle])
+                continue;
+
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                uint32_t vertex = indices[triangle * 3 + j];
+
+                result.push_back(vertex);
+                dead_end.push_back(vertex);
+                candidates.push_back(vertex);
+                live_triangles[vertex]--;
+
+                if (time - cache_time[vertex] > cache_size)
+                {
+                    cache_time[vertex] = time;
+                    time++;
+                }
+            }
+
+            emitted[triangle] = true;
+        }
+
+        // Prefer a vertex that will still be in the cache after its 
+        // remaining triangles are emitted
+        int next = -1;
+        int best_priority = -1;
+
+        for (uint32_t vertex : candidates)
+        {
+            if (live_triangles[vertex] == 0)
+                continue;
+
+            int priority = 0;
+
+            if (time - cache_time[vertex] + 2 * live_triangles[vertex] <= 
+                cache_size)
+            {
+                priority = time - cache_time[vertex];
+            }
+
+            if (priority > best_priority)
+            {
+                best_priority = priority;
+                next = vertex;
+            }
+        }
+
+        if (next != -1)
+        {
+            fanning = next;
+            continue;
+        }
+
+        // Dead end, the next fan is started from a recently used vertex or 
+        // from the next vertex in the input, which also starts a new cluster
+        fanning = -1;
+
+        while (!dead_end.empty())
+        {
+            uint32_t vertex = dead_end.back();
+            dead_end.pop_back();
+
+            if (live_triangles[vertex] > 0)
+            {
+                fanning = vertex;
+                break;
+            }
+        }
+
+        while (fanning == -1 && cursor < vertex_count)
+        {
+            if (live_triangles[cursor] > 0)
+            {
+                fanning = cursor;
+            }
+
+            cursor++;
+        }
+
+        if (fanning != -1 && result.size() / 3 != clusters.back())
+        {
+            clusters.push_back(result.size() / 3);
+        }
+    }
+}
+
+// Clusters facing outwards from the mesh center are likely to occlude other
+// clusters, so they are drawn first
+void MeshOptimizer::optimizeOverdraw(const std::vector<Vertex>& vertices,
+                                     std::vector<uint32_t>& indices,
+                                     const std::vector<unsigned int>& clusters)
+{
+    unsigned int triangle_count = indices.size() / 3;
+
+    glm::vec3 mesh_center(0.0f);
+    float mesh_area = 0.0f;
+
+    std::vector<glm::vec3> cluster_centers(clusters.size(), glm::vec3(0.0f));
+    std::vector<glm::vec3> cluster_normals(clusters.size(), glm::vec3(0.0f));
+
+    for (unsigned int c = 0; c < clusters.size(); c++)
+    {
+        unsigned int begin = clusters[c];
+        unsigned int end = (c + 1 < clusters.size()) ? clusters[c + 1] : 
+                                                       triangle_count;
+        float cluster_area = 0.0f;
+
+        for (unsigned int t = begin; t < end; t++)
+        {
+            const glm::vec3& p0 = vertices[indices[t * 3]].pos;
+            const glm::vec3& p1 = vertices[indices[t * 3 + 1]].pos;
+            const glm::vec3& p2 = vertices[indices[t * 3 + 2]].pos;
+
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float area = glm::length(normal);
+            glm::vec3 center = (p0 + p1 + p2) / 3.0f;
+
+            cluster_centers[c] += center * area;
+            cluster_normals[c] += normal;
+            cluster_area += area;
+            mesh_center += center * area;
+            mesh_area += area;
+        }
+
+        if (cluster_area > 0.0f)
+        {
+            cluster_centers[c] /= cluster_area;
+        }
+
+        float length = glm::length(cluster_normals[c]);
+
+        if (length > 0.0f)
+        {
+            cluster_normals[c] /= length;
+        }
+    }
+
+    if (mesh_area > 0.0f)
+    {
+        mesh_center /= mesh_area;
+    }
+
+    std::vector<float> sort_keys(clusters.size());
+    std::vector<unsigned int> order(clusters.size());
+
+    for (unsigned int c = 0; c < clusters.size(); c++)
+    {
+        sort_keys[c] = glm::dot(cluster_centers[c] - mesh_center, 
+                                cluster_normals[c]);
+        order[c] = c;
+    }
+
+    std::stable_sort(order.begin(), order.end(), 
+                     [&sort_keys](unsigned int a, unsigned int b)
+    {
+        return sort_keys[a] > sort_keys[b];
+    });
+
+    std::vector<uint32_t> result;
+    result.reserve(indices.size());
+
+    for (unsigned int c : order)
+    {
+        unsigned int begin = clusters[c];
+        unsigned int end = (c + 1 < clusters.size()) ? clusters[c + 1] : 
+                                                       triangle_count;
+
+        result.insert(result.end(), indices.begin() + begin * 3,
+                      indices.begin() + end * 3);
+    }
+
+    indices.swap(result);
+}
+
+void MeshOptimizer::optimizeVertexFetch(std::vector<Vertex>& vertices,
+                                        std::vector<uint32_t>& indices)
+{
+    const uint32_t unused = 0xffffffff;
+    std::vector<uint32_t> remap(vertices.size(), unused);
+    std::vector<Vertex> result;
+    result.reserve(vertices.size());
+
+    for (uint32_t& index : indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = result.size();
+            result.push_back(vertices[index]);
+        }
+
+        index = remap[index];
+    }
+
+    vertices.swap(result);
+}
+
+VertexCacheStats MeshOptimizer::analyzeVertexCache(
+                                        const std::vector<uint32_t>& indices,
+                                        unsigned int vertex_count,
+                                        unsigned int cache_size)
+{
+    VertexCacheStats stats = {};
+
+    if (indices.size() < 3 || vertex_count == 0)
+        return stats;
+
+    // FIFO cache, as in most hardware
+    std::deque<uint32_t> cache;
+    std::vector<bool> in_cache(vertex_count, false);
+    std::vector<bool> used(vertex_count, false);
+    unsigned int misses = 0;
+    unsigned int used_count = 0;
+
+    for (uint32_t index : indices)
+    {
+        if (!used[index])
+        {
+            used[index] = true;
+            used_count++;
+        }
+
+        if (in_cache[index])
+            continue;
+
+        misses++;
+        cache.push_back(index);
+        in_cache[index] = true;
+
+        if (cache.size() > cache_size)
+        {
+            in_cache[cache.front()] = false;
+            cache.pop_front();
+        }
+    }
+
+    stats.acmr = (float)misses / (indices.size() / 3);
+    stats.atvr = (float)misses / used_count;
+
+    return stats;
+}
+
+// Splits the sub-mesh into consecutive index ranges, so that every meshlet
+// can be drawn with a single indexed draw from the original buffer
+void MeshOptimizer::buildMeshlets(const std::vector<Vertex>& vertices,
+                                  const std::vector<uint32_t>& indices,
+                                  const SubMesh& submesh,
+                                  std::vector<Meshlet>& meshlets)
+{
+    if (submesh.index_count < 3 || vertices.empty())
+        return;
+
+    unsigned int triangle_count = submesh.index_count / 3;
+    unsigned int offset = submesh.first_index;
+
+    // Meshlet that the vertex was last added to
+    std::vector<unsigned int> vertex_meshlet(vertices.size(), ~0u);
+    unsigned int meshlet_id = 0;
+    unsigned int meshlet_vertices = 0;
+    unsigned int first_triangle = 0;
+
+    for (unsigned int i = 0; i < triangle_count; i++)
+    {
+        uint32_t a = indices[offset + i * 3 + 0];
+        uint32_t b = indices[offset + i * 3 + 1];
+        uint32_t c = indices[offset + i * 3 + 2];
+
+        // Triangle may reference the same vertex more than once
+        unsigned int new_vertices = 
+                    (vertex_meshlet[a] != meshlet_id) +
+                    (vertex_meshlet[b] != meshlet_id && b != a) +
+                    (vertex_meshlet[c] != meshlet_id && c != a && c != b);
+
+        if (meshlet_vertices + new_vertices > MAX_MESHLET_VERTICES ||
+            i - first_triangle + 1 > MAX_MESHLET_TRIANGLES)
+        {
+            meshlets.push_back(computeMeshletBounds(vertices, indices, 
+                                            offset + first_triangle * 3, 
+                                            (i - first_triangle) * 3,
+                                            submesh.material));
+            meshlet_id++;
+            meshlet_vertices = 0;
+            first_triangle = i;
+        }
+
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            uint32_t index = indices[offset + i * 3 + j];
+
+            if (vertex_meshlet[index] != meshlet_id)
+            {
+                vertex_meshlet[index] = meshlet_id;
+                meshlet_vertices++;
+            }
+        }
+    }
+
+    meshlets.push_back(computeMeshletBounds(vertices, indices, 
+                                            offset + first_triangle * 3,
+                                            (triangle_count - first_triangle) * 3,
+                                            submesh.material));
+}
+
+// Bounding sphere and normal cone, "Optimizing the Graphics Pipeline with 
+// Compute", Wihlidal 2016. The cluster is back-facing when
+// dot(center - camera, cone.xyz) >= cone.w * length(center - camera) + radius
+Meshlet MeshOptimizer::computeMeshletBounds(const std::vector<Vertex>& vertices,
+                                            const std::vector<uint32_t>& indices,
+                                            unsigned int first_index,
+                                            unsigned int index_count,
+                                            unsigned int material)
+{
+    Meshlet meshlet = {};
+    meshlet.first_index = first_index;
+    meshlet.index_count = index_count;
+    meshlet.material = material;
+
+    glm::vec3 min_pos = vertices[indices[first_index]].pos;
+    glm::vec3 max_pos = min_pos;
+
+    for (unsigned int i = first_index; i < first_index + index_count; i++)
+    {
+        min_pos = glm::min(min_pos, vertices[indices[i]].pos);
+        max_pos = glm::max(max_pos, vertices[indices[i]].pos);
+    }
+
+    glm::vec3 center = (min_pos + max_pos) * 0.5f;
+    float radius = 0.0f;
+
+    for (unsigned int i = first_index; i < first_index + index_count; i++)
+    {
+        radius = std::max(radius, glm::length(vertices[indices[i]].pos - center));
+    }
+
+    meshlet.sphere = glm::vec4(center, radius);
+
+    std::vector<glm::vec3> normals;
+    normals.reserve(index_count / 3);
+    glm::vec3 axis = glm::vec3(0.0f);
+
+    for (unsigned int i = first_index; i < first_index + index_count; i += 3)
+    {
+        glm::vec3 p0 = vertices[indices[i]].pos;
+        glm::vec3 p1 = vertices[indices[i + 1]].pos;
+        glm::vec3 p2 = vertices[indices[i + 2]].pos;
+
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float length = glm::length(normal);
+
+        // Degenerate triangles are never rasterized
+        if (length <= 0.0f)
+            continue;
+
+        normals.push_back(normal / length);
+        axis += normals.back();
+    }
+
+    // Cutoff 1 means that the cluster is never culled
+    meshlet.cone = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+    float axis_length = glm::length(axis);
+
+    if (normals.empty() || axis_length <= 0.0f)
+        return meshlet;
+
+    axis /= axis_length;
+    float min_dot = 1.0f;
+
+    for (const glm::vec3& normal : normals)
+    {
+        min_dot = std::min(min_dot, glm::dot(axis, normal));
+    }
+
+    // Normals span more than a hemisphere
+    if (min_dot <= 0.0f)
+        return meshlet;
+
+    meshlet.cone = glm::vec4(axis, sqrtf(1.0f - min_dot * min_dot));
+
+    return meshlet;
+}
@@ -0,0 +1,74 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MESH_OPTIMIZER_HPP
+#define MESH_OPTIMIZER_HPP
+
+#include "model.hpp"
+
+#include <cstdint>
+#include <vector>
+
+struct VertexCacheStats
+{
+    // Average cache miss ratio, vertex shader invocations per triangle
+    float acmr;
+    // Average transformed vertex ratio, invocations per unique vertex
+    float atvr;
+};
+
+// Reorders triangles for post-transform vertex cache with Tipsify, then 
+// orders the resulting clusters to reduce overdraw, and finally reorders 
+// vertices in the order in which they are used. Triangles never move between
+// sub-meshes.
+class MeshOptimizer
+{
+private:
+    static void optimizeVertexCache(const std::vector<uint32_t>& indices,
+                                    unsigned int vertex_count,
+                                    std::vector<uint32_t>& result,
+                                    std::vector<unsigned int>& clusters);
+    static void optimizeOverdraw(const std::vector<Vertex>& vertices,
+                                 std::vector<uint32_t>& indices,
+                                 const std::vector<unsigned int>& clusters);
+    static void optimizeVertexFetch(std::vector<Vertex>& vertices,
+                                    std::vector<uint32_t>& indices);
+    static Meshlet computeMeshletBounds(const std::vector<Vertex>& vertices,
+                                        const std::vector<uint32_t>& indices,
+                                        unsigned int first_index,
+                                        unsigned int index_count,
+                                        unsigned int material);
+
+public:
+    static void optimize(std::vector<Vertex>& vertices,
+                         std::vector<uint32_t>& indices,
+                         const std::vector<SubMesh>& submeshes);
+    static VertexCacheStats analyzeVertexCache(
+                                    const std::vector<uint32_t>& indices,
+                                    unsigned int vertex_count,
+                                    unsigned int cache_size = 
+                                                    VERTEX_CACHE_SIZE);
+    static void buildMeshlets(const std::vector<Vertex>& vertices,
+                              const std::vector<uint32_t>& indices,
+                              const SubMesh& submesh,
+                              std::vector<Meshlet>& meshlets);
+
+    static const unsigned int VERTEX_CACHE_SIZE = 16;
+    static const unsigned int MAX_MESHLET_VERTICES = 64;
+    static const unsigned int MAX_MESHLET_TRIANGLES = 124;
+};
+
+#endif
@@ -0,0 +1,325 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "metrics.hpp"
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+Metrics* Metrics::m_metrics_registry = nullptr;
+
+Metric::Metric(std::string name, std::string help, MetricType type,
+               const std::vector<double>& buckets)
+{
+    m_name = name;
+    m_help = help;
+    m_type = type;
+    m_value = 0.0;
+    m_buckets = buckets;
+    m_bucket_counts.reset(new std::atomic<uint64_t>[buckets.size()]);
+    m_count = 0;
+    m_sum = 0.0;
+
+    for (unsigned int i = 0; i < buckets.size(); i++)
+    {
+        m_bucket_counts[i] = 0;
+    }
+}
+
+void Metric::set(double value)
+{
+    m_value.store(value, std::memory_order_relaxed);
+}
+
+static void atomicAdd(std::atomic<double>& atomic_value, double value)
+{
+    double current = atomic_value.load(std::memory_order_relaxed);
+
+    while (!atomic_value.compare_exchange_weak(current, current + value,
+                                               std::memory_order_relaxed))
+    {
+    }
+}
+
+void Metric::add(double value)
+{
+    atomicAdd(m_value, value);
+}
+
+void Metric::observe(double value)
+{
+    // Buckets are stored as not cumulative and summed up when formatted
+    for (unsigned int i = 0; i < m_buckets.size(); i++)
+    {
+        if (value <= m_buckets[i])
+        {
+            m_bucket_counts[i].fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    atomicAdd(m_sum, value);
+}
+
+Metrics::Metrics()
+{
+    m_server_socket = -1;
+    m_server_running = false;
+
+    m_metrics_registry = this;
+}
+
+Metrics::~Metrics()
+{
+    stopServer();
+
+    m_metrics_registry = nullptr;
+}
+
+Metric* Metrics::getMetric(std::string name, std::string help, 
+                           MetricType type, const std::vector<double>& buckets)
+{
+    std::lock_guard<std::mutex> lock(m_metrics_mutex);
+
+    for (std::unique_ptr<Metric>& metric : m_metrics)
+    {
+        if (metric->m_name == name)
+            return metric.get();
+    }
+
+    m_metrics.emplace_back(new Metric(name, help, type, buckets));
+
+    return m_metrics.back().get();
+}
+
+Metric* Metrics::getCounter(std::string name, std::string help)
+{
+    return getMetric(name, help, METRIC_COUNTER, {});
+}
+
+Metric* Metrics::getGauge(std::string name, std::string help)
+{
+    return getMetric(name, help, METRIC_GAUGE, {});
+}
+
+Metric* Metrics::getHistogram(std::string name, std::string help,
+                              const std::vector<double>& buckets)
+{
+    return getMetric(name, help, METRIC_HISTOGRAM, buckets);
+}
+
+// Splits gpu_memory_bytes{category="texture"} into the family name and
+// the labels without braces
+static std::string getFamilyName(const std::string& name, std::string& labels)
+{
+    std::size_t pos = name.find('{');
+
+    if (pos == std::string::npos)
+    {
+        labels.clear();
+        return name;
+    }
+
+    labels = name.substr(pos + 1, name.size() - pos - 2);
+
+    return name.substr(0, pos);
+}
+
+std::string Metrics::format()
+{
+    std::lock_guard<std::mutex> lock(m_metrics_mutex);
+
+    // Lines of a family must be contiguous, but labeled metrics of one family
+    // can be registered between other ones. Families keep the order in which
+    // they were first registered.
+    std::vector<std::string> families;
+    std::map<std::string, std::vector<Metric*> > family_metrics;
+
+    for (std::unique_ptr<Metric>& metric : m_metrics)
+    {
+        std::string labels;
+        std::string family = getFamilyName(metric->m_name, labels);
+
+        std::vector<Metric*>& metrics = family_metrics[family];
+
+        if (metrics.empty())
+        {
+            families.push_back(family);
+        }
+
+        metrics.push_back(metric.get());
+    }
+
+    std::ostringstream out;
+
+    for (const std::string& name : families)
+    {
+        const std::vector<Metric*>& metrics = family_metrics[name];
+
+        // Metrics with labels share the description
+        const char* types[] = {"counter", "gauge", "histogram"};
+        out << "# HELP " << name << " " << metrics[0]->m_help << "\n";
+        out << "# TYPE " << name << " " << types[metrics[0]->m_type] << "\n";
+
+        for (Metric* metric : metrics)
+        {
+            if (metric->m_type != METRIC_HISTOGRAM)
+            {
+                out << metric->m_name << " " << metric->m_value.load() << "\n";
+                continue;
+            }
+
+            std::string labels;
+            getFamilyName(metric->m_name, labels);
+
+            std::string separator = labels.empty() ? "" : ",";
+            uint64_t cumulative_count = 0;
+
+            for (unsigned int i = 0; i < metric->m_buckets.size(); i++)
+            {
+                cumulative_count += metric->m_bucket_counts[i].load();
+                out << name << "_bucket{" << labels << separator << "le=\"" 
+                    << metric->m_buckets[i] << "\"} " << cumulative_count 
+                    << "\n";
+            }
+
+            std::string braced_labels = labels.empty() ? "" : 
+                                        "{" + labels + "}";
+
+            out << name << "_bucket{" << labels << separator 
+                << "le=\"+Inf\"} " << metric->m_count.load() << "\n";
+            out << name << "_sum" << braced_labels << " " 
+                << metric->m_sum.load() << "\n";
+            out << name << "_count" << braced_labels << " " 
+                << metric->m_count.load() << "\n";
+        }
+    }
+
+    return out.str();
+}
+
+bool Metrics::startServer(unsigned int port)
+{
+    m_server_socket = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (m_server_socket < 0)
+        return false;
+
+    int reuse = 1;
+    setsockopt(m_server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, 
+               sizeof(reuse));
+
+    // Only local scrapers, there is no authentication
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+
+    if (bind(m_server_socket, (sockaddr*)&address, sizeof(address)) < 0 ||
+        listen(m_server_socket, 4) < 0)
+    {
+        close(m_server_socket);
+        m_server_socket = -1;
+        return false;
+    }
+
+    m_server_running = true;
+    m_server_thread = std::thread(&Metrics::serve, this);
+
+    return true;
+}
+
+void Metrics::stopServer()
+{
+    if (!m_server_running)
+        return;
+
+    m_server_running = false;
+    m_server_thread.join();
+
+    close(m_server_socket);
+    m_server_socket = -1;
+}
+
+void Metrics::serve()
+{
+    while (m_server_running)
+    {
+        // Timeout only to notice that the server was stopped
+        pollfd poll_fd = {};
+        poll_fd.fd = m_server_socket;
+        poll_fd.events = POLLIN;
+
+        int result = poll(&poll_fd, 1, 200);
+
+        if (result <= 0)
+            continue;
+
+        int client_socket = accept(m_server_socket, nullptr, nullptr);
+
+        if (client_socket < 0)
+            continue;
+
+        handleClient(client_socket);
+        close(client_socket);
+    }
+}
+
+void Metrics::handleClient(int client_socket)
+{
+    // Scraper that connects and doesn't send anything can't block the server
+    timeval timeout = {};
+    timeout.tv_sec = 1;
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, 
+               sizeof(timeout));
+    setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, 
+               sizeof(timeout));
+
+    // Every request gets the metrics, the request itself doesn't matter
+    char request[1024];
+    recv(client_socket, request, sizeof(request), 0);
+
+    std::string body = format();
+    std::ostringstream response;
+    response << "HTTP/1.0 200 OK\r\n"
+             << "Content-Type: text/plain; version=0.0.4\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << body;
+
+    std::string data = response.str();
+    std::size_t sent = 0;
+
+    while (sent < data.size())
+    {
+        ssize_t result = send(client_socket, data.data() + sent, 
+                              data.size() - sent, MSG_NOSIGNAL);
+
+        if (result <= 0)
+            break;
+
+        sent += result;
+    }
+}
@@ -0,0 +1,94 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum MetricType
+{
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM
+};
+
+// Values are atomics, so updating a metric never waits for a scrape and
+// costs the same whether anybody is scraping or not
+class Metric
+{
+    friend class Metrics;
+
+private:
+    std::string m_name;
+    std::string m_help;
+    MetricType m_type;
+    std::atomic<double> m_value;
+    std::vector<double> m_buckets;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_bucket_counts;
+    std::atomic<uint64_t> m_count;
+    std::atomic<double> m_sum;
+
+public:
+    Metric(std::string name, std::string help, MetricType type,
+           const std::vector<double>& buckets);
+
+    void set(double value);
+    void add(double value);
+    void observe(double value);
+};
+
+// Registry of metrics in Prometheus text format. Names may include labels,
+// e.g. gpu_memory_bytes{category="texture"}. With a port set, the metrics
+// are served over HTTP on localhost from a background thread.
+class Metrics
+{
+private:
+    std::mutex m_metrics_mutex;
+    std::vector<std::unique_ptr<Metric> > m_metrics;
+    int m_server_socket;
+    std::thread m_server_thread;
+    std::atomic<bool> m_server_running;
+
+    static Metrics* m_metrics_registry;
+
+    Metric* getMetric(std::string name, std::string help, MetricType type,
+                      const std::vector<double>& buckets);
+    void serve();
+    void handleClient(int client_socket);
+
+public:
+    Metrics();
+    ~Metrics();
+
+    Metric* getCounter(std::string name, std::string help);
+    Metric* getGauge(std::string name, std::string help);
+    Metric* getHistogram(std::string name, std::string help,
+                         const std::vector<double>& buckets);
+    std::string format();
+    bool startServer(unsigned int port);
+    void stopServer();
+
+    static Metrics* getMetrics() {return m_metrics_registry;}
+};
+
+#endif
@@ -15,30 +15,109 @@
 //    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "file_manager.hpp"
+#include "mesh_optimizer.hpp"
 #include "renderer.hpp"
 #include "texture_manager.hpp"
 
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstring>
 
+static uint16_t packUnorm16(float value)
+{
+    value = std::min(std::max(value, 0.0f), 1.0f);
+    return (uint16_t)roundf(value * 65535.0f);
+}
+
+static int16_t packSnorm16(float value)
+{
+    value = std::min(std::max(value, -1.0f), 1.0f);
+    return (int16_t)roundf(value * 32767.0f);
+}
+
+static uint16_t packHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    // Inf and NaN
+    if (exponent == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+    int half_exponent = (int)exponent - 127 + 15;
+
+    if (half_exponent >= 31)
+        return sign | 0x7c00;
+
+    // Denormalized half
+    if (half_exponent <= 0)
+    {
+        if (half_exponent < -10)
+            return sign;
+
+        mantissa |= 0x800000;
+        uint32_t shift = 14 - half_exponent;
+        uint32_t half = mantissa >> shift;
+
+        if ((mantissa >> (shift - 1)) & 1)
+        {
+            half++;
+        }
+
+        return sign | half;
+    }
+
+    uint32_t half = sign | (half_exponent << 10) | (mantissa >> 13);
+
+    // Rounding can carry over to the exponent, which is still correct
+    if (mantissa & 0x1000)
+    {
+        half++;
+    }
+
+    return half;
+}
+
 Model::Model(std::string name,
              const std::vector<Vertex>& vertices,
              const std::vector<uint32_t>& indices,
-             std::string tex_name)
+             const std::vector<SubMesh>& submeshes,
+             const std::vector<MaterialBounds>& material_bounds,
+             const std::vector<std::string>& tex_names)
 {
-    m_vulkan_context = VulkanContext::getVulkanContext();
-    m_vulkan_device = m_vulkan_context->getDevice();
+    // Vulkan objects are created in init(), so that models can be prepared
+    // before the device exists
+    m_vulkan_context = nullptr;
+    m_vulkan_device = VK_NULL_HANDLE;
 
     m_name = name;
     m_vertices = vertices;
     m_indices = indices;
-    m_tex_name = tex_name;
+    m_submeshes = submeshes;
+    m_material_bounds = material_bounds;
+    m_tex_names = tex_names;
+
+    computeBoundingSphere();
+    computeQuantization();
+
+    for (SubMesh& submesh : m_submeshes)
+    {
+        computeSubMeshBounds(submesh);
+        MeshOptimizer::buildMeshlets(m_vertices, m_indices, submesh, 
+                                     m_meshlets);
+    }
 
     m_vertex_buffer = VK_NULL_HANDLE;
     m_vertex_buffer_memory = VK_NULL_HANDLE;
     m_index_buffer = VK_NULL_HANDLE;
     m_index_buffer_memory = VK_NULL_HANDLE;
+    m_index_type = (vertices.size() <= MAX_16BIT_INDEX_VERTICES) ? 
+                   VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
 }
 
 Model::~Model()
@@ -50,7 +129,7 @@ Model::~Model()
     
     if (m_index_buffer_memory != VK_NULL_HANDLE)
     {
-        vkFreeMemory(m_vulkan_device, m_index_buffer_memory, nullptr);
+        m_vulkan_context->freeMemory(m_index_buffer_memory);
     }
 
     if (m_vertex_buffer != VK_NULL_HANDLE)
@@ -60,12 +139,15 @@ Model::~Model()
 
     if (m_vertex_buffer_memory != VK_NULL_HANDLE)
     {
-        vkFreeMemory(m_vulkan_device, m_vertex_buffer_memory, nullptr);
+        m_vulkan_context->freeMemory(m_vertex_buffer_memory);
     }
 }
 
 bool Model::init()
 {
+    m_vulkan_context = VulkanContext::getVulkanContext();
+    m_vulkan_device = m_vulkan_context->getDevice();
+
     bool success = createVertexBuffer();
 
     if (!success)
@@ -93,9 +175,27 @@ bool Model::init()
     return true;
 }
 
+// Size of vertex and index buffers
+VkDeviceSize Model::getUploadSize()
+{
+    VkDeviceSize index_size = (m_index_type == VK_INDEX_TYPE_UINT16) ? 
+                              sizeof(uint16_t) : sizeof(uint32_t);
+
+    return sizeof(PackedVertex) * m_vertices.size() + 
+           index_size * m_indices.size();
+}
+
 bool Model::createVertexBuffer()
 {
-    VkDeviceSize buffer_size = sizeof(m_vertices[0]) * m_vertices.size();
+    std::vector<PackedVertex> packed_vertices;
+    packed_vertices.reserve(m_vertices.size());
+
+    for (const Vertex& vertex : m_vertices)
+    {
+        packed_vertices.push_back(packVertex(vertex));
+    }
+
+    VkDeviceSize buffer_size = sizeof(packed_vertices[0]) * packed_vertices.size();
 
     VkBuffer staging_buffer;
     VkDeviceMemory staging_buffer_memory;
@@ -104,41 +204,54 @@ bool Model::createVertexBuffer()
                                         VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                        staging_buffer, staging_buffer_memory);
+                                        staging_buffer, staging_buffer_memory,
+                                        MEMORY_CATEGORY_STAGING);
 
     if (!success)
         return false;
 
     void* data;
     vkMapMemory(m_vulkan_device, staging_buffer_memory, 0, buffer_size, 0, &data);
-    memcpy(data, &m_vertices[0], (size_t) buffer_size);
+    memcpy(data, &packed_vertices[0], (size_t) buffer_size);
     vkUnmapMemory(m_vulkan_device, staging_buffer_memory);
 
     success = m_vulkan_context->createBuffer(buffer_size,
                                         VK_BUFFER_USAGE_TRANSFER_DST_BIT |
                                         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                                        m_vertex_buffer, m_vertex_buffer_memory);
+                                        m_vertex_buffer, m_vertex_buffer_memory,
+                                        MEMORY_CATEGORY_GEOMETRY);
 
     if (!success)
     {
         vkDestroyBuffer(m_vulkan_device, staging_buffer, nullptr);
-        vkFreeMemory(m_vulkan_device, staging_buffer_memory, nullptr);
+        m_vulkan_context->freeMemory(staging_buffer_memory);
         return false;
     }
 
-    m_vulkan_context->copyBuffer(staging_buffer, m_vertex_buffer, buffer_size);
+    success = m_vulkan_context->uploadBuffer(staging_buffer, 
+                                             staging_buffer_memory,
+                                             m_vertex_buffer, buffer_size);
 
-    vkDestroyBuffer(m_vulkan_device, staging_buffer, nullptr);
-    vkFreeMemory(m_vulkan_device, staging_buffer_memory, nullptr);
+    if (!success)
+        return false;
 
     return true;
 }
 
 bool Model::createIndexBuffer()
 {
+    std::vector<uint16_t> indices_16;
+    const void* indices_data = &m_indices[0];
     VkDeviceSize buffer_size = sizeof(m_indices[0]) * m_indices.size();
 
+    if (m_index_type == VK_INDEX_TYPE_UINT16)
+    {
+        indices_16.assign(m_indices.begin(), m_indices.end());
+        indices_data = &indices_16[0];
+        buffer_size = sizeof(indices_16[0]) * indices_16.size();
+    }
+
     VkBuffer staging_buffer;
     VkDeviceMemory staging_buffer_memory;
 
@@ -146,104 +259,279 @@ bool Model::createIndexBuffer()
                                         VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                        staging_buffer, staging_buffer_memory);
+                                        staging_buffer, staging_buffer_memory,
+                                        MEMORY_CATEGORY_STAGING);
 
     if (!success)
         return false;
 
     void* data;
     vkMapMemory(m_vulkan_device, staging_buffer_memory, 0, buffer_size, 0, &data);
-    memcpy(data, &m_indices[0], (size_t) buffer_size);
+    memcpy(data, indices_data, (size_t) buffer_size);
     vkUnmapMemory(m_vulkan_device, staging_buffer_memory);
 
     success = m_vulkan_context->createBuffer(buffer_size,
                                         VK_BUFFER_USAGE_TRANSFER_DST_BIT |
                                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
                                         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                                        m_index_buffer, m_index_buffer_memory);
+                                        m_index_buffer, m_index_buffer_memory,
+                                        MEMORY_CATEGORY_GEOMETRY);
 
     if (!success)
     {
         vkDestroyBuffer(m_vulkan_device, staging_buffer, nullptr);
-        vkFreeMemory(m_vulkan_device, staging_buffer_memory, nullptr);
+        m_vulkan_context->freeMemory(staging_buffer_memory);
         return false;
     }
 
-    m_vulkan_context->copyBuffer(staging_buffer, m_index_buffer, buffer_size);
+    success = m_vulkan_context->uploadBuffer(staging_buffer, 
+                                             staging_buffer_memory,
+                                             m_index_buffer, buffer_size);
 
-    vkDestroyBuffer(m_vulkan_device, staging_buffer, nullptr);
-    vkFreeMemory(m_vulkan_device, staging_buffer_memory, nullptr);
+    if (!success)
+        return false;
 
     return true;
 }
 
+// Every frame in flight has its own set, so that textures can be replaced
+// while the GPU still uses sets of the previous frames
 bool Model::createDescriptorSets()
 {
     Renderer* renderer = Renderer::getRenderer();
 
-    unsigned int count = m_vulkan_context->getSwapChainImagesCount();
-    std::vector<VkDescriptorSet> descriptor_sets(count);
-    
-    VkDescriptorSetLayout layout = renderer->getDescriptorSetLayout();
-    std::vector<VkDescriptorSetLayout> layouts(count, layout);
+    unsigned int frames_count = m_vulkan_context->getFramesInFlight();
+    std::vector<VkDescriptorSetLayout> layouts(frames_count, 
+                                        renderer->getDescriptorSetLayout());
+    m_descriptor_sets.resize(frames_count, VK_NULL_HANDLE);
+    m_outdated_descriptor_sets.resize(frames_count, false);
+
+    VkDescriptorPool descriptor_pool = renderer->getDescriptorPool();
+
+    if (descriptor_pool == VK_NULL_HANDLE)
+        return false;
 
     VkDescriptorSetAllocateInfo alloc_info = {};
     alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    alloc_info.descriptorPool = renderer->getDescriptorPool();
+    alloc_info.descriptorPool = descriptor_pool;
     alloc_info.descriptorSetCount = (uint32_t)(layouts.size());
     alloc_info.pSetLayouts = &layouts[0];
 
     VkResult result = vkAllocateDescriptorSets(m_vulkan_device, &alloc_info, 
-                                               &descriptor_sets[0]);
+                                               &m_descriptor_sets[0]);
 
     if (result != VK_SUCCESS)
         return false;
-    
-    m_descriptor_sets = descriptor_sets;
 
-    Texture* texture = TextureManager::getTextureManager()->getTexture(m_tex_name);
-    
-    if (texture == nullptr)
+    for (unsigned int i = 0; i < frames_count; i++)
     {
-        printf("Error: Missing texture: %s\n", m_tex_name.c_str());
+        bool success = writeDescriptorSet(i);
+
+        if (!success)
+            return false;
+    }
+
+    return true;
+}
+
+// Sets are rewritten when their frames are recorded again
+void Model::invalidateDescriptorSets()
+{
+    m_outdated_descriptor_sets.assign(m_descriptor_sets.size(), true);
+}
+
+// Must be called when the GPU is done with the previous use of the frame
+bool Model::updateDescriptorSet(unsigned int frame)
+{
+    if (!m_outdated_descriptor_sets[frame])
+        return true;
+
+    bool success = writeDescriptorSet(frame);
+
+    if (!success)
         return false;
+
+    m_outdated_descriptor_sets[frame] = false;
+
+    return true;
+}
+
+bool Model::writeDescriptorSet(unsigned int frame)
+{
+    Renderer* renderer = Renderer::getRenderer();
+    TextureManager* texture_manager = TextureManager::getTextureManager();
+
+    // Unused slots repeat the first texture, so that the whole array is valid
+    std::vector<VkDescriptorImageInfo> image_infos(MAX_MODEL_MATERIALS);
+
+    for (unsigned int i = 0; i < MAX_MODEL_MATERIALS; i++)
+    {
+        std::string tex_name = m_tex_names[i < m_tex_names.size() ? i : 0];
+        Texture* texture = texture_manager->getTexture(tex_name);
+    
+        if (texture == nullptr)
+        {
+            printf("Error: Missing texture: %s\n", tex_name.c_str());
+            return false;
+        }
+
+        VulkanImage* vulkan_image = texture->vulkan_image;
+        image_infos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        image_infos[i].imageView = vulkan_image->getImageView();
+        image_infos[i].sampler = vulkan_image->getSampler();
     }
         
-    VulkanImage* vulkan_image = texture->vulkan_image;
-    const std::vector<VkBuffer> uniform_buffers = renderer->getUniformBuffers();
-
-    for (unsigned int i = 0; i < m_descriptor_sets.size(); i++)
-    {
-        VkDescriptorBufferInfo buffer_info = {};
-        buffer_info.buffer = uniform_buffers[i];
-        buffer_info.offset = 0;
-        buffer_info.range = sizeof(UniformBufferObject);
-
-        VkDescriptorImageInfo image_info = {};
-        image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        image_info.imageView = vulkan_image->getImageView();
-        image_info.sampler = vulkan_image->getSampler();
-
-        std::array<VkWriteDescriptorSet, 2> write_descriptor_sets = {};
-        write_descriptor_sets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write_descriptor_sets[0].dstSet = m_descriptor_sets[i];
-        write_descriptor_sets[0].dstBinding = 0;
-        write_descriptor_sets[0].dstArrayElement = 0;
-        write_descriptor_sets[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        write_descriptor_sets[0].descriptorCount = 1;
-        write_descriptor_sets[0].pBufferInfo = &buffer_info;
-        write_descriptor_sets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        write_descriptor_sets[1].dstSet = m_descriptor_sets[i];
-        write_descriptor_sets[1].dstBinding = 1;
-        write_descriptor_sets[1].dstArrayElement = 0;
-        write_descriptor_sets[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        write_descriptor_sets[1].descriptorCount = 1;
-        write_descriptor_sets[1].pImageInfo = &image_info;
-
-        vkUpdateDescriptorSets(m_vulkan_device, (uint32_t)(write_descriptor_sets.size()),
-                               &write_descriptor_sets[0], 0, nullptr);
-    }
+    // Offset of the current frame slice is applied when the set is bound
+    VkDescriptorBufferInfo buffer_info = {};
+    buffer_info.buffer = renderer->getUniformBuffer();
+    buffer_info.offset = 0;
+    buffer_info.range = sizeof(UniformBufferObject);
+
+    std::array<VkWriteDescriptorSet, 2> write_descriptor_sets = {};
+    write_descriptor_sets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_sets[0].dstSet = m_descriptor_sets[frame];
+    write_descriptor_sets[0].dstBinding = 0;
+    write_descriptor_sets[0].dstArrayElement = 0;
+    write_descriptor_sets[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    write_descriptor_sets[0].descriptorCount = 1;
+    write_descriptor_sets[0].pBufferInfo = &buffer_info;
+    write_descriptor_sets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_sets[1].dstSet = m_descriptor_sets[frame];
+    write_descriptor_sets[1].dstBinding = 1;
+    write_descriptor_sets[1].dstArrayElement = 0;
+    write_descriptor_sets[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    write_descriptor_sets[1].descriptorCount = (uint32_t)(image_infos.size());
+    write_descriptor_sets[1].pImageInfo = &image_infos[0];
+
+    vkUpdateDescriptorSets(m_vulkan_device, (uint32_t)(write_descriptor_sets.size()),
+                           &write_descriptor_sets[0], 0, nullptr);
 
     return true;
 }
 
+void Model::computeBoundingSphere()
+{
+    m_bounding_center = glm::vec3(0.0f);
+    m_bounding_radius = 0.0f;
+
+    if (m_vertices.empty())
+        return;
+
+    glm::vec3 min_pos = m_vertices[0].pos;
+    glm::vec3 max_pos = m_vertices[0].pos;
+
+    for (const Vertex& vertex : m_vertices)
+    {
+        min_pos = glm::min(min_pos, vertex.pos);
+        max_pos = glm::max(max_pos, vertex.pos);
+    }
+
+    m_bounding_center = (min_pos + max_pos) * 0.5f;
+
+    for (const Vertex& vertex : m_vertices)
+    {
+        float distance = glm::length(vertex.pos - m_bounding_center);
+        m_bounding_radius = std::max(m_bounding_radius, distance);
+    }
+}
+
+void Model::computeSubMeshBounds(SubMesh& submesh)
+{
+    submesh.bounding_center = glm::vec3(0.0f);
+    submesh.bounding_radius = 0.0f;
+
+    if (submesh.index_count == 0)
+        return;
+
+    unsigned int first = submesh.first_index;
+    unsigned int last = submesh.first_index + submesh.index_count;
+
+    glm::vec3 min_pos = m_vertices[m_indices[first]].pos;
+    glm::vec3 max_pos = min_pos;
+
+    for (unsigned int i = first; i < last; i++)
+    {
+        min_pos = glm::min(min_pos, m_vertices[m_indices[i]].pos);
+        max_pos = glm::max(max_pos, m_vertices[m_indices[i]].pos);
+    }
+
+    submesh.bounding_center = (min_pos + max_pos) * 0.5f;
+
+    for (unsigned int i = first; i < last; i++)
+    {
+        float distance = glm::length(m_vertices[m_indices[i]].pos - 
+                                     submesh.bounding_center);
+        submesh.bounding_radius = std::max(submesh.bounding_radius, distance);
+    }
+}
+
+void Model::computeQuantization()
+{
+    m_position_scale = glm::vec3(1.0f);
+    m_position_offset = glm::vec3(0.0f);
+
+    if (m_vertices.empty())
+        return;
+
+    glm::vec3 min_pos = m_vertices[0].pos;
+    glm::vec3 max_pos = m_vertices[0].pos;
+
+    for (const Vertex& vertex : m_vertices)
+    {
+        min_pos = glm::min(min_pos, vertex.pos);
+        max_pos = glm::max(max_pos, vertex.pos);
+    }
+
+    m_position_offset = min_pos;
+    m_position_scale = max_pos - min_pos;
+
+    // Flat models still need a valid scale for the zero-sized axis
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        if (m_position_scale[i] <= 0.0f)
+        {
+            m_position_scale[i] = 1.0f;
+        }
+    }
+}
+
+PackedVertex Model::packVertex(const Vertex& vertex)
+{
+    PackedVertex packed_vertex = {};
+
+    glm::vec3 pos = (vertex.pos - m_position_offset) / m_position_scale;
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        packed_vertex.pos[i] = packUnorm16(pos[i]);
+    }
+
+    // Octahedral encoding, lower hemisphere is folded over the diagonals
+    glm::vec3 normal = vertex.normal;
+    float length = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+
+    if (length > 0.0f)
+    {
+        normal /= length;
+    }
+    else
+    {
+        normal = glm::vec3(0.0f, 0.0f, 1.0f);
+    }
+
+    glm::vec2 encoded(normal.x, normal.y);
+
+    if (normal.z < 0.0f)
+    {
+        encoded.x = (1.0f - fabsf(normal.y)) * (normal.x >= 0.0f ? 1.0f : -1.0f);
+        encoded.y = (1.0f - fabsf(normal.x)) * (normal.y >= 0.0f ? 1.0f : -1.0f);
+    }
+
+    packed_vertex.normal[0] = packSnorm16(encoded.x);
+    packed_vertex.normal[1] = packSnorm16(encoded.y);
+
+    packed_vertex.tex_coord[0] = packHalf(vertex.tex_coord.x);
+    packed_vertex.tex_coord[1] = packHalf(vertex.tex_coord.y);
+
+    return packed_vertex;
+}
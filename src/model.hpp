@@ -27,13 +27,63 @@
 #include <map>
 #include <string>
 
+// Meshes with more vertices must be split to use 16-bit indices
+const unsigned int MAX_16BIT_INDEX_VERTICES = 65536;
+
+// Textures of a model are bound as one array. It's the lowest
+// maxPerStageDescriptorSamplers allowed by the spec.
+const unsigned int MAX_MODEL_MATERIALS = 16;
+
 struct Vertex
 {
     glm::vec3 pos;
-    glm::vec3 color;
+    glm::vec3 normal;
     glm::vec2 tex_coord;
 };
 
+// Vertex format used on GPU. Positions are unorm16 relative to the model
+// bounding box, normals are octahedral encoded snorm16 and texture 
+// coordinates are half floats.
+struct PackedVertex
+{
+    uint16_t pos[4];
+    int16_t normal[2];
+    uint16_t tex_coord[2];
+};
+
+// Range of the index buffer that uses a single material. Sub-meshes are
+// sorted by material.
+struct SubMesh
+{
+    uint32_t first_index;
+    uint32_t index_count;
+    uint32_t material;
+    glm::vec3 bounding_center;
+    float bounding_radius;
+};
+
+// Bounds of the triangles of one source shape with a single material. Unlike
+// sub-meshes they stay local when shapes are batched, so they are used for
+// the texture streaming demand.
+struct MaterialBounds
+{
+    uint32_t material;
+    glm::vec3 bounding_center;
+    float bounding_radius;
+};
+
+// Small cluster of triangles that is culled as a whole on GPU. The layout
+// matches the meshlets storage buffer in cull.comp.
+struct Meshlet
+{
+    glm::vec4 sphere;
+    glm::vec4 cone;
+    uint32_t index_count;
+    uint32_t first_index;
+    uint32_t material;
+    uint32_t padding;
+};
+
 class Model
 {
 private:
@@ -43,37 +93,64 @@ private:
     std::string m_name;
     std::vector<Vertex> m_vertices;
     std::vector<uint32_t> m_indices;
-    std::string m_tex_name;
+    std::vector<SubMesh> m_submeshes;
+    std::vector<MaterialBounds> m_material_bounds;
+    std::vector<std::string> m_tex_names;
+    glm::vec3 m_bounding_center;
+    float m_bounding_radius;
+    glm::vec3 m_position_scale;
+    glm::vec3 m_position_offset;
+    std::vector<Meshlet> m_meshlets;
 
     VkBuffer m_vertex_buffer;
     VkDeviceMemory m_vertex_buffer_memory;
     VkBuffer m_index_buffer;
     VkDeviceMemory m_index_buffer_memory;
+    VkIndexType m_index_type;
     std::vector<VkDescriptorSet> m_descriptor_sets;
+    std::vector<bool> m_outdated_descriptor_sets;
 
     bool createVertexBuffer();
     bool createIndexBuffer();
     bool createDescriptorSets();
+    bool writeDescriptorSet(unsigned int frame);
+    void computeBoundingSphere();
+    void computeSubMeshBounds(SubMesh& submesh);
+    void computeQuantization();
+    PackedVertex packVertex(const Vertex& vertex);
 
 public:
     Model(std::string name,
           const std::vector<Vertex>& vertices,
           const std::vector<uint32_t>& indices,
-          std::string tex_name);
+          const std::vector<SubMesh>& submeshes,
+          const std::vector<MaterialBounds>& material_bounds,
+          const std::vector<std::string>& tex_names);
     ~Model();
 
     bool init();
+    void invalidateDescriptorSets();
+    bool updateDescriptorSet(unsigned int frame);
 
     const std::vector<Vertex>& getVertices() {return m_vertices;}
     const std::vector<uint32_t>& getIndices() {return m_indices;}
     std::string getName() {return m_name;}
-    std::string getTexName() {return m_tex_name;}
+    const std::vector<SubMesh>& getSubMeshes() {return m_submeshes;}
+    const std::vector<MaterialBounds>& getMaterialBounds() {return m_material_bounds;}
+    const std::vector<std::string>& getTexNames() {return m_tex_names;}
+    glm::vec3 getBoundingCenter() {return m_bounding_center;}
+    float getBoundingRadius() {return m_bounding_radius;}
+    glm::vec3 getPositionScale() {return m_position_scale;}
+    glm::vec3 getPositionOffset() {return m_position_offset;}
+    const std::vector<Meshlet>& getMeshlets() {return m_meshlets;}
+    VkDeviceSize getUploadSize();
 
     const VkBuffer getVertexBuffer() {return m_vertex_buffer;}
     const VkDeviceMemory getVertexBufferMemory() {return m_vertex_buffer_memory;}
     const VkBuffer getIndexBuffer() {return m_index_buffer;}
     const VkDeviceMemory getIndexBufferMemory() {return m_index_buffer_memory;}
-    const std::vector<VkDescriptorSet>& getDescriptorSets() {return m_descriptor_sets;}
+    VkIndexType getIndexType() {return m_index_type;}
+    VkDescriptorSet getDescriptorSet(unsigned int frame) {return m_descriptor_sets[frame];}
 };
 
 #endif
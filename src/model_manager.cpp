@@ -14,9 +14,12 @@
 //    You should have received a copy of the GNU General Public License
 //    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include "cpu_profiler.hpp"
 #include "file_manager.hpp"
+#include "mesh_optimizer.hpp"
 #include "model_manager.hpp"
 #include "renderer.hpp"
+#include "texture_streamer.hpp"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
@@ -26,8 +29,206 @@
 
 ModelManager* ModelManager::m_model_manager = nullptr;
 
+struct MeshData
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    // Material of every triangle, index to tex_names
+    std::vector<uint32_t> materials;
+    // Source shape of every triangle, batched meshes keep per-shape bounds
+    // for texture streaming
+    std::vector<uint32_t> shapes;
+    std::vector<std::string> tex_names;
+};
+
+static uint32_t getMaterial(MeshData& mesh_data, std::string tex_name)
+{
+    for (unsigned int i = 0; i < mesh_data.tex_names.size(); i++)
+    {
+        if (mesh_data.tex_names[i] == tex_name)
+            return i;
+    }
+
+    mesh_data.tex_names.push_back(tex_name);
+
+    return mesh_data.tex_names.size() - 1;
+}
+
+// Stable counting sort of triangles, so that every material is a single
+// range of the index buffer
+static void sortByMaterial(MeshData& mesh_data)
+{
+    std::vector<unsigned int> offsets(mesh_data.tex_names.size() + 1, 0);
+
+    for (uint32_t material : mesh_data.materials)
+    {
+        offsets[material + 1]++;
+    }
+
+    for (unsigned int i = 0; i < mesh_data.tex_names.size(); i++)
+    {
+        offsets[i + 1] += offsets[i];
+    }
+
+    std::vector<uint32_t> indices(mesh_data.indices.size());
+    std::vector<uint32_t> materials(mesh_data.materials.size());
+    std::vector<uint32_t> shapes(mesh_data.shapes.size());
+
+    for (unsigned int i = 0; i < mesh_data.materials.size(); i++)
+    {
+        uint32_t material = mesh_data.materials[i];
+        unsigned int triangle = offsets[material]++;
+
+        materials[triangle] = material;
+        shapes[triangle] = mesh_data.shapes[i];
+        indices[triangle * 3 + 0] = mesh_data.indices[i * 3 + 0];
+        indices[triangle * 3 + 1] = mesh_data.indices[i * 3 + 1];
+        indices[triangle * 3 + 2] = mesh_data.indices[i * 3 + 2];
+    }
+
+    mesh_data.indices.swap(indices);
+    mesh_data.materials.swap(materials);
+    mesh_data.shapes.swap(shapes);
+}
+
+static void computeNormals(std::vector<Vertex>& vertices,
+                           const std::vector<uint32_t>& indices)
+{
+    for (unsigned int i = 0; i + 2 < indices.size(); i += 3)
+    {
+        Vertex& v0 = vertices[indices[i]];
+        Vertex& v1 = vertices[indices[i + 1]];
+        Vertex& v2 = vertices[indices[i + 2]];
+
+        // Not normalized, so that larger faces have more weight
+        glm::vec3 normal = glm::cross(v1.pos - v0.pos, v2.pos - v0.pos);
+        v0.normal += normal;
+        v1.normal += normal;
+        v2.normal += normal;
+    }
+
+    for (Vertex& vertex : vertices)
+    {
+        float length = glm::length(vertex.normal);
+
+        if (length > 0.0f)
+        {
+            vertex.normal /= length;
+        }
+    }
+}
+
+// Bounds of every run of triangles from one shape with one material. Runs
+// are computed before the triangles are reordered by the optimizer.
+static void computeMaterialBounds(const MeshData& mesh_data,
+                                  std::vector<MaterialBounds>& bounds)
+{
+    std::vector<glm::vec3> min_pos;
+    std::vector<glm::vec3> max_pos;
+
+    for (unsigned int i = 0; i < mesh_data.materials.size(); i++)
+    {
+        if (i == 0 || mesh_data.materials[i] != mesh_data.materials[i - 1] ||
+            mesh_data.shapes[i] != mesh_data.shapes[i - 1])
+        {
+            MaterialBounds material_bounds = {};
+            material_bounds.material = mesh_data.materials[i];
+            bounds.push_back(material_bounds);
+
+            glm::vec3 pos = mesh_data.vertices[mesh_data.indices[i * 3]].pos;
+            min_pos.push_back(pos);
+            max_pos.push_back(pos);
+        }
+
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            uint32_t index = mesh_data.indices[i * 3 + j];
+            glm::vec3 pos = mesh_data.vertices[index].pos;
+            min_pos.back() = glm::min(min_pos.back(), pos);
+            max_pos.back() = glm::max(max_pos.back(), pos);
+        }
+    }
+
+    for (unsigned int i = 0; i < bounds.size(); i++)
+    {
+        bounds[i].bounding_center = (min_pos[i] + max_pos[i]) * 0.5f;
+        bounds[i].bounding_radius = glm::length(max_pos[i] - min_pos[i]) * 
+                                    0.5f;
+    }
+}
+
+// Splits the mesh into chunks that can use 16-bit indices and bind all their
+// textures at once. Triangles are kept in the original order, a new chunk is 
+// started when the next triangle doesn't fit in the current one.
+static void splitMesh(const MeshData& mesh_data, std::vector<MeshData>& chunks)
+{
+    std::vector<uint32_t> remap(mesh_data.vertices.size());
+    std::vector<unsigned int> remap_chunk(mesh_data.vertices.size(), 0);
+    std::vector<uint32_t> remap_material(mesh_data.tex_names.size());
+    std::vector<unsigned int> remap_material_chunk(mesh_data.tex_names.size(), 0);
+    unsigned int chunk_id = 0;
+
+    for (unsigned int i = 0; i + 2 < mesh_data.indices.size(); i += 3)
+    {
+        uint32_t material = mesh_data.materials[i / 3];
+        unsigned int new_vertices = 0;
+        unsigned int new_materials = 0;
+
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            if (remap_chunk[mesh_data.indices[i + j]] != chunk_id)
+            {
+                new_vertices++;
+            }
+        }
+
+        if (remap_material_chunk[material] != chunk_id)
+        {
+            new_materials++;
+        }
+
+        if (chunk_id == 0 || 
+            chunks.back().vertices.size() + new_vertices > 
+                                                MAX_16BIT_INDEX_VERTICES ||
+            chunks.back().tex_names.size() + new_materials > 
+                                                MAX_MODEL_MATERIALS)
+        {
+            chunks.push_back(MeshData());
+            chunk_id++;
+        }
+
+        MeshData& chunk = chunks.back();
+
+        if (remap_material_chunk[material] != chunk_id)
+        {
+            remap_material_chunk[material] = chunk_id;
+            remap_material[material] = chunk.tex_names.size();
+            chunk.tex_names.push_back(mesh_data.tex_names[material]);
+        }
+
+        chunk.materials.push_back(remap_material[material]);
+        chunk.shapes.push_back(mesh_data.shapes[i / 3]);
+
+        for (unsigned int j = 0; j < 3; j++)
+        {
+            uint32_t index = mesh_data.indices[i + j];
+
+            if (remap_chunk[index] != chunk_id)
+            {
+                remap_chunk[index] = chunk_id;
+                remap[index] = chunk.vertices.size();
+                chunk.vertices.push_back(mesh_data.vertices[index]);
+            }
+
+            chunk.indices.push_back(remap[index]);
+        }
+    }
+}
+
 ModelManager::ModelManager()
 {
+    m_mesh_report = false;
+    m_static_batching = true;
     m_model_manager = this;
 }
 
@@ -37,12 +238,17 @@ ModelManager::~ModelManager()
     {
         delete model;
     }
+
+    for (auto model : m_pending_models)
+    {
+        delete model;
+    }
 }
 
-bool ModelManager::init()
+void ModelManager::load()
 {
-    Renderer* renderer = Renderer::getRenderer();
-    
+    CPU_PROFILER_SCOPE("ModelManager::load");
+
     FileManager* file_manager = FileManager::getFileManager();
     std::vector<std::string> assets_list = file_manager->getAssetsList();
 
@@ -61,24 +267,17 @@ bool ModelManager::init()
     
         if (!success)
             continue;
+
+        // Static shapes are merged into one mesh, materials are kept per
+        // triangle
+        MeshData batch;
     
         for (unsigned int i = 0; i < shapes.size(); i++)
         {
             std::vector<Vertex> vertices;
             std::vector<uint32_t> indices;
-            std::string tex_name;
     
             tinyobj::mesh_t mesh = shapes[i].mesh;
-    
-            if (mesh.material_ids.size() > 0)
-            {
-                int material_id = mesh.material_ids[0];
-    
-                if (material_id > -1)
-                {
-                    tex_name = materials[material_id].diffuse_texname;
-                }
-            }
             
             for (auto index : mesh.indices)
             {
@@ -100,14 +299,22 @@ bool ModelManager::init()
                     };
                 }
 
-                vertex.color = {1.0f, 1.0f, 1.0f};
+                if (mesh.normals.size() > 0)
+                {
+                    vertex.normal = 
+                    {
+                        mesh.normals[index * 3 + 0],
+                        mesh.normals[index * 3 + 1],
+                        mesh.normals[index * 3 + 2]
+                    };
+                }
                 
                 unsigned int vertex_id = vertices.size();
                 
                 for (unsigned int j = 0; j < vertices.size(); j++)
                 {
                     if (vertex.pos == vertices[j].pos &&
-                        vertex.color == vertices[j].color &&
+                        vertex.normal == vertices[j].normal &&
                         vertex.tex_coord == vertices[j].tex_coord)
                     {
                         vertex_id = j;
@@ -122,39 +329,217 @@ bool ModelManager::init()
 
                 indices.push_back(vertex_id);
             }
-    
-            Model* model = new Model(name, vertices, indices, 
-                                     tex_name.empty() ? "white.png" : tex_name);
-            m_models.push_back(model);
+
+            if (mesh.normals.empty())
+            {
+                computeNormals(vertices, indices);
+            }
+
+            MeshData shape_data;
+            MeshData* mesh_data = m_static_batching ? &batch : &shape_data;
+
+            uint32_t first_vertex = mesh_data->vertices.size();
+            mesh_data->vertices.insert(mesh_data->vertices.end(), 
+                                       vertices.begin(), vertices.end());
+
+            int last_material_id = -2;
+            uint32_t material = 0;
+
+            for (unsigned int j = 0; j + 2 < indices.size(); j += 3)
+            {
+                unsigned int face = j / 3;
+                int material_id = -1;
+
+                if (face < mesh.material_ids.size())
+                {
+                    material_id = mesh.material_ids[face];
+                }
+
+                if (material_id != last_material_id)
+                {
+                    std::string tex_name;
+
+                    if (material_id > -1)
+                    {
+                        tex_name = materials[material_id].diffuse_texname;
+                    }
+
+                    if (tex_name.empty())
+                    {
+                        tex_name = "white.png";
+                    }
+
+                    material = getMaterial(*mesh_data, tex_name);
+                    last_material_id = material_id;
+                }
+
+                mesh_data->materials.push_back(material);
+                mesh_data->shapes.push_back(i);
+                mesh_data->indices.push_back(first_vertex + indices[j]);
+                mesh_data->indices.push_back(first_vertex + indices[j + 1]);
+                mesh_data->indices.push_back(first_vertex + indices[j + 2]);
+            }
+
+            if (!m_static_batching)
+            {
+                addMesh(name, shape_data);
+            }
+        }
+
+        if (!batch.indices.empty())
+        {
+            addMesh(name, batch);
         }
     }
-    
-    bool success = renderer->createDescriptorPool(m_models.size());
-    
-    if (!success)
-    {
-        printf("Error: Couldn't create descriptor pool\n");
-        return false;
-    }
-    
-    for (Model* model : m_models)
+}
+
+bool ModelManager::update(UploadBudget* upload_budget)
+{
+    Renderer* renderer = Renderer::getRenderer();
+    unsigned int count = 0;
+    bool success = true;
+
+    // The budget is checked before every model, so that the time limit
+    // applies to model uploads too
+    while (true)
     {
+        Model* model = nullptr;
+        VkDeviceSize upload_size = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(m_pending_mutex);
+
+            if (m_pending_models.empty())
+                break;
+
+            model = m_pending_models.front();
+            upload_size = model->getUploadSize();
+
+            if (!upload_budget->canUpload(upload_size))
+                break;
+
+            m_pending_models.erase(m_pending_models.begin());
+        }
+
+        CPU_PROFILER_SCOPE("Model::init");
+
+        // Added before initialization, so that it's released on failure
+        m_models.push_back(model);
+
         success = model->init();
         
         if (!success)
         {
             printf("Error: Couldn't create model: %s\n", model->getName().c_str());
-            return false;
+            break;
         }
+
+        upload_budget->addUpload(upload_size);
+        count++;
     }
-    
-    success = renderer->buildCommandBuffers(m_models);
+
+    if (!success)
+        return false;
+
+    if (count == 0)
+        return true;
+
+    CPU_PROFILER_SCOPE("ModelManager::update");
+
+    success = renderer->createMeshletBuffers(m_models);
     
     if (!success)
     {
-        printf("Error: Couldn't build command buffers\n");
+        printf("Error: Couldn't create meshlet buffers\n");
         return false;
     }
 
+    // Meshlets of all models are uploaded again
+    upload_budget->addUpload(renderer->getMeshletBufferSize());
+
+    renderer->setModels(m_models);
+
+    TextureStreamer* texture_streamer = TextureStreamer::getTextureStreamer();
+
+    if (texture_streamer != nullptr)
+    {
+        texture_streamer->updateModels();
+    }
+
+    if (m_mesh_report)
+    {
+        printf("Models: %u, draw calls per frame: %u\n", 
+               (unsigned int)m_models.size(), renderer->getDrawCallsCount());
+    }
+
     return true;
 }
+
+void ModelManager::addMesh(std::string name, MeshData& mesh_data)
+{
+    sortByMaterial(mesh_data);
+
+    if (mesh_data.vertices.size() <= MAX_16BIT_INDEX_VERTICES &&
+        mesh_data.tex_names.size() <= MAX_MODEL_MATERIALS)
+    {
+        addModel(name, mesh_data);
+        return;
+    }
+
+    std::vector<MeshData> chunks;
+    splitMesh(mesh_data, chunks);
+
+    for (MeshData& chunk : chunks)
+    {
+        addModel(name, chunk);
+    }
+}
+
+void ModelManager::addModel(std::string name, MeshData& mesh_data)
+{
+    std::vector<Vertex>& vertices = mesh_data.vertices;
+    std::vector<uint32_t>& indices = mesh_data.indices;
+
+    // Triangles are already sorted by material
+    std::vector<SubMesh> submeshes;
+
+    for (unsigned int i = 0; i < mesh_data.materials.size(); i++)
+    {
+        if (submeshes.empty() || 
+            submeshes.back().material != mesh_data.materials[i])
+        {
+            SubMesh submesh = {};
+            submesh.first_index = i * 3;
+            submesh.material = mesh_data.materials[i];
+            submeshes.push_back(submesh);
+        }
+
+        submeshes.back().index_count += 3;
+    }
+
+    std::vector<MaterialBounds> material_bounds;
+    computeMaterialBounds(mesh_data, material_bounds);
+
+    VertexCacheStats before = MeshOptimizer::analyzeVertexCache(indices, 
+                                                            vertices.size());
+
+    MeshOptimizer::optimize(vertices, indices, submeshes);
+
+    if (m_mesh_report)
+    {
+        VertexCacheStats after = MeshOptimizer::analyzeVertexCache(indices, 
+                                                            vertices.size());
+
+        printf("Mesh %s (%u materials): %u triangles, ACMR %.3f -> %.3f, "
+               "ATVR %.3f -> %.3f\n", name.c_str(), 
+               (unsigned int)mesh_data.tex_names.size(),
+               (unsigned int)indices.size() / 3, before.acmr, after.acmr,
+               before.atvr, after.atvr);
+    }
+
+    Model* model = new Model(name, vertices, indices, submeshes, 
+                             material_bounds, mesh_data.tex_names);
+
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+    m_pending_models.push_back(model);
+}
@@ -18,23 +18,38 @@
 #define MODEL_MANAGER_HPP
 
 #include "model.hpp"
+#include "upload_budget.hpp"
 
+#include <mutex>
 #include <string>
 #include <vector>
 
+struct MeshData;
 
+// Models are parsed by load(), which can run on any thread, and are added to
+// the renderer by update() on the main thread as soon as they are ready
 class ModelManager
 {
 private:
     std::vector<Model*> m_models;
+    std::vector<Model*> m_pending_models;
+    std::mutex m_pending_mutex;
+    bool m_mesh_report;
+    bool m_static_batching;
     static ModelManager* m_model_manager;
 
+    void addMesh(std::string name, MeshData& mesh_data);
+    void addModel(std::string name, MeshData& mesh_data);
+
 public:
     ModelManager();
     ~ModelManager();
 
-    bool init();
+    void load();
+    bool update(UploadBudget* upload_budget);
     const std::vector<Model*>& getModels() {return m_models;}
+    void setMeshReport(bool mesh_report) {m_mesh_report = mesh_report;}
+    void setStaticBatching(bool static_batching) {m_static_batching = static_batching;}
 
     static ModelManager* getModelManager() {return m_model_manager;}
 };
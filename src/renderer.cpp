@@ -15,7 +15,10 @@
 //    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "camera.hpp"
+#include "cpu_profiler.hpp"
+#include "device_manager.hpp"
 #include "file_manager.hpp"
+#include "metrics.hpp"
 #include "renderer.hpp"
 
 #include <array>
@@ -32,24 +35,58 @@ Renderer::Renderer()
     m_render_pass = VK_NULL_HANDLE;
     m_pipeline_layout = VK_NULL_HANDLE;
     m_graphics_pipeline = VK_NULL_HANDLE;
-    m_descriptor_pool = VK_NULL_HANDLE;
     m_descriptor_set_layout = VK_NULL_HANDLE;
+    m_uniform_buffer = VK_NULL_HANDLE;
+    m_uniform_buffer_memory = VK_NULL_HANDLE;
+    m_uniform_data = nullptr;
+    m_uniform_slice_size = 0;
+    m_cull_uniform_offset = 0;
+    m_descriptor_pool_free = 0;
+
+    m_cluster_culling = true;
+    m_cull_descriptor_set_layout = VK_NULL_HANDLE;
+    m_cull_pipeline_layout = VK_NULL_HANDLE;
+    m_cull_pipeline = VK_NULL_HANDLE;
+    m_cull_descriptor_pool = VK_NULL_HANDLE;
+    m_meshlet_buffer = VK_NULL_HANDLE;
+    m_meshlet_buffer_memory = VK_NULL_HANDLE;
+    m_meshlets_count = 0;
+    m_draw_calls_count = 0;
+    m_triangles_count = 0;
+    m_pipeline_statistics = false;
+    m_statistics_query_pool = VK_NULL_HANDLE;
+    m_render_stats = {};
+    m_gpu_profiler = new GpuProfiler();
+
+    Metrics* metrics = Metrics::getMetrics();
+    m_draw_calls_metric = metrics->getGauge("renderer_draw_calls",
+                                            "Draw calls in the last frame");
+    m_triangles_metric = metrics->getGauge("renderer_triangles",
+                                "Triangles submitted in the last frame");
+    m_overdraw_metric = metrics->getGauge("renderer_overdraw",
+                                "Fragment shader invocations per pixel");
+    m_acquire_time = 0;
 }
 
 Renderer::~Renderer()
 {
+    delete m_gpu_profiler;
+    vkDestroyQueryPool(m_vulkan_device, m_statistics_query_pool, nullptr);
+    destroyMeshletBuffers();
+
+    vkDestroyPipeline(m_vulkan_device, m_cull_pipeline, nullptr);
+    vkDestroyPipelineLayout(m_vulkan_device, m_cull_pipeline_layout, nullptr);
+    vkDestroyDescriptorSetLayout(m_vulkan_device, m_cull_descriptor_set_layout, nullptr);
+
     vkDestroyDescriptorSetLayout(m_vulkan_device, m_descriptor_set_layout, nullptr);
-    vkDestroyDescriptorPool(m_vulkan_device, m_descriptor_pool, nullptr);
 
-    for (auto uniform_buffer : m_uniform_buffers)
+    for (VkDescriptorPool descriptor_pool : m_descriptor_pools)
     {
-        vkDestroyBuffer(m_vulkan_device, uniform_buffer, nullptr);
+        vkDestroyDescriptorPool(m_vulkan_device, descriptor_pool, nullptr);
     }
 
-    for (auto uniform_buffer_memory : m_uniform_buffers_memory)
-    {
-        vkFreeMemory(m_vulkan_device, uniform_buffer_memory, nullptr);
-    }
+    vkDestroyBuffer(m_vulkan_device, m_uniform_buffer, nullptr);
+    m_vulkan_context->freeMemory(m_uniform_buffer_memory);
 
     for (auto framebuffer : m_swap_chain_framebuffers)
     {
@@ -111,6 +148,59 @@ bool Renderer::init()
         return false;
     }
 
+    success = m_gpu_profiler->init();
+
+    if (!success)
+    {
+        printf("Error: Couldn't create GPU profiler\n");
+        return false;
+    }
+
+    if (m_pipeline_statistics && 
+        !m_vulkan_context->isPipelineStatisticsSupported())
+    {
+        printf("Warning: Pipeline statistics queries are not supported\n");
+        m_pipeline_statistics = false;
+    }
+
+    if (m_pipeline_statistics)
+    {
+        success = createStatisticsQueryPool();
+
+        if (!success)
+        {
+            printf("Error: Couldn't create pipeline statistics query pool\n");
+            return false;
+        }
+    }
+
+    if (m_cluster_culling && 
+        !m_vulkan_context->isDrawIndirectFirstInstanceSupported())
+    {
+        printf("Warning: Cluster culling disabled, drawIndirectFirstInstance "
+               "is not supported\n");
+        m_cluster_culling = false;
+    }
+
+    if (!m_cluster_culling)
+        return true;
+
+    success = createCullDescriptorSetLayout();
+
+    if (!success)
+    {
+        printf("Error: Couldn't create cull descriptor set layout\n");
+        return false;
+    }
+
+    success = createCullPipeline();
+
+    if (!success)
+    {
+        printf("Error: Couldn't create cull pipeline\n");
+        return false;
+    }
+
     return true;
 }
 
@@ -124,7 +214,9 @@ bool Renderer::createRenderPass()
     color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    color_attachment.finalLayout = m_vulkan_context->isHeadless() ? 
+                                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL :
+                                   VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     VkAttachmentDescription depth_attachment = {};
     depth_attachment.format = m_vulkan_context->getDepthImage()->getFormat();
@@ -183,6 +275,14 @@ bool Renderer::createPipelineLayout()
     pipeline_layout_info.setLayoutCount = 1;
     pipeline_layout_info.pSetLayouts = &m_descriptor_set_layout;
 
+    VkPushConstantRange push_constant_range = {};
+    push_constant_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    push_constant_range.offset = 0;
+    push_constant_range.size = sizeof(ModelPushConstants);
+
+    pipeline_layout_info.pushConstantRangeCount = 1;
+    pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+
     VkResult result = vkCreatePipelineLayout(m_vulkan_device, &pipeline_layout_info,
                                              nullptr, &m_pipeline_layout);
 
@@ -224,22 +324,22 @@ bool Renderer::createGraphicsPipeline()
 
     VkVertexInputBindingDescription binding_description = {};
     binding_description.binding = 0;
-    binding_description.stride = sizeof(Vertex);
+    binding_description.stride = sizeof(PackedVertex);
     binding_description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 
     std::array<VkVertexInputAttributeDescription, 3> attribute_descriptions = {};
     attribute_descriptions[0].binding = 0;
     attribute_descriptions[0].location = 0;
-    attribute_descriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attribute_descriptions[0].offset = offsetof(Vertex, pos);
+    attribute_descriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+    attribute_descriptions[0].offset = offsetof(PackedVertex, pos);
     attribute_descriptions[1].binding = 0;
     attribute_descriptions[1].location = 1;
-    attribute_descriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attribute_descriptions[1].offset = offsetof(Vertex, color);
+    attribute_descriptions[1].format = VK_FORMAT_R16G16_SNORM;
+    attribute_descriptions[1].offset = offsetof(PackedVertex, normal);
     attribute_descriptions[2].binding = 0;
     attribute_descriptions[2].location = 2;
-    attribute_descriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attribute_descriptions[2].offset = offsetof(Vertex, tex_coord);
+    attribute_descriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+    attribute_descriptions[2].offset = offsetof(PackedVertex, tex_coord);
 
     VkPipelineVertexInputStateCreateInfo vertex_input_info = {};
     vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -372,40 +472,62 @@ bool Renderer::createFramebuffers()
     return true;
 }
 
+static VkDeviceSize alignSize(VkDeviceSize size, VkDeviceSize alignment)
+{
+    if (alignment == 0)
+        return size;
+
+    return (size + alignment - 1) / alignment * alignment;
+}
+
 bool Renderer::createUniformBuffers()
 {
-    unsigned int count = m_vulkan_context->getSwapChainImagesCount();
-    
-    for (unsigned int i = 0; i < count; i++)
-    {
-        VkBuffer uniform_buffer = VK_NULL_HANDLE;
-        VkDeviceMemory uniform_buffer_memory = VK_NULL_HANDLE;
-        
-        bool success = m_vulkan_context->createBuffer(sizeof(UniformBufferObject),
+    // Every frame in flight has its own slice of one persistently mapped
+    // buffer, with the cull uniforms placed after the draw uniforms
+    VkDeviceSize alignment = m_vulkan_context->getDeviceProperties().limits.
+                                                minUniformBufferOffsetAlignment;
+    m_cull_uniform_offset = alignSize(sizeof(UniformBufferObject), alignment);
+    m_uniform_slice_size = m_cull_uniform_offset + 
+                           alignSize(sizeof(CullUniformBufferObject), alignment);
+
+    VkDeviceSize size = m_uniform_slice_size * 
+                        m_vulkan_context->getFramesInFlight();
+
+    bool success = m_vulkan_context->createBuffer(size,
                                            VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
                                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                           uniform_buffer, uniform_buffer_memory);
+                                           m_uniform_buffer, m_uniform_buffer_memory,
+                                           MEMORY_CATEGORY_UNIFORM);
 
-        if (!success)
-            return false;
-        
-        m_uniform_buffers.push_back(uniform_buffer);
-        m_uniform_buffers_memory.push_back(uniform_buffer_memory);
-    }
+    if (!success)
+        return false;
+
+    void* data = nullptr;
+    VkResult result = vkMapMemory(m_vulkan_device, m_uniform_buffer_memory, 0, 
+                                  size, 0, &data);
+
+    if (result != VK_SUCCESS)
+        return false;
+
+    m_uniform_data = (unsigned char*)data;
 
     return true;
 }
 
-bool Renderer::createDescriptorPool(unsigned int models_count)
+// Models can be added while rendering, so every batch gets its own pool
+bool Renderer::createDescriptorPool()
 {
-    uint32_t descriptor_count = models_count * m_vulkan_context->getSwapChainImagesCount();
+    // Every frame in flight has its own set, uniform slice is selected with
+    // a dynamic offset
+    uint32_t descriptor_count = DESCRIPTOR_POOL_MODELS * 
+                                m_vulkan_context->getFramesInFlight();
 
     std::array<VkDescriptorPoolSize, 2> pool_sizes = {};
-    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     pool_sizes[0].descriptorCount = descriptor_count;
     pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    pool_sizes[1].descriptorCount = descriptor_count;
+    pool_sizes[1].descriptorCount = descriptor_count * MAX_MODEL_MATERIALS;
 
     VkDescriptorPoolCreateInfo pool_info = {};
     pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -413,10 +535,37 @@ bool Renderer::createDescriptorPool(unsigned int models_count)
     pool_info.pPoolSizes = &pool_sizes[0];
     pool_info.maxSets = descriptor_count;
 
+    VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
     VkResult result = vkCreateDescriptorPool(m_vulkan_device, &pool_info,
-                                             nullptr, &m_descriptor_pool);
+                                             nullptr, &descriptor_pool);
 
-    return (result == VK_SUCCESS);
+    if (result != VK_SUCCESS)
+        return false;
+
+    m_descriptor_pools.push_back(descriptor_pool);
+    m_descriptor_pool_free = DESCRIPTOR_POOL_MODELS;
+
+    return true;
+}
+
+// Returns a pool with space for the sets of one model, a new pool is created
+// when the last one is full
+VkDescriptorPool Renderer::getDescriptorPool()
+{
+    if (m_descriptor_pool_free == 0)
+    {
+        bool success = createDescriptorPool();
+
+        if (!success)
+        {
+            printf("Error: Couldn't create descriptor pool\n");
+            return VK_NULL_HANDLE;
+        }
+    }
+
+    m_descriptor_pool_free--;
+
+    return m_descriptor_pools.back();
 }
 
 bool Renderer::createDescriptorSetLayout()
@@ -424,13 +573,13 @@ bool Renderer::createDescriptorSetLayout()
     VkDescriptorSetLayoutBinding ubo_layout_binding = {};
     ubo_layout_binding.binding = 0;
     ubo_layout_binding.descriptorCount = 1;
-    ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    ubo_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     ubo_layout_binding.pImmutableSamplers = nullptr;
     ubo_layout_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
     VkDescriptorSetLayoutBinding sampler_layout_binding = {};
     sampler_layout_binding.binding = 1;
-    sampler_layout_binding.descriptorCount = 1;
+    sampler_layout_binding.descriptorCount = MAX_MODEL_MATERIALS;
     sampler_layout_binding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     sampler_layout_binding.pImmutableSamplers = nullptr;
     sampler_layout_binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -449,66 +598,553 @@ bool Renderer::createDescriptorSetLayout()
     return (result == VK_SUCCESS);
 }
 
-bool Renderer::buildCommandBuffers(std::vector<Model*>& models)
+bool Renderer::createCullDescriptorSetLayout()
 {
-    m_models = models;
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorCount = 1;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorCount = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[2].binding = 2;
+    bindings[2].descriptorCount = 1;
+    bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[2].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layout_info = {};
+    layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layout_info.bindingCount = (uint32_t)(bindings.size());
+    layout_info.pBindings = &bindings[0];
+
+    VkResult result = vkCreateDescriptorSetLayout(m_vulkan_device, &layout_info,
+                                                  nullptr, 
+                                                  &m_cull_descriptor_set_layout);
+
+    return (result == VK_SUCCESS);
+}
+
+bool Renderer::createCullPipeline()
+{
+    VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+    pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_info.setLayoutCount = 1;
+    pipeline_layout_info.pSetLayouts = &m_cull_descriptor_set_layout;
 
-    const std::vector<VkCommandBuffer> command_buffers = m_vulkan_context->getCommandBuffers();
+    VkResult result = vkCreatePipelineLayout(m_vulkan_device, &pipeline_layout_info,
+                                             nullptr, &m_cull_pipeline_layout);
+
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkShaderModule shader_module_comp;
+
+    bool success = createShaderModule("cull_comp.spv", &shader_module_comp);
+
+    if (!success)
+        return false;
+
+    VkComputePipelineCreateInfo pipeline_info = {};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_info.stage.module = shader_module_comp;
+    pipeline_info.stage.pName = "main";
+    pipeline_info.layout = m_cull_pipeline_layout;
 
-    for (unsigned int i = 0; i < command_buffers.size(); i++)
+    result = vkCreateComputePipelines(m_vulkan_device, VK_NULL_HANDLE, 1,
+                                      &pipeline_info, nullptr, &m_cull_pipeline);
+
+    vkDestroyShaderModule(m_vulkan_device, shader_module_comp, nullptr);
+
+    return (result == VK_SUCCESS);
+}
+
+bool Renderer::createMeshletBuffers(std::vector<Model*>& models)
+{
+    if (!m_cluster_culling)
+        return true;
+
+    // Meshlets of new models are appended and the buffers are recreated,
+    // the old ones are released when frames in flight don't use them
+    for (Model* model : models)
     {
-        VkCommandBufferBeginInfo begin_info = {};
-        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        begin_info.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        if (m_first_meshlets.count(model) > 0)
+            continue;
 
-        VkResult result = vkBeginCommandBuffer(command_buffers[i], &begin_info);
+        m_first_meshlets[model] = m_meshlets.size();
 
-        if (result != VK_SUCCESS)
+        const std::vector<Meshlet>& model_meshlets = model->getMeshlets();
+        m_meshlets.insert(m_meshlets.end(), model_meshlets.begin(), 
+                          model_meshlets.end());
+    }
+
+    destroyMeshletBuffers();
+
+    if (m_meshlets.empty())
+        return true;
+
+    std::vector<Meshlet> meshlets = m_meshlets;
+
+    // Empty meshlets fill the last workgroup, so that the shader doesn't
+    // need bounds checks
+    unsigned int count = (meshlets.size() + CULL_WORKGROUP_SIZE - 1) / 
+                         CULL_WORKGROUP_SIZE * CULL_WORKGROUP_SIZE;
+    meshlets.resize(count, Meshlet());
+    m_meshlets_count = count;
+
+    VkDeviceSize buffer_size = sizeof(meshlets[0]) * meshlets.size();
+
+    VkBuffer staging_buffer;
+    VkDeviceMemory staging_buffer_memory;
+
+    bool success = m_vulkan_context->createBuffer(buffer_size,
+                                        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                        staging_buffer, staging_buffer_memory,
+                                        MEMORY_CATEGORY_STAGING);
+
+    if (!success)
+        return false;
+
+    void* data;
+    vkMapMemory(m_vulkan_device, staging_buffer_memory, 0, buffer_size, 0, &data);
+    memcpy(data, &meshlets[0], (size_t) buffer_size);
+    vkUnmapMemory(m_vulkan_device, staging_buffer_memory);
+
+    success = m_vulkan_context->createBuffer(buffer_size,
+                                        VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                        m_meshlet_buffer, m_meshlet_buffer_memory,
+                                        MEMORY_CATEGORY_GEOMETRY);
+
+    if (!success)
+    {
+        vkDestroyBuffer(m_vulkan_device, staging_buffer, nullptr);
+        m_vulkan_context->freeMemory(staging_buffer_memory);
+        return false;
+    }
+
+    success = m_vulkan_context->uploadBuffer(staging_buffer, 
+                                             staging_buffer_memory,
+                                             m_meshlet_buffer, buffer_size);
+
+    if (!success)
+        return false;
+
+    unsigned int frames_count = m_vulkan_context->getFramesInFlight();
+
+    for (unsigned int i = 0; i < frames_count; i++)
+    {
+        VkBuffer draw_commands_buffer = VK_NULL_HANDLE;
+        VkDeviceMemory draw_commands_buffer_memory = VK_NULL_HANDLE;
+
+        success = m_vulkan_context->createBuffer(
+                                    sizeof(VkDrawIndexedIndirectCommand) * count,
+                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                    VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                                    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                    draw_commands_buffer, 
+                                    draw_commands_buffer_memory,
+                                    MEMORY_CATEGORY_GEOMETRY);
+
+        if (!success)
             return false;
 
-        std::array<VkClearValue, 2> clear_values = {};
-        clear_values[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
-        clear_values[1].depthStencil = {1.0f, 0};
+        m_draw_commands_buffers.push_back(draw_commands_buffer);
+        m_draw_commands_buffers_memory.push_back(draw_commands_buffer_memory);
+    }
 
-        VkRenderPassBeginInfo render_pass_info = {};
-        render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        render_pass_info.renderPass = m_render_pass;
-        render_pass_info.framebuffer = m_swap_chain_framebuffers[i];
-        render_pass_info.renderArea.offset = {0, 0};
-        render_pass_info.renderArea.extent = m_vulkan_context->getSwapChainExtent();
-        render_pass_info.clearValueCount = (uint32_t)(clear_values.size());
-        render_pass_info.pClearValues = &clear_values[0];
+    return createCullDescriptorSets();
+}
 
-        vkCmdBeginRenderPass(command_buffers[i], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindPipeline(command_buffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics_pipeline);
+void Renderer::destroyMeshletBuffers()
+{
+    VkDevice device = m_vulkan_device;
+    VulkanContext* vulkan_context = m_vulkan_context;
+    VkDescriptorPool cull_descriptor_pool = m_cull_descriptor_pool;
+    VkBuffer meshlet_buffer = m_meshlet_buffer;
+    VkDeviceMemory meshlet_buffer_memory = m_meshlet_buffer_memory;
+    std::vector<VkBuffer> draw_commands_buffers = m_draw_commands_buffers;
+    std::vector<VkDeviceMemory> draw_commands_buffers_memory = 
+                                            m_draw_commands_buffers_memory;
+
+    m_vulkan_context->destroyLater([=]()
+    {
+        vkDestroyDescriptorPool(device, cull_descriptor_pool, nullptr);
+        vkDestroyBuffer(device, meshlet_buffer, nullptr);
+        vulkan_context->freeMemory(meshlet_buffer_memory);
 
-        for (Model* model : m_models)
+        for (unsigned int i = 0; i < draw_commands_buffers.size(); i++)
         {
-            VkBuffer vertex_buffers[] = {model->getVertexBuffer()};
-            VkDeviceSize offsets[] = {0};
-            vkCmdBindVertexBuffers(command_buffers[i], 0, 1, vertex_buffers, offsets);
-            vkCmdBindIndexBuffer(command_buffers[i], model->getIndexBuffer(), 0,
-                                 VK_INDEX_TYPE_UINT32);
-            vkCmdBindDescriptorSets(command_buffers[i],
-                                    VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                    m_pipeline_layout, 0, 1,
-                                    &model->getDescriptorSets()[i], 0, nullptr);
-
-            vkCmdDrawIndexed(command_buffers[i],
-                            (uint32_t)(model->getIndices().size()), 1, 0, 0, 0);
+            vkDestroyBuffer(device, draw_commands_buffers[i], nullptr);
+            vulkan_context->freeMemory(draw_commands_buffers_memory[i]);
         }
+    });
+
+    m_cull_descriptor_pool = VK_NULL_HANDLE;
+    m_cull_descriptor_sets.clear();
+    m_meshlet_buffer = VK_NULL_HANDLE;
+    m_meshlet_buffer_memory = VK_NULL_HANDLE;
+    m_draw_commands_buffers.clear();
+    m_draw_commands_buffers_memory.clear();
+    m_meshlets_count = 0;
+}
 
-        vkCmdEndRenderPass(command_buffers[i]);
+bool Renderer::createCullDescriptorSets()
+{
+    uint32_t count = m_vulkan_context->getFramesInFlight();
 
-        result = vkEndCommandBuffer(command_buffers[i]);
+    std::array<VkDescriptorPoolSize, 2> pool_sizes = {};
+    pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    pool_sizes[0].descriptorCount = count;
+    pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    pool_sizes[1].descriptorCount = count * 2;
 
-        if (result != VK_SUCCESS)
-            return false;
+    VkDescriptorPoolCreateInfo pool_info = {};
+    pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pool_info.poolSizeCount = (uint32_t)(pool_sizes.size());
+    pool_info.pPoolSizes = &pool_sizes[0];
+    pool_info.maxSets = count;
+
+    VkResult result = vkCreateDescriptorPool(m_vulkan_device, &pool_info,
+                                             nullptr, &m_cull_descriptor_pool);
+
+    if (result != VK_SUCCESS)
+        return false;
+
+    std::vector<VkDescriptorSetLayout> layouts(count, m_cull_descriptor_set_layout);
+    m_cull_descriptor_sets.resize(count);
+
+    VkDescriptorSetAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = m_cull_descriptor_pool;
+    alloc_info.descriptorSetCount = (uint32_t)(layouts.size());
+    alloc_info.pSetLayouts = &layouts[0];
+
+    result = vkAllocateDescriptorSets(m_vulkan_device, &alloc_info, 
+                                      &m_cull_descriptor_sets[0]);
+
+    if (result != VK_SUCCESS)
+        return false;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        std::array<VkDescriptorBufferInfo, 3> buffer_infos = {};
+        buffer_infos[0].buffer = m_uniform_buffer;
+        buffer_infos[0].offset = i * m_uniform_slice_size + m_cull_uniform_offset;
+        buffer_infos[0].range = sizeof(CullUniformBufferObject);
+        buffer_infos[1].buffer = m_meshlet_buffer;
+        buffer_infos[1].offset = 0;
+        buffer_infos[1].range = VK_WHOLE_SIZE;
+        buffer_infos[2].buffer = m_draw_commands_buffers[i];
+        buffer_infos[2].offset = 0;
+        buffer_infos[2].range = VK_WHOLE_SIZE;
+
+        std::array<VkWriteDescriptorSet, 3> write_descriptor_sets = {};
+
+        for (unsigned int j = 0; j < write_descriptor_sets.size(); j++)
+        {
+            write_descriptor_sets[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write_descriptor_sets[j].dstSet = m_cull_descriptor_sets[i];
+            write_descriptor_sets[j].dstBinding = j;
+            write_descriptor_sets[j].dstArrayElement = 0;
+            write_descriptor_sets[j].descriptorType = (j == 0) ? 
+                                        VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER :
+                                        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            write_descriptor_sets[j].descriptorCount = 1;
+            write_descriptor_sets[j].pBufferInfo = &buffer_infos[j];
+        }
+
+        vkUpdateDescriptorSets(m_vulkan_device, (uint32_t)(write_descriptor_sets.size()),
+                               &write_descriptor_sets[0], 0, nullptr);
     }
 
     return true;
 }
 
+void Renderer::recordClusterCulling(VkCommandBuffer command_buffer,
+                                    unsigned int frame)
+{
+    // Previous submission of this frame may still read the draw commands
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 
+                         0, nullptr, 0, nullptr);
+
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, 
+                      m_cull_pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_cull_pipeline_layout, 0, 1, 
+                            &m_cull_descriptor_sets[frame], 0, nullptr);
+    vkCmdDispatch(command_buffer, m_meshlets_count / CULL_WORKGROUP_SIZE, 1, 1);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = m_draw_commands_buffers[frame];
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, 
+                         1, &barrier, 0, nullptr);
+}
+
+unsigned int Renderer::countDrawCalls(Model* model)
+{
+    if (!m_cluster_culling)
+        return model->getSubMeshes().size();
+
+    if (m_vulkan_context->isMultiDrawIndirectSupported())
+        return 1;
+
+    return model->getMeshlets().size();
+}
+
+unsigned int Renderer::countTriangles(Model* model)
+{
+    unsigned int triangles_count = 0;
+
+    if (!m_cluster_culling)
+    {
+        for (const SubMesh& submesh : model->getSubMeshes())
+        {
+            triangles_count += submesh.index_count / 3;
+        }
+
+        return triangles_count;
+    }
+
+    for (const Meshlet& meshlet : model->getMeshlets())
+    {
+        triangles_count += meshlet.index_count / 3;
+    }
+
+    return triangles_count;
+}
+
+void Renderer::recordDraw(VkCommandBuffer command_buffer, unsigned int frame, 
+                          Model* model)
+{
+    m_render_stats.draws += countDrawCalls(model);
+
+    // First instance is the material index
+    if (!m_cluster_culling)
+    {
+        for (const SubMesh& submesh : model->getSubMeshes())
+        {
+            vkCmdDrawIndexed(command_buffer, submesh.index_count, 1, 
+                             submesh.first_index, 0, submesh.material);
+        }
+
+        return;
+    }
+
+    uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+    uint32_t meshlets_count = (uint32_t)(model->getMeshlets().size());
+    VkDeviceSize offset = m_first_meshlets[model] * stride;
+    VkBuffer buffer = m_draw_commands_buffers[frame];
+
+    if (m_vulkan_context->isMultiDrawIndirectSupported())
+    {
+        vkCmdDrawIndexedIndirect(command_buffer, buffer, offset, meshlets_count,
+                                 stride);
+        return;
+    }
+
+    for (unsigned int i = 0; i < meshlets_count; i++)
+    {
+        vkCmdDrawIndexedIndirect(command_buffer, buffer, offset + i * stride,
+                                 1, stride);
+    }
+}
+
+bool Renderer::createStatisticsQueryPool()
+{
+    unsigned int frames_count = m_vulkan_context->getFramesInFlight();
+    m_statistics_written.resize(frames_count, false);
+
+    VkQueryPoolCreateInfo create_info = {};
+    create_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    create_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    create_info.queryCount = frames_count;
+    create_info.pipelineStatistics = 
+                VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+                VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+    VkResult result = vkCreateQueryPool(m_vulkan_device, &create_info, nullptr,
+                                        &m_statistics_query_pool);
+
+    return (result == VK_SUCCESS);
+}
+
+void Renderer::readPipelineStatistics(unsigned int frame)
+{
+    if (m_statistics_query_pool == VK_NULL_HANDLE || 
+        !m_statistics_written[frame])
+        return;
+
+    // Counters in order of their bits, followed by availability
+    uint64_t data[7] = {};
+
+    vkGetQueryPoolResults(m_vulkan_device, m_statistics_query_pool, frame, 1,
+                          sizeof(data), data, sizeof(data), 
+                          VK_QUERY_RESULT_64_BIT | 
+                          VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+    if (data[6] == 0)
+        return;
+
+    m_render_stats.input_vertices = data[0];
+    m_render_stats.input_primitives = data[1];
+    m_render_stats.vertex_invocations = data[2];
+    m_render_stats.clipping_invocations = data[3];
+    m_render_stats.clipping_primitives = data[4];
+    m_render_stats.fragment_invocations = data[5];
+}
+
+// Fragment shader invocations per pixel
+float Renderer::getOverdraw()
+{
+    VkExtent2D extent = m_vulkan_context->getSwapChainExtent();
+    uint64_t pixels_count = (uint64_t)extent.width * extent.height;
+
+    if (pixels_count == 0)
+        return 0.0f;
+
+    return (float)m_render_stats.fragment_invocations / pixels_count;
+}
+
+void Renderer::setModels(std::vector<Model*>& models)
+{
+    m_models = models;
+    m_draw_calls_count = 0;
+    m_triangles_count = 0;
+
+    for (Model* model : m_models)
+    {
+        m_draw_calls_count += countDrawCalls(model);
+        m_triangles_count += countTriangles(model);
+    }
+}
+
+bool Renderer::recordCommandBuffer(unsigned int frame, unsigned int image_index)
+{
+    CPU_PROFILER_SCOPE("Renderer::recordCommandBuffer");
+
+    VkCommandBuffer command_buffer = m_vulkan_context->getCommandBuffer();
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
+
+    if (result != VK_SUCCESS)
+        return false;
+
+    m_gpu_profiler->beginFrame(command_buffer, frame);
+
+    m_render_stats.draws = 0;
+    m_render_stats.binds = 0;
+    m_render_stats.triangles = m_triangles_count;
+
+    if (m_statistics_query_pool != VK_NULL_HANDLE)
+    {
+        vkCmdResetQueryPool(command_buffer, m_statistics_query_pool, frame, 1);
+    }
+
+    if (m_cluster_culling && m_meshlets_count > 0)
+    {
+        int cull_query = m_gpu_profiler->beginScope(command_buffer, "cull");
+        recordClusterCulling(command_buffer, frame);
+        m_gpu_profiler->endScope(command_buffer, cull_query);
+        m_render_stats.binds += 2;
+    }
+
+    std::array<VkClearValue, 2> clear_values = {};
+    clear_values[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
+    clear_values[1].depthStencil = {1.0f, 0};
+
+    VkRenderPassBeginInfo render_pass_info = {};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_info.renderPass = m_render_pass;
+    render_pass_info.framebuffer = m_swap_chain_framebuffers[image_index];
+    render_pass_info.renderArea.offset = {0, 0};
+    render_pass_info.renderArea.extent = m_vulkan_context->getSwapChainExtent();
+    render_pass_info.clearValueCount = (uint32_t)(clear_values.size());
+    render_pass_info.pClearValues = &clear_values[0];
+
+    int render_pass_query = m_gpu_profiler->beginScope(command_buffer, 
+                                                       "render_pass");
+
+    if (m_statistics_query_pool != VK_NULL_HANDLE)
+    {
+        vkCmdBeginQuery(command_buffer, m_statistics_query_pool, frame, 0);
+    }
+
+    vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphics_pipeline);
+    m_render_stats.binds++;
+
+    uint32_t uniform_offset = (uint32_t)(frame * m_uniform_slice_size);
+
+    for (Model* model : m_models)
+    {
+        VkBuffer vertex_buffers[] = {model->getVertexBuffer()};
+        VkDeviceSize offsets[] = {0};
+        vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
+        vkCmdBindIndexBuffer(command_buffer, model->getIndexBuffer(), 0,
+                             model->getIndexType());
+
+        bool success = model->updateDescriptorSet(frame);
+
+        if (!success)
+            return false;
+
+        VkDescriptorSet descriptor_set = model->getDescriptorSet(frame);
+        vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                m_pipeline_layout, 0, 1, &descriptor_set, 
+                                1, &uniform_offset);
+        m_render_stats.binds += 3;
+
+        ModelPushConstants push_constants = {};
+        push_constants.position_scale = glm::vec4(model->getPositionScale(), 0.0f);
+        push_constants.position_offset = glm::vec4(model->getPositionOffset(), 0.0f);
+        vkCmdPushConstants(command_buffer, m_pipeline_layout,
+                           VK_SHADER_STAGE_VERTEX_BIT, 0, 
+                           sizeof(ModelPushConstants), &push_constants);
+
+        recordDraw(command_buffer, frame, model);
+    }
+
+    vkCmdEndRenderPass(command_buffer);
+
+    if (m_statistics_query_pool != VK_NULL_HANDLE)
+    {
+        vkCmdEndQuery(command_buffer, m_statistics_query_pool, frame);
+        m_statistics_written[frame] = true;
+    }
+
+    m_gpu_profiler->endScope(command_buffer, render_pass_query);
+    m_gpu_profiler->endFrame(command_buffer);
+
+    result = vkEndCommandBuffer(command_buffer);
+
+    return (result == VK_SUCCESS);
+}
+
 bool Renderer::recreateSwapChain(int drawable_width, int drawable_height)
 {
     m_vulkan_context->waitIdle();
@@ -534,23 +1170,35 @@ bool Renderer::recreateSwapChain(int drawable_width, int drawable_height)
     createPipelineLayout();
     createGraphicsPipeline();
     createFramebuffers();
-    buildCommandBuffers(m_models);
 
     return true;
 }
 
-void Renderer::updateUniformBuffer(uint32_t current_image)
+void Renderer::updateUniformBuffer(unsigned int frame)
 {
+    unsigned char* slice = m_uniform_data + frame * m_uniform_slice_size;
+
     UniformBufferObject ubo = {};
     ubo.model = glm::mat4(1.0f);
     ubo.view = Camera::getCamera()->getViewMatrix();
     ubo.proj = Camera::getCamera()->getProjMatrix();
 
-    void* data;
-    vkMapMemory(m_vulkan_device, m_uniform_buffers_memory[current_image], 0,
-                sizeof(ubo), 0, &data);
-    memcpy(data, &ubo, sizeof(ubo));
-    vkUnmapMemory(m_vulkan_device, m_uniform_buffers_memory[current_image]);
+    memcpy(slice, &ubo, sizeof(ubo));
+
+    if (!m_cluster_culling)
+        return;
+
+    CullUniformBufferObject cull_ubo = {};
+    const glm::vec4* frustum_planes = Camera::getCamera()->getFrustumPlanes();
+
+    for (unsigned int i = 0; i < 6; i++)
+    {
+        cull_ubo.frustum_planes[i] = frustum_planes[i];
+    }
+
+    cull_ubo.camera_pos = glm::vec4(Camera::getCamera()->getCameraPos(), 1.0f);
+
+    memcpy(slice + m_cull_uniform_offset, &cull_ubo, sizeof(cull_ubo));
 }
 
 bool Renderer::createShaderModule(std::string filename, VkShaderModule* shader_module)
@@ -577,15 +1225,39 @@ bool Renderer::createShaderModule(std::string filename, VkShaderModule* shader_m
 
 bool Renderer::drawFrame()
 {
+    CPU_PROFILER_SCOPE("Renderer::drawFrame");
+
     bool success = m_vulkan_context->beginFrame();
 
     if (!success)
         return false;
 
-    updateUniformBuffer(m_vulkan_context->getImageIndex());
+    Device* device = DeviceManager::getDeviceManager()->getDevice();
+    m_acquire_time = device->getMicroTickCount();
+
+    unsigned int frame = m_vulkan_context->getCurrentFrame();
+
+    readPipelineStatistics(frame);
+    updateUniformBuffer(frame);
+
+    success = recordCommandBuffer(frame, m_vulkan_context->getImageIndex());
+
+    if (!success)
+    {
+        printf("Error: Couldn't record command buffer\n");
+        return false;
+    }
 
     m_vulkan_context->submitCommandBuffer();
 
+    m_draw_calls_metric->set(m_render_stats.draws);
+    m_triangles_metric->set(m_render_stats.triangles);
+
+    if (m_statistics_query_pool != VK_NULL_HANDLE)
+    {
+        m_overdraw_metric->set(getOverdraw());
+    }
+
     success = m_vulkan_context->endFrame();
 
     if (!success)
@@ -17,6 +17,7 @@
 #ifndef RENDERER_HPP
 #define RENDERER_HPP
 
+#include "gpu_profiler.hpp"
 #include "model_manager.hpp"
 #include "vulkan_context.hpp"
 
@@ -27,6 +28,10 @@
 
 #include <vulkan/vulkan.h>
 
+#include <map>
+
+class Metric;
+
 struct UniformBufferObject
 {
     alignas(16) glm::mat4 model;
@@ -34,6 +39,41 @@ struct UniformBufferObject
     alignas(16) glm::mat4 proj;
 };
 
+struct ModelPushConstants
+{
+    glm::vec4 position_scale;
+    glm::vec4 position_offset;
+};
+
+struct CullUniformBufferObject
+{
+    glm::vec4 frustum_planes[6];
+    glm::vec4 camera_pos;
+};
+
+// CPU counters are from the last recorded frame. GPU counters come from
+// pipeline statistics of the main render pass, so they lag behind by frames
+// in flight, and with cluster culling triangles are counted before culling.
+struct RenderStats
+{
+    unsigned int draws;
+    unsigned int binds;
+    unsigned int triangles;
+    uint64_t input_vertices;
+    uint64_t input_primitives;
+    uint64_t vertex_invocations;
+    uint64_t clipping_invocations;
+    uint64_t clipping_primitives;
+    uint64_t fragment_invocations;
+};
+
+// Must match local_size_x in cull.comp
+const unsigned int CULL_WORKGROUP_SIZE = 64;
+
+// Models are added a few at a time, so descriptor pools are created for
+// this many models at once
+const unsigned int DESCRIPTOR_POOL_MODELS = 64;
+
 class Renderer
 {
 private:
@@ -44,11 +84,42 @@ private:
     VkPipelineLayout m_pipeline_layout;
     VkPipeline m_graphics_pipeline;
     std::vector<VkFramebuffer> m_swap_chain_framebuffers;
-    std::vector<VkBuffer> m_uniform_buffers;
-    std::vector<VkDeviceMemory> m_uniform_buffers_memory;
-    VkDescriptorPool m_descriptor_pool;
+    VkBuffer m_uniform_buffer;
+    VkDeviceMemory m_uniform_buffer_memory;
+    unsigned char* m_uniform_data;
+    VkDeviceSize m_uniform_slice_size;
+    VkDeviceSize m_cull_uniform_offset;
+    std::vector<VkDescriptorPool> m_descriptor_pools;
+    unsigned int m_descriptor_pool_free;
     VkDescriptorSetLayout m_descriptor_set_layout;
 
+    bool m_cluster_culling;
+    VkDescriptorSetLayout m_cull_descriptor_set_layout;
+    VkPipelineLayout m_cull_pipeline_layout;
+    VkPipeline m_cull_pipeline;
+    VkDescriptorPool m_cull_descriptor_pool;
+    std::vector<VkDescriptorSet> m_cull_descriptor_sets;
+    std::vector<VkBuffer> m_draw_commands_buffers;
+    std::vector<VkDeviceMemory> m_draw_commands_buffers_memory;
+    VkBuffer m_meshlet_buffer;
+    VkDeviceMemory m_meshlet_buffer_memory;
+    unsigned int m_meshlets_count;
+    std::vector<Meshlet> m_meshlets;
+    std::map<Model*, unsigned int> m_first_meshlets;
+    unsigned int m_draw_calls_count;
+    unsigned int m_triangles_count;
+
+    bool m_pipeline_statistics;
+    VkQueryPool m_statistics_query_pool;
+    std::vector<bool> m_statistics_written;
+    RenderStats m_render_stats;
+    Metric* m_draw_calls_metric;
+    Metric* m_triangles_metric;
+    Metric* m_overdraw_metric;
+
+    GpuProfiler* m_gpu_profiler;
+    unsigned long m_acquire_time;
+
     std::vector<Model*> m_models;
 
     static Renderer* m_renderer;
@@ -58,24 +129,46 @@ private:
     bool createGraphicsPipeline();
     bool createFramebuffers();
     bool createUniformBuffers();
+    bool createDescriptorPool();
     bool createDescriptorSetLayout();
+    bool createCullDescriptorSetLayout();
+    bool createCullPipeline();
+    bool createCullDescriptorSets();
+    void destroyMeshletBuffers();
+    void recordClusterCulling(VkCommandBuffer command_buffer, unsigned int frame);
+    void recordDraw(VkCommandBuffer command_buffer, unsigned int frame,
+                    Model* model);
+    unsigned int countDrawCalls(Model* model);
+    unsigned int countTriangles(Model* model);
+    bool createStatisticsQueryPool();
+    void readPipelineStatistics(unsigned int frame);
+    bool recordCommandBuffer(unsigned int frame, unsigned int image_index);
 
     bool createShaderModule(std::string filename, VkShaderModule* shader_module);
-    void updateUniformBuffer(uint32_t current_image);
+    void updateUniformBuffer(unsigned int frame);
 
 public:
     Renderer();
     ~Renderer();
 
     bool init();
-    bool buildCommandBuffers(std::vector<Model*>& models);
-    bool createDescriptorPool(unsigned int models_count);
+    void setModels(std::vector<Model*>& models);
+    bool createMeshletBuffers(std::vector<Model*>& models);
     bool recreateSwapChain(int drawable_width, int drawable_height);
     bool drawFrame();
 
-    VkDescriptorPool getDescriptorPool() {return m_descriptor_pool;}
+    VkDescriptorPool getDescriptorPool();
+    VkDeviceSize getMeshletBufferSize() {return sizeof(Meshlet) * m_meshlets_count;}
     VkDescriptorSetLayout getDescriptorSetLayout() {return m_descriptor_set_layout;}
-    const std::vector<VkBuffer>& getUniformBuffers() {return m_uniform_buffers;}
+    VkBuffer getUniformBuffer() {return m_uniform_buffer;}
+    void setClusterCulling(bool cluster_culling) {m_cluster_culling = cluster_culling;}
+    bool getClusterCulling() {return m_cluster_culling;}
+    unsigned int getDrawCallsCount() {return m_draw_calls_count;}
+    void setPipelineStatistics(bool enabled) {m_pipeline_statistics = enabled;}
+    const RenderStats& getRenderStats() {return m_render_stats;}
+    float getOverdraw();
+    float getGpuFrameTime() {return m_gpu_profiler->getFrameTime();}
+    unsigned long getAcquireTime() {return m_acquire_time;}
 
     static Renderer* getRenderer() {return m_renderer;}
 };
@@ -14,17 +14,26 @@
 //    You should have received a copy of the GNU General Public License
 //    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include "cooked_texture.hpp"
+#include "cpu_profiler.hpp"
 #include "file_manager.hpp"
 #include "image_loader.hpp"
+#include "model_manager.hpp"
 #include "texture_manager.hpp"
+#include "texture_streamer.hpp"
+#include "vulkan_context.hpp"
 
 #include <algorithm>
 #include <cstring>
+#include <set>
 
 TextureManager* TextureManager::m_texture_manager = nullptr;
 
 TextureManager::TextureManager()
 {
+    m_placeholder = nullptr;
+    m_rgb8_supported = false;
+    m_device_ready = false;
     m_texture_manager = this;
 }
 
@@ -35,50 +44,292 @@ TextureManager::~TextureManager()
         if (texture.second == nullptr)
             continue;
             
-        delete texture.second->vulkan_image;
+        if (!texture.second->placeholder)
+        {
+            delete texture.second->vulkan_image;
+        }
+
         delete texture.second;
     }
+
+    for (auto& decoded : m_decoded_textures)
+    {
+        if (decoded.second.texture == nullptr)
+            continue;
+
+        delete decoded.second.texture->vulkan_image;
+        delete decoded.second.texture;
+    }
+
+    if (m_placeholder != nullptr)
+    {
+        delete m_placeholder->vulkan_image;
+        delete m_placeholder;
+    }
+}
+
+// Can run on any thread, also before the device is created. Once the device
+// exists, images are decoded straight into staging buffers and update() only
+// uploads them. Cooked textures are read into staging buffers in init().
+void TextureManager::decodeTextures()
+{
+    CPU_PROFILER_SCOPE("TextureManager::decodeTextures");
+
+    FileManager* file_manager = FileManager::getFileManager();
+    std::vector<std::string> assets_list = file_manager->getAssetsList();
+    std::set<std::string> assets_set(assets_list.begin(), assets_list.end());
+
+    for (std::string name : assets_list)
+    {
+        if (file_manager->getExtension(name) != ".png")
+            continue;
+
+        if (assets_set.count(CookedTexture::getCookedPath(name)) > 0)
+            continue;
+
+        // Failed ones are added too, so that they are reported in update()
+        DecodedTexture decoded;
+        decoded.texture = nullptr;
+
+        if (m_device_ready)
+        {
+            decoded.texture = decodeTexture(name);
+        }
+        else
+        {
+            decoded.image = ImageLoader::loadImage(name);
+        }
+
+        std::lock_guard<std::mutex> lock(m_decoded_mutex);
+        m_decoded_textures[name] = std::move(decoded);
+    }
 }
 
 bool TextureManager::init()
 {
+    VulkanContext* vulkan_context = VulkanContext::getVulkanContext();
+    m_rgb8_supported = vulkan_context->isFormatSupported(VK_FORMAT_R8G8B8_UNORM,
+                                VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+                                VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+    m_device_ready = true;
+
+    const unsigned char white[4] = {255, 255, 255, 255};
+    m_placeholder = createTexture(1, 1, 4, white);
+
+    if (m_placeholder == nullptr)
+    {
+        printf("Error: Couldn't create placeholder texture\n");
+        return false;
+    }
+
     loadTextures();
 
     return true;
 }
 
-void TextureManager::loadTextures()
+// Uploads decoded textures that fit in the budget and replaces their
+// placeholders, the rest is left for the next frames
+bool TextureManager::update(UploadBudget* upload_budget)
 {
-    FileManager* file_manager = FileManager::getFileManager();
-    std::vector<std::string> assets_list = file_manager->getAssetsList();
+    CPU_PROFILER_SCOPE("TextureManager::update");
 
-    for (std::string name : assets_list)
+    std::map<std::string, Texture*> loaded_textures;
+
+    while (true)
     {
-        Image* image = ImageLoader::loadImage(name);
+        std::string name;
+        DecodedTexture decoded;
+        uint64_t size = 0;
 
-        if (image == nullptr)
-            continue;
-        
-        if (image->channels < 3 || image->channels > 4)
+        {
+            std::lock_guard<std::mutex> lock(m_decoded_mutex);
+
+            if (m_decoded_textures.empty())
+                break;
+
+            auto next = m_decoded_textures.begin();
+
+            if (next->second.texture != nullptr)
+            {
+                const Texture* texture = next->second.texture;
+                size = texture->width * texture->height * texture->channels;
+            }
+            else if (next->second.image != nullptr)
+            {
+                // RGB may be expanded to RGBA in the staging buffer
+                const Image& image = *next->second.image;
+                TextureFormat format = getTextureFormat(image.channels);
+                size = image.width * image.height * format.bytes_per_pixel;
+            }
+
+            if (!upload_budget->canUpload(size))
+                break;
+
+            name = next->first;
+            decoded = std::move(next->second);
+            m_decoded_textures.erase(next);
+        }
+
+        Texture* texture = decoded.texture;
+
+        if (texture != nullptr && !finishTexture(texture))
+        {
+            delete texture->vulkan_image;
+            delete texture;
+            texture = nullptr;
+        }
+        else if (decoded.image != nullptr)
+        {
+            const Image& image = *decoded.image;
+            texture = createTexture(image.width, image.height,
+                                    image.channels, &image.data[0]);
+        }
+
+        if (texture == nullptr)
         {
             printf("Warning: Couldn't load texture: %s\n", name.c_str());
-            ImageLoader::closeImage(image);
             continue;
         }
-            
-        unsigned char* data = nullptr;
-        
-        if (image->channels == 3)
+
+        upload_budget->addUpload(size);
+        loaded_textures[name] = texture;
+    }
+
+    if (loaded_textures.empty())
+        return true;
+
+    VulkanContext* vulkan_context = VulkanContext::getVulkanContext();
+
+    for (auto& loaded : loaded_textures)
+    {
+        Texture*& texture = m_textures[loaded.first];
+
+        if (texture == nullptr)
         {
-            data = new unsigned char[image->width * image->height * 4];
-            convertToRGBA(image->data, image->width * image->height * 3, data);
+            texture = loaded.second;
+            continue;
         }
-        else
+
+        // Replaced images may be still used by frames in flight, descriptor
+        // sets of the next frames are rewritten before they are bound
+        if (!texture->placeholder)
+        {
+            VulkanImage* old_image = texture->vulkan_image;
+            vulkan_context->destroyLater([old_image]() {delete old_image;});
+        }
+
+        *texture = *loaded.second;
+        delete loaded.second;
+    }
+
+    ModelManager* model_manager = ModelManager::getModelManager();
+
+    for (Model* model : model_manager->getModels())
+    {
+        for (const std::string& tex_name : model->getTexNames())
+        {
+            if (loaded_textures.count(tex_name) == 0)
+                continue;
+
+            model->invalidateDescriptorSets();
+            break;
+        }
+    }
+
+    return true;
+}
+
+Texture* TextureManager::createPlaceholder()
+{
+    Texture* texture = new Texture();
+    texture->vulkan_image = m_placeholder->vulkan_image;
+    texture->width = m_placeholder->width;
+    texture->height = m_placeholder->height;
+    texture->channels = m_placeholder->channels;
+    texture->placeholder = true;
+
+    return texture;
+}
+
+TextureFormat TextureManager::getTextureFormat(unsigned int channels)
+{
+    const VkComponentSwizzle r = VK_COMPONENT_SWIZZLE_R;
+    const VkComponentSwizzle g = VK_COMPONENT_SWIZZLE_G;
+    const VkComponentSwizzle one = VK_COMPONENT_SWIZZLE_ONE;
+    const VkComponentSwizzle identity = VK_COMPONENT_SWIZZLE_IDENTITY;
+
+    TextureFormat format = {};
+    format.components = {identity, identity, identity, identity};
+
+    switch (channels)
+    {
+    case 1:
+        // Grayscale
+        format.format = VK_FORMAT_R8_UNORM;
+        format.bytes_per_pixel = 1;
+        format.components = {r, r, r, one};
+        break;
+    case 2:
+        // Grayscale with alpha
+        format.format = VK_FORMAT_R8G8_UNORM;
+        format.bytes_per_pixel = 2;
+        format.components = {r, r, r, g};
+        break;
+    case 3:
+        // RGB8 is optional in Vulkan and rarely supported on desktop GPUs, 
+        // so it's expanded to RGBA when needed
+        format.format = m_rgb8_supported ? VK_FORMAT_R8G8B8_UNORM : 
+                                           VK_FORMAT_R8G8B8A8_UNORM;
+        format.bytes_per_pixel = m_rgb8_supported ? 3 : 4;
+        break;
+    case 4:
+        format.format = VK_FORMAT_R8G8B8A8_UNORM;
+        format.bytes_per_pixel = 4;
+        break;
+    default:
+        format.format = VK_FORMAT_UNDEFINED;
+        format.bytes_per_pixel = 0;
+        break;
+    }
+
+    return format;
+}
+
+void TextureManager::loadTextures()
+{
+    FileManager* file_manager = FileManager::getFileManager();
+    std::vector<std::string> assets_list = file_manager->getAssetsList();
+    std::set<std::string> assets_set(assets_list.begin(), assets_list.end());
+
+    for (std::string name : assets_list)
+    {
+        std::string cooked_path = CookedTexture::getCookedPath(name);
+
+        if (assets_set.count(cooked_path) > 0)
         {
-            data = image->data;
+            Texture* texture = loadCookedTexture(name, cooked_path);
+
+            if (texture)
+            {
+                m_textures[name] = texture;
+                continue;
+            }
+
+            printf("Warning: Couldn't load cooked texture: %s\n",
+                   cooked_path.c_str());
         }
-        
-        Texture* texture = createTexture(image->width, image->height, 4, data);
+
+        if (file_manager->getExtension(name) != ".png")
+            continue;
+
+        // Resolved in update() when decodeTextures() gets to it
+        if (assets_set.count(cooked_path) == 0)
+        {
+            m_textures[name] = createPlaceholder();
+            continue;
+        }
+
+        Texture* texture = loadTexture(name);
 
         if (texture)
         {
@@ -88,22 +339,214 @@ void TextureManager::loadTextures()
         {
             printf("Warning: Couldn't load texture: %s\n", name.c_str());
         }
-        
-        if (image->channels == 3)
-        {
-            delete[] data;
-        }
+    }
+}
+
+Texture* TextureManager::loadTexture(std::string name)
+{
+    Texture* texture = decodeTexture(name);
+
+    if (texture == nullptr)
+        return nullptr;
+
+    if (!finishTexture(texture))
+    {
+        delete texture->vulkan_image;
+        delete texture;
+        return nullptr;
+    }
+
+    return texture;
+}
+
+// Rows are decoded straight into the mapped staging buffer, libpng adds
+// alpha channel on the fly if RGB format can't be used. The image is created
+// in finishTexture(), so this can run on any thread once the device exists.
+Texture* TextureManager::decodeTexture(std::string name)
+{
+    VulkanImage* image = nullptr;
+    Texture* texture = new Texture();
+
+    bool success = ImageLoader::loadImage(name, 
+                                          [&](int width, int height, int channels)
+    {
+        TextureFormat format = getTextureFormat(channels);
+
+        if (format.format == VK_FORMAT_UNDEFINED || 
+            format.bytes_per_pixel != (unsigned int)channels)
+            return (unsigned char*)nullptr;
 
-        ImageLoader::closeImage(image);
+        texture->width = width;
+        texture->height = height;
+        texture->channels = channels;
+
+        image = new VulkanImage(format.format, width, height);
+        image->setComponentMapping(format.components);
+
+        return (unsigned char*)image->mapStagingBuffer(width * height * channels);
+    }, !m_rgb8_supported);
+
+    if (!success)
+    {
+        delete image;
+        delete texture;
+        return nullptr;
     }
+
+    texture->vulkan_image = image;
+
+    return texture;
 }
 
-Texture* TextureManager::createTexture(int width, int height, int channels,
-                                       const void* data)
+bool TextureManager::finishTexture(Texture* texture)
+{
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {texture->width, texture->height, 1};
+
+    return finishImage(texture->vulkan_image, {region});
+}
+
+Texture* TextureManager::loadCookedTexture(std::string name,
+                                           std::string cooked_path)
+{
+    FileManager* file_manager = FileManager::getFileManager();
+
+    int length = file_manager->getFileLength(cooked_path);
+
+    if (length < (int)sizeof(CookedTextureHeader))
+        return nullptr;
+
+    CookedTextureHeader header;
+    bool success = file_manager->readFile(cooked_path, &header, 
+                                          sizeof(CookedTextureHeader));
+
+    if (!success || !CookedTexture::checkHeader(&header, length))
+        return nullptr;
+
+    TextureStreamer* texture_streamer = TextureStreamer::getTextureStreamer();
+    unsigned int base_mip = 0;
+
+    if (texture_streamer != nullptr)
+    {
+        base_mip = texture_streamer->getInitialMip(header);
+    }
+
+    VulkanImage* image = createCookedImage(cooked_path, header, base_mip);
+
+    if (image == nullptr)
+        return nullptr;
+
+    Texture* texture = new Texture();
+    texture->width = header.width;
+    texture->height = header.height;
+    texture->channels = header.channels;
+    texture->vulkan_image = image;
+
+    if (texture_streamer != nullptr)
+    {
+        TextureFormat format = getTextureFormat(header.channels);
+        texture_streamer->addTexture(name, texture, cooked_path, header,
+                                     base_mip, format.bytes_per_pixel);
+    }
+
+    return texture;
+}
+
+VulkanImage* TextureManager::createCookedImage(std::string cooked_path,
+                                               const CookedTextureHeader& header,
+                                               unsigned int base_mip)
 {
-    VulkanImage* image = new VulkanImage(VK_FORMAT_R8G8B8A8_UNORM, width, height);
+    if (base_mip >= header.mip_levels)
+        return nullptr;
+
+    TextureFormat format = getTextureFormat(header.channels);
+
+    if (format.format == VK_FORMAT_UNDEFINED)
+        return nullptr;
+
+    FileManager* file_manager = FileManager::getFileManager();
+
+    const CookedTextureMip& last_mip = header.mips[header.mip_levels - 1];
+    unsigned int offset = header.mips[base_mip].offset;
+    unsigned int length = last_mip.offset + last_mip.size - offset;
+
+    VulkanImage* image = new VulkanImage(format.format,
+                                         header.mips[base_mip].width,
+                                         header.mips[base_mip].height,
+                                         header.mip_levels - base_mip);
+    image->setComponentMapping(format.components);
 
-    bool success = image->createTextureImage(data, channels);
+    std::vector<VkBufferImageCopy> regions;
+
+    for (unsigned int i = base_mip; i < header.mip_levels; i++)
+    {
+        VkBufferImageCopy region = {};
+        region.bufferOffset = header.mips[i].offset - offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = i - base_mip;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {header.mips[i].width, header.mips[i].height, 1};
+        regions.push_back(region);
+    }
+
+    bool success = false;
+
+    if (format.bytes_per_pixel == header.channels)
+    {
+        // Mip levels are stored from the largest one, so everything from the 
+        // base mip to the end of the file goes to the staging buffer in one read
+        void* data = image->mapStagingBuffer(length);
+
+        if (data != nullptr)
+        {
+            success = file_manager->readFile(cooked_path, data, length, offset);
+        }
+    }
+    else
+    {
+        std::vector<unsigned char> rgb(length);
+        success = file_manager->readFile(cooked_path, &rgb[0], length, offset);
+
+        VkDeviceSize staging_size = 0;
+
+        for (VkBufferImageCopy& region : regions)
+        {
+            staging_size = (staging_size + COOKED_TEXTURE_ALIGNMENT - 1) /
+                           COOKED_TEXTURE_ALIGNMENT * COOKED_TEXTURE_ALIGNMENT;
+            region.bufferOffset = staging_size;
+            staging_size += region.imageExtent.width * 
+                            region.imageExtent.height * format.bytes_per_pixel;
+        }
+
+        unsigned char* data = nullptr;
+
+        if (success)
+        {
+            data = (unsigned char*)image->mapStagingBuffer(staging_size);
+            success = (data != nullptr);
+        }
+
+        for (unsigned int i = base_mip; success && i < header.mip_levels; i++)
+        {
+            const VkBufferImageCopy& region = regions[i - base_mip];
+            ImageLoader::convertToRGBA(&rgb[header.mips[i].offset - offset],
+                                       header.mips[i].size,
+                                       data + region.bufferOffset);
+        }
+    }
+
+    if (success)
+    {
+        success = finishImage(image, regions);
+    }
 
     if (!success)
     {
@@ -111,15 +554,71 @@ Texture* TextureManager::createTexture(int width, int height, int channels,
         return nullptr;
     }
 
+    return image;
+}
+
+bool TextureManager::finishImage(VulkanImage* image,
+                                 const std::vector<VkBufferImageCopy>& regions)
+{
+    bool success = image->createTextureImageFromStaging(regions);
+
+    if (!success)
+        return false;
+
     success = image->createImageView(VK_IMAGE_ASPECT_COLOR_BIT);
 
     if (!success)
+        return false;
+
+    success = image->createSampler();
+
+    if (!success)
+        return false;
+
+    return true;
+}
+
+Texture* TextureManager::createTexture(int width, int height, int channels,
+                                       const void* data)
+{
+    TextureFormat format = getTextureFormat(channels);
+
+    if (format.format == VK_FORMAT_UNDEFINED)
+        return nullptr;
+
+    VulkanImage* image = new VulkanImage(format.format, width, height);
+    image->setComponentMapping(format.components);
+
+    VkDeviceSize image_size = width * height * format.bytes_per_pixel;
+    void* staging_data = image->mapStagingBuffer(image_size);
+
+    if (staging_data == nullptr)
     {
         delete image;
         return nullptr;
     }
 
-    success = image->createSampler();
+    if (format.bytes_per_pixel == (unsigned int)channels)
+    {
+        memcpy(staging_data, data, image_size);
+    }
+    else
+    {
+        ImageLoader::convertToRGBA((const unsigned char*)data,
+                                   width * height * channels,
+                                   (unsigned char*)staging_data);
+    }
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {(uint32_t)width, (uint32_t)height, 1};
+
+    bool success = finishImage(image, {region});
 
     if (!success)
     {
@@ -135,17 +634,3 @@ Texture* TextureManager::createTexture(int width, int height, int channels,
 
     return texture;
 }
-
-void TextureManager::convertToRGBA(unsigned char* src, unsigned int src_length,
-                                   unsigned char* dst)
-{
-    unsigned int pixels = src_length / 3;
-
-    for (unsigned int i = 0; i < pixels; i++)
-    {
-        dst[i*4]   = src[i*3];
-        dst[i*4+1] = src[i*3+1];
-        dst[i*4+2] = src[i*3+2];
-        dst[i*4+3] = 255;
-    }
-}
@@ -17,37 +17,78 @@
 #ifndef TEXTURE_MANAGER_HPP
 #define TEXTURE_MANAGER_HPP
 
+#include "cooked_texture.hpp"
+#include "image_loader.hpp"
+#include "upload_budget.hpp"
 #include "vulkan_image.hpp"
 
+#include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 
+// Placeholder textures share a white image until the real one is uploaded,
+// so the pointer can be used as a handle before the texture is loaded
 struct Texture
 {
     VulkanImage* vulkan_image;
     unsigned int width;
     unsigned int height;
     unsigned int channels;
+    bool placeholder;
+};
+
+// Decoded texture that waits for upload. Pixels are in the staging buffer of
+// the texture image, or in host memory if it was decoded before the device
+// was created.
+struct DecodedTexture
+{
+    Texture* texture;
+    std::unique_ptr<Image> image;
+};
+
+struct TextureFormat
+{
+    VkFormat format;
+    unsigned int bytes_per_pixel;
+    VkComponentMapping components;
 };
 
 class TextureManager
 {
 private:
     std::map<std::string, Texture*> m_textures;
+    std::map<std::string, DecodedTexture> m_decoded_textures;
+    std::mutex m_decoded_mutex;
+    Texture* m_placeholder;
+    bool m_rgb8_supported;
+    std::atomic<bool> m_device_ready;
     static TextureManager* m_texture_manager;
 
     void loadTextures();
-    void convertToRGBA(unsigned char* src, unsigned int src_length,
-                       unsigned char* dst);
+    Texture* createPlaceholder();
+    Texture* loadTexture(std::string name);
+    Texture* decodeTexture(std::string name);
+    bool finishTexture(Texture* texture);
+    Texture* loadCookedTexture(std::string name, std::string cooked_path);
+    bool finishImage(VulkanImage* image,
+                     const std::vector<VkBufferImageCopy>& regions);
 
 public:
     TextureManager();
     ~TextureManager();
 
+    void decodeTextures();
     bool init();
+    bool update(UploadBudget* upload_budget);
     Texture* createTexture(int width, int height, int channels,
                            const void* data);
+    VulkanImage* createCookedImage(std::string cooked_path,
+                                   const CookedTextureHeader& header,
+                                   unsigned int base_mip);
     Texture* getTexture(std::string name) {return m_textures[name];}
+    TextureFormat getTextureFormat(unsigned int channels);
 
     static TextureManager* getTextureManager() {return m_texture_manager;}
 };
@@ -0,0 +1,422 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "camera.hpp"
+#include "cpu_profiler.hpp"
+#include "metrics.hpp"
+#include "model_manager.hpp"
+#include "renderer.hpp"
+#include "texture_manager.hpp"
+#include "texture_streamer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <set>
+
+TextureStreamer* TextureStreamer::m_texture_streamer = nullptr;
+
+TextureStreamer::TextureStreamer(uint64_t budget)
+{
+    m_budget = budget;
+    m_frame = 0;
+    m_max_loads_per_update = 2;
+    m_min_mip_size = 64;
+    m_mip_bias = 0.0f;
+    m_stats = {};
+    m_stats.budget = budget;
+
+    Metrics* metrics = Metrics::getMetrics();
+    m_resident_bytes_metric = metrics->getGauge(
+                                "renderer_texture_resident_bytes",
+                                "Size of texture mips resident in memory");
+    m_pending_loads_metric = metrics->getGauge(
+                                "renderer_texture_pending_loads",
+                                "Textures waiting for higher resolution mips");
+    m_loads_metric = metrics->getCounter("renderer_texture_loads_total",
+                                         "Texture mip loads");
+    m_evictions_metric = metrics->getCounter("renderer_texture_evictions_total",
+                                             "Texture mip evictions");
+    metrics->getGauge("renderer_texture_budget_bytes",
+                      "Texture streaming budget")->set((double)budget);
+
+    m_texture_streamer = this;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+    m_texture_streamer = nullptr;
+}
+
+bool TextureStreamer::init()
+{
+    updateModels();
+
+    return true;
+}
+
+// Models that use a texture get new descriptor sets when its mips change
+void TextureStreamer::updateModels()
+{
+    ModelManager* model_manager = ModelManager::getModelManager();
+
+    for (StreamedTexture& streamed_texture : m_textures)
+    {
+        streamed_texture.models.clear();
+
+        for (Model* model : model_manager->getModels())
+        {
+            const std::vector<std::string>& tex_names = model->getTexNames();
+
+            if (std::find(tex_names.begin(), tex_names.end(), 
+                          streamed_texture.name) != tex_names.end())
+            {
+                streamed_texture.models.push_back(model);
+            }
+        }
+    }
+}
+
+unsigned int TextureStreamer::getInitialMip(const CookedTextureHeader& header)
+{
+    for (unsigned int i = 0; i < header.mip_levels; i++)
+    {
+        if (std::max(header.mips[i].width, header.mips[i].height) <= 
+            m_min_mip_size)
+            return i;
+    }
+
+    return header.mip_levels - 1;
+}
+
+void TextureStreamer::addTexture(std::string name, Texture* texture,
+                                 std::string cooked_path,
+                                 const CookedTextureHeader& header,
+                                 unsigned int base_mip,
+                                 unsigned int bytes_per_pixel)
+{
+    StreamedTexture streamed_texture;
+    streamed_texture.name = name;
+    streamed_texture.cooked_path = cooked_path;
+    streamed_texture.header = header;
+    streamed_texture.texture = texture;
+    streamed_texture.bytes_per_pixel = bytes_per_pixel;
+    streamed_texture.resident_mip = base_mip;
+    streamed_texture.wanted_mip = base_mip;
+    streamed_texture.min_mip = getInitialMip(header);
+    streamed_texture.last_used_frame = 0;
+
+    m_textures.push_back(streamed_texture);
+
+    m_stats.resident_bytes += getMipChainSize(streamed_texture, base_mip);
+}
+
+uint64_t TextureStreamer::getMipChainSize(
+                                    const StreamedTexture& streamed_texture,
+                                    unsigned int base_mip)
+{
+    const CookedTextureHeader& header = streamed_texture.header;
+    uint64_t size = 0;
+
+    for (unsigned int i = base_mip; i < header.mip_levels; i++)
+    {
+        size += header.mips[i].width * header.mips[i].height * 
+                streamed_texture.bytes_per_pixel;
+    }
+
+    return size;
+}
+
+unsigned int TextureStreamer::getDemandMip(StreamedTexture& streamed_texture)
+{
+    Camera* camera = Camera::getCamera();
+
+    const CookedTextureHeader& header = streamed_texture.header;
+    float texture_size = (float)std::max(header.width, header.height);
+    float viewport_height = (float)camera->getViewportHeight();
+    float tan_half_fov = tanf(camera->getFov() / 2.0f);
+
+    unsigned int wanted_mip = streamed_texture.min_mip;
+    bool visible = false;
+
+    for (Model* model : streamed_texture.models)
+    {
+        const std::vector<std::string>& tex_names = model->getTexNames();
+
+        // Per-shape bounds, sub-meshes of batched models cover whole scenes
+        for (const MaterialBounds& bounds : model->getMaterialBounds())
+        {
+            if (tex_names[bounds.material] != streamed_texture.name)
+                continue;
+
+            glm::vec3 center = bounds.bounding_center;
+            float radius = bounds.bounding_radius;
+
+            if (!camera->isSphereVisible(center, radius))
+                continue;
+
+            visible = true;
+
+            float distance = glm::length(center - camera->getCameraPos());
+            distance = std::max(distance - radius, 0.01f);
+
+            // Size of the bounding sphere on the screen in pixels
+            float screen_size = radius * viewport_height / 
+                                (distance * tan_half_fov);
+            screen_size = std::max(screen_size, 1.0f);
+
+            float mip = log2f(texture_size / screen_size) + m_mip_bias;
+            mip = std::max(mip, 0.0f);
+
+            wanted_mip = std::min(wanted_mip, (unsigned int)mip);
+        }
+    }
+
+    if (!visible)
+        return streamed_texture.resident_mip;
+
+    streamed_texture.last_used_frame = m_frame;
+
+    return wanted_mip;
+}
+
+bool TextureStreamer::evictTextures(uint64_t required_bytes,
+                                    unsigned int loading_id,
+                                    std::vector<unsigned int>& planned_mips,
+                                    uint64_t& resident_bytes)
+{
+    while (resident_bytes + required_bytes > m_budget)
+    {
+        int evict_id = -1;
+
+        for (unsigned int i = 0; i < m_textures.size(); i++)
+        {
+            StreamedTexture& streamed_texture = m_textures[i];
+
+            if (i == loading_id || streamed_texture.last_used_frame == m_frame)
+                continue;
+
+            if (planned_mips[i] >= streamed_texture.min_mip)
+                continue;
+
+            if (evict_id == -1 || streamed_texture.last_used_frame <
+                                  m_textures[evict_id].last_used_frame)
+            {
+                evict_id = i;
+            }
+        }
+
+        if (evict_id == -1)
+            return false;
+
+        StreamedTexture& streamed_texture = m_textures[evict_id];
+        resident_bytes -= getMipChainSize(streamed_texture,
+                                          planned_mips[evict_id]);
+        resident_bytes += getMipChainSize(streamed_texture,
+                                          streamed_texture.min_mip);
+        planned_mips[evict_id] = streamed_texture.min_mip;
+    }
+
+    return true;
+}
+
+void TextureStreamer::updateMetrics()
+{
+    m_resident_bytes_metric->set((double)m_stats.resident_bytes);
+    m_pending_loads_metric->set(m_stats.pending_loads);
+    m_loads_metric->set((double)m_stats.loads);
+    m_evictions_metric->set((double)m_stats.evictions);
+}
+
+bool TextureStreamer::update()
+{
+    CPU_PROFILER_SCOPE("TextureStreamer::update");
+
+    // Stats of the previous update
+    updateMetrics();
+
+    m_frame++;
+
+    std::vector<unsigned int> load_ids;
+
+    for (unsigned int i = 0; i < m_textures.size(); i++)
+    {
+        StreamedTexture& streamed_texture = m_textures[i];
+        streamed_texture.wanted_mip = getDemandMip(streamed_texture);
+
+        if (streamed_texture.wanted_mip < streamed_texture.resident_mip)
+        {
+            load_ids.push_back(i);
+        }
+    }
+
+    // Textures that miss the most detail are loaded first
+    std::sort(load_ids.begin(), load_ids.end(), 
+              [this](unsigned int a, unsigned int b)
+    {
+        return m_textures[a].resident_mip - m_textures[a].wanted_mip >
+               m_textures[b].resident_mip - m_textures[b].wanted_mip;
+    });
+
+    std::vector<unsigned int> planned_mips(m_textures.size());
+
+    for (unsigned int i = 0; i < m_textures.size(); i++)
+    {
+        planned_mips[i] = m_textures[i].resident_mip;
+    }
+
+    std::vector<VulkanImage*> new_images(m_textures.size(), nullptr);
+    uint64_t resident_bytes = m_stats.resident_bytes;
+    unsigned int loads_count = 0;
+
+    for (unsigned int id : load_ids)
+    {
+        if (loads_count >= m_max_loads_per_update)
+            break;
+
+        StreamedTexture& streamed_texture = m_textures[id];
+
+        uint64_t required_bytes = 
+                getMipChainSize(streamed_texture,
+                                streamed_texture.wanted_mip) -
+                getMipChainSize(streamed_texture, planned_mips[id]);
+
+        // Evictions are planned on a copy and kept only if the load and
+        // the evictions it needs produce their images
+        std::vector<unsigned int> new_mips = planned_mips;
+        uint64_t new_resident_bytes = resident_bytes;
+
+        if (!evictTextures(required_bytes, id, new_mips, new_resident_bytes))
+            continue;
+
+        new_mips[id] = streamed_texture.wanted_mip;
+
+        if (!createImages(planned_mips, new_mips, new_images))
+            continue;
+
+        planned_mips = new_mips;
+        resident_bytes = new_resident_bytes + required_bytes;
+        loads_count++;
+    }
+
+    applyChanges(planned_mips, new_images);
+
+    m_stats.pending_loads = 0;
+
+    for (StreamedTexture& streamed_texture : m_textures)
+    {
+        if (streamed_texture.wanted_mip < streamed_texture.resident_mip)
+        {
+            m_stats.pending_loads++;
+        }
+    }
+
+    return true;
+}
+
+// Creates images for textures with changed mips, either all of them or none
+bool TextureStreamer::createImages(const std::vector<unsigned int>& planned_mips,
+                                   const std::vector<unsigned int>& new_mips,
+                                   std::vector<VulkanImage*>& new_images)
+{
+    TextureManager* texture_manager = TextureManager::getTextureManager();
+
+    std::vector<unsigned int> changed_ids;
+    std::vector<VulkanImage*> images;
+
+    for (unsigned int i = 0; i < m_textures.size(); i++)
+    {
+        if (new_mips[i] == planned_mips[i])
+            continue;
+
+        StreamedTexture& streamed_texture = m_textures[i];
+
+        VulkanImage* image = texture_manager->createCookedImage(
+                                                streamed_texture.cooked_path,
+                                                streamed_texture.header,
+                                                new_mips[i]);
+
+        if (image == nullptr)
+        {
+            printf("Warning: Couldn't stream texture: %s\n",
+                   streamed_texture.name.c_str());
+
+            for (VulkanImage* created_image : images)
+            {
+                delete created_image;
+            }
+
+            return false;
+        }
+
+        changed_ids.push_back(i);
+        images.push_back(image);
+    }
+
+    for (unsigned int i = 0; i < changed_ids.size(); i++)
+    {
+        delete new_images[changed_ids[i]];
+        new_images[changed_ids[i]] = images[i];
+    }
+
+    return true;
+}
+
+// Old images may be still used by frames in flight, so they are destroyed 
+// later and descriptor sets of every frame are rewritten when it's recorded
+void TextureStreamer::applyChanges(const std::vector<unsigned int>& planned_mips,
+                                   const std::vector<VulkanImage*>& new_images)
+{
+    VulkanContext* vulkan_context = VulkanContext::getVulkanContext();
+
+    std::set<Model*> models;
+
+    for (unsigned int i = 0; i < m_textures.size(); i++)
+    {
+        if (new_images[i] == nullptr)
+            continue;
+
+        StreamedTexture& streamed_texture = m_textures[i];
+
+        if (planned_mips[i] < streamed_texture.resident_mip)
+        {
+            m_stats.loads++;
+        }
+        else
+        {
+            m_stats.evictions++;
+        }
+
+        m_stats.resident_bytes -= getMipChainSize(streamed_texture,
+                                                  streamed_texture.resident_mip);
+        m_stats.resident_bytes += getMipChainSize(streamed_texture,
+                                                  planned_mips[i]);
+
+        VulkanImage* old_image = streamed_texture.texture->vulkan_image;
+        vulkan_context->destroyLater([old_image]() {delete old_image;});
+
+        streamed_texture.texture->vulkan_image = new_images[i];
+        streamed_texture.resident_mip = planned_mips[i];
+
+        models.insert(streamed_texture.models.begin(),
+                      streamed_texture.models.end());
+    }
+
+    for (Model* model : models)
+    {
+        model->invalidateDescriptorSets();
+    }
+}
@@ -0,0 +1,108 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef TEXTURE_STREAMER_HPP
+#define TEXTURE_STREAMER_HPP
+
+#include "cooked_texture.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Metric;
+class Model;
+class VulkanImage;
+struct Texture;
+
+struct TextureStreamerStats
+{
+    uint64_t resident_bytes;
+    uint64_t budget;
+    unsigned int pending_loads;
+    uint64_t loads;
+    uint64_t evictions;
+};
+
+struct StreamedTexture
+{
+    std::string name;
+    std::string cooked_path;
+    CookedTextureHeader header;
+    Texture* texture;
+    unsigned int bytes_per_pixel;
+    unsigned int resident_mip;
+    unsigned int wanted_mip;
+    unsigned int min_mip;
+    uint64_t last_used_frame;
+    std::vector<Model*> models;
+};
+
+// Keeps cooked textures resident only down to the mip level that is actually
+// visible on the screen. Textures start with their low mips and higher mips
+// are loaded on demand, least recently used textures are dropped back to the
+// low mips when the budget is exceeded.
+class TextureStreamer
+{
+private:
+    std::vector<StreamedTexture> m_textures;
+    uint64_t m_budget;
+    uint64_t m_frame;
+    unsigned int m_max_loads_per_update;
+    unsigned int m_min_mip_size;
+    float m_mip_bias;
+    TextureStreamerStats m_stats;
+    Metric* m_resident_bytes_metric;
+    Metric* m_pending_loads_metric;
+    Metric* m_loads_metric;
+    Metric* m_evictions_metric;
+
+    static TextureStreamer* m_texture_streamer;
+
+    uint64_t getMipChainSize(const StreamedTexture& streamed_texture,
+                             unsigned int base_mip);
+    unsigned int getDemandMip(StreamedTexture& streamed_texture);
+    bool evictTextures(uint64_t required_bytes, unsigned int loading_id,
+                       std::vector<unsigned int>& planned_mips,
+                       uint64_t& resident_bytes);
+    bool createImages(const std::vector<unsigned int>& planned_mips,
+                      const std::vector<unsigned int>& new_mips,
+                      std::vector<VulkanImage*>& new_images);
+    void applyChanges(const std::vector<unsigned int>& planned_mips,
+                      const std::vector<VulkanImage*>& new_images);
+    void updateMetrics();
+
+public:
+    TextureStreamer(uint64_t budget);
+    ~TextureStreamer();
+
+    bool init();
+    bool update();
+    void updateModels();
+
+    unsigned int getInitialMip(const CookedTextureHeader& header);
+    void addTexture(std::string name, Texture* texture,
+                    std::string cooked_path, const CookedTextureHeader& header,
+                    unsigned int base_mip, unsigned int bytes_per_pixel);
+
+    void setMaxLoadsPerUpdate(unsigned int count) {m_max_loads_per_update = count;}
+    void setMipBias(float bias) {m_mip_bias = bias;}
+    const TextureStreamerStats& getStats() {return m_stats;}
+
+    static TextureStreamer* getTextureStreamer() {return m_texture_streamer;}
+};
+
+#endif
@@ -0,0 +1,66 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "cpu_profiler.hpp"
+#include "metrics.hpp"
+#include "upload_budget.hpp"
+
+UploadBudget::UploadBudget()
+{
+    m_max_bytes = 0;
+    m_max_time = 0.0f;
+    m_bytes = 0;
+    m_uploads_count = 0;
+    m_begin_time = CpuProfiler::getNanoTickCount();
+
+    Metrics* metrics = Metrics::getMetrics();
+    m_bytes_metric = metrics->getCounter("renderer_upload_bytes_total",
+                                         "Bytes of loaded assets uploaded");
+    m_uploads_metric = metrics->getCounter("renderer_uploads_total",
+                                           "Loaded assets uploaded");
+}
+
+void UploadBudget::beginFrame()
+{
+    m_bytes = 0;
+    m_uploads_count = 0;
+    m_begin_time = CpuProfiler::getNanoTickCount();
+}
+
+bool UploadBudget::canUpload(uint64_t bytes)
+{
+    if (m_uploads_count == 0)
+        return true;
+
+    if (m_max_bytes > 0 && m_bytes + bytes > m_max_bytes)
+        return false;
+
+    float time = (CpuProfiler::getNanoTickCount() - m_begin_time) / 1e6f;
+
+    if (m_max_time > 0.0f && time >= m_max_time)
+        return false;
+
+    return true;
+}
+
+void UploadBudget::addUpload(uint64_t bytes)
+{
+    m_bytes += bytes;
+    m_uploads_count++;
+
+    m_bytes_metric->add((double)bytes);
+    m_uploads_metric->add(1);
+}
@@ -0,0 +1,52 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef UPLOAD_BUDGET_HPP
+#define UPLOAD_BUDGET_HPP
+
+#include <cstdint>
+
+class Metric;
+
+// Limits how much loader output is turned into GPU resources in one frame,
+// so that streaming in large assets doesn't cause frame time spikes. The
+// first upload of a frame is always allowed, so that assets larger than the
+// budget are still loaded. Time is in milliseconds, zero means no limit.
+class UploadBudget
+{
+private:
+    uint64_t m_max_bytes;
+    float m_max_time;
+    uint64_t m_bytes;
+    unsigned int m_uploads_count;
+    uint64_t m_begin_time;
+    Metric* m_bytes_metric;
+    Metric* m_uploads_metric;
+
+public:
+    UploadBudget();
+
+    void beginFrame();
+    bool canUpload(uint64_t bytes);
+    void addUpload(uint64_t bytes);
+
+    void setMaxBytes(uint64_t max_bytes) {m_max_bytes = max_bytes;}
+    void setMaxTime(float max_time) {m_max_time = max_time;}
+    uint64_t getBytes() {return m_bytes;}
+    unsigned int getUploadsCount() {return m_uploads_count;}
+};
+
+#endif
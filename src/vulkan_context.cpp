@@ -14,14 +14,17 @@
 //    You should have received a copy of the GNU General Public License
 //    along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include "cpu_profiler.hpp"
+#include "metrics.hpp"
 #include "vulkan_context.hpp"
 
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
 #include <set>
 #include <string>
 
-const unsigned int MAX_FRAMES_IN_FLIGHT = 2;
-
 VulkanContext* VulkanContext::m_vulkan_context = nullptr;
 
 #if defined(__linux__) && !defined(ANDROID)
@@ -42,19 +45,61 @@ VulkanContext::VulkanContext(ANativeWindow* window,
     m_device = VK_NULL_HANDLE;
     m_graphics_queue = VK_NULL_HANDLE;
     m_present_queue = VK_NULL_HANDLE;
+    m_transfer_queue = VK_NULL_HANDLE;
     m_swap_chain = VK_NULL_HANDLE;
+    m_present_mode = VK_PRESENT_MODE_FIFO_KHR;
     m_command_pool = VK_NULL_HANDLE;
+    m_transfer_command_pool = VK_NULL_HANDLE;
     m_depth_image = nullptr;
 
+    m_frames_in_flight = 2;
     m_current_frame = 0;
+    m_submitted_frames = 0;
+    m_finished_frames = 0;
     m_image_index = 0;
     m_swap_chain_images_count = 0;
 
     m_graphics_family = 0;
     m_present_family = 0;
+    m_transfer_family = 0;
+    m_multi_draw_indirect_supported = false;
+    m_draw_indirect_first_instance_supported = false;
+    m_pipeline_statistics_supported = false;
+    m_properties2_supported = false;
+    m_present_wait_supported = false;
+    m_timestamp_supported = false;
+    m_timestamp_period = 1.0f;
+    m_memory_budget_supported = false;
+    m_total_memory_stats = {};
+
+    Metrics* metrics = Metrics::getMetrics();
+
+    for (unsigned int i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+    {
+        m_memory_stats[i] = {};
+
+        std::string category = getMemoryCategoryName((MemoryCategory)i);
+        m_memory_metrics[i] = metrics->getGauge(
+                    "renderer_gpu_memory_bytes{category=\"" + category + "\"}",
+                    "Device memory allocated by category");
+    }
+
+    m_total_memory_metric = metrics->getGauge("renderer_gpu_memory_total_bytes",
+                                    "Device memory allocated in total");
+    m_peak_memory_metric = metrics->getGauge("renderer_gpu_memory_peak_bytes",
+                                    "Peak of device memory allocated in total");
+
+    m_present_id = 0;
+    m_wait_for_present = nullptr;
     m_drawable_width = drawable_width;
     m_drawable_height = drawable_height;
 
+    m_swap_chain_params.vsync = true;
+    m_swap_chain_params.low_latency = false;
+    m_swap_chain_params.force_present_mode = false;
+    m_swap_chain_params.present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    m_swap_chain_params.images_count = 0;
+
 #if defined(__linux__) && !defined(ANDROID)
     m_display = display;
     m_window = window;
@@ -64,25 +109,51 @@ VulkanContext::VulkanContext(ANativeWindow* window,
     #error Unsupported system
 #endif
 
+    m_headless = false;
+
     m_device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 }
 
+#if defined(__linux__) && !defined(ANDROID)
+VulkanContext::VulkanContext(uint32_t drawable_width, uint32_t drawable_height)
+    : VulkanContext(nullptr, 0, drawable_width, drawable_height)
+#elif defined(ANDROID)
+VulkanContext::VulkanContext(uint32_t drawable_width, uint32_t drawable_height)
+    : VulkanContext(nullptr, drawable_width, drawable_height)
+#else
+    #error Unsupported system
+#endif
+{
+    m_headless = true;
+    m_device_extensions.clear();
+}
+
 VulkanContext::~VulkanContext()
 {
+    if (m_device != VK_NULL_HANDLE)
+    {
+        vkDeviceWaitIdle(m_device);
+        releaseUploads(true);
+        releaseDeferred(true);
+    }
+
     delete m_depth_image;
 
-    if (!m_command_buffers.empty())
+    for (VkCommandPool& command_pool : m_command_pools)
     {
-        vkFreeCommandBuffers(m_device, m_command_pool, 
-                            (uint32_t)(m_command_buffers.size()), 
-                            &m_command_buffers[0]);
+        vkDestroyCommandPool(m_device, command_pool, nullptr);
     }
-    
+
     if (m_command_pool != VK_NULL_HANDLE)
     {
         vkDestroyCommandPool(m_device, m_command_pool, nullptr);
     }
 
+    if (m_transfer_command_pool != VK_NULL_HANDLE)
+    {
+        vkDestroyCommandPool(m_device, m_transfer_command_pool, nullptr);
+    }
+
     for (VkSemaphore& semaphore : m_render_finished_semaphores)
     {
         vkDestroySemaphore(m_device, semaphore, nullptr);
@@ -103,11 +174,22 @@ VulkanContext::~VulkanContext()
         vkDestroyImageView(m_device, image_view, nullptr);
     }
 
+    for (VulkanImage* offscreen_image : m_offscreen_images)
+    {
+        delete offscreen_image;
+    }
+
     if (m_swap_chain != VK_NULL_HANDLE)
     {
         vkDestroySwapchainKHR(m_device, m_swap_chain, nullptr);
     }
     
+    if (!m_memory_allocations.empty())
+    {
+        printf("Warning: %u device memory allocations were not freed\n",
+               (unsigned int)m_memory_allocations.size());
+    }
+
     if (m_device != VK_NULL_HANDLE)
     {
         vkDestroyDevice(m_device, nullptr);
@@ -134,12 +216,15 @@ bool VulkanContext::init()
         return false;
     }
 
-    success = createSurface();
-
-    if (!success)
+    if (!m_headless)
     {
-        printf("Error: Couldn't create surface\n");
-        return false;
+        success = createSurface();
+
+        if (!success)
+        {
+            printf("Error: Couldn't create surface\n");
+            return false;
+        }
     }
 
     success = findPhysicalDevice();
@@ -158,7 +243,7 @@ bool VulkanContext::init()
         return false;
     }
 
-    success = createSwapChain();
+    success = m_headless ? createOffscreenImages() : createSwapChain();
 
     if (!success)
     {
@@ -174,11 +259,11 @@ bool VulkanContext::init()
         return false;
     }
 
-    success = createCommandPool();
+    success = createCommandPools();
 
     if (!success)
     {
-        printf("Error: Couldn't create command pool\n");
+        printf("Error: Couldn't create command pools\n");
         return false;
     }
 
@@ -221,11 +306,41 @@ bool VulkanContext::createInstance()
     #error Unsupported system
 #endif
 
+    if (m_headless)
+    {
+        extensions.clear();
+    }
+
+    uint32_t extension_count = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extension_count, nullptr);
+
+    std::vector<VkExtensionProperties> available_extensions(extension_count);
+
+    if (extension_count > 0)
+    {
+        vkEnumerateInstanceExtensionProperties(nullptr, &extension_count,
+                                               &available_extensions[0]);
+    }
+
+    // Needed to query present wait features
+    for (VkExtensionProperties& extension : available_extensions)
+    {
+        if (strcmp(extension.extensionName, 
+                   VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0)
+        {
+            extensions.push_back(
+                        VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+            m_properties2_supported = true;
+            break;
+        }
+    }
+
     VkInstanceCreateInfo create_info = {};
     create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
     create_info.pApplicationInfo = &application_info;
     create_info.enabledExtensionCount = (uint32_t)(extensions.size());
-    create_info.ppEnabledExtensionNames = &extensions[0];
+    create_info.ppEnabledExtensionNames = extensions.empty() ? nullptr : 
+                                                               &extensions[0];
     create_info.enabledLayerCount = 0;
 
     VkResult result = vkCreateInstance(&create_info, nullptr, &m_instance);
@@ -274,8 +389,10 @@ bool VulkanContext::findPhysicalDevice()
     {
         uint32_t graphics_family = 0;
         uint32_t present_family = 0;
+        uint32_t transfer_family = 0;
 
-        bool success = findQueueFamilies(device, &graphics_family, &present_family);
+        bool success = findQueueFamilies(device, &graphics_family, &present_family,
+                                         &transfer_family);
 
         if (!success)
             continue;
@@ -285,15 +402,18 @@ bool VulkanContext::findPhysicalDevice()
         if (!success)
             continue;
 
-        VkSurfaceCapabilitiesKHR surface_capabilities;
+        VkSurfaceCapabilitiesKHR surface_capabilities = {};
         std::vector<VkSurfaceFormatKHR> surface_formats;
         std::vector<VkPresentModeKHR> present_modes;
 
-        success = updateSurfaceInformation(device, &surface_capabilities, 
-                                           &surface_formats, &present_modes);
+        if (!m_headless)
+        {
+            success = updateSurfaceInformation(device, &surface_capabilities, 
+                                               &surface_formats, &present_modes);
 
-        if (!success)
-            continue;
+            if (!success)
+                continue;
+        }
 
         VkPhysicalDeviceFeatures device_features;
         vkGetPhysicalDeviceFeatures(device, &device_features);
@@ -301,8 +421,24 @@ bool VulkanContext::findPhysicalDevice()
         if (!device_features.samplerAnisotropy)
             continue;
 
+        // Material textures are indexed in the fragment shader
+        if (!device_features.shaderSampledImageArrayDynamicIndexing)
+            continue;
+
+        vkGetPhysicalDeviceProperties(device, &m_device_properties);
+
+        m_timestamp_period = m_device_properties.limits.timestampPeriod;
+        m_present_wait_supported = checkPresentWaitSupport(device);
+        m_timestamp_supported = checkTimestampSupport(device, graphics_family);
+        m_memory_budget_supported = checkMemoryBudgetSupport(device);
+        m_multi_draw_indirect_supported = device_features.multiDrawIndirect;
+        m_draw_indirect_first_instance_supported = 
+                                    device_features.drawIndirectFirstInstance;
+        m_pipeline_statistics_supported = 
+                                    device_features.pipelineStatisticsQuery;
         m_graphics_family = graphics_family;
         m_present_family = present_family;
+        m_transfer_family = transfer_family;
         m_surface_capabilities = surface_capabilities;
         m_surface_formats = surface_formats;
         m_present_modes = present_modes;
@@ -318,35 +454,85 @@ bool VulkanContext::createDevice()
     std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
     float queue_priority = 1.0f;
 
-    VkDeviceQueueCreateInfo queue_create_info = {};
-    queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queue_create_info.queueFamilyIndex = m_graphics_family;
-    queue_create_info.queueCount = 1;
-    queue_create_info.pQueuePriorities = &queue_priority;
-    queue_create_infos.push_back(queue_create_info);
+    // Every queue family can be requested only once
+    std::set<uint32_t> queue_families = {m_graphics_family, m_present_family,
+                                         m_transfer_family};
 
-    queue_create_info.queueFamilyIndex = m_present_family;
-    queue_create_infos.push_back(queue_create_info);
+    for (uint32_t queue_family : queue_families)
+    {
+        VkDeviceQueueCreateInfo queue_create_info = {};
+        queue_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        queue_create_info.queueFamilyIndex = queue_family;
+        queue_create_info.queueCount = 1;
+        queue_create_info.pQueuePriorities = &queue_priority;
+        queue_create_infos.push_back(queue_create_info);
+    }
 
     VkPhysicalDeviceFeatures device_features = {};
     device_features.samplerAnisotropy = VK_TRUE;
+    device_features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+    device_features.multiDrawIndirect = m_multi_draw_indirect_supported;
+    device_features.drawIndirectFirstInstance = 
+                                    m_draw_indirect_first_instance_supported;
+    device_features.pipelineStatisticsQuery = m_pipeline_statistics_supported;
+
+    std::vector<const char*> extensions = m_device_extensions;
 
     VkDeviceCreateInfo create_info = {};
     create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
     create_info.queueCreateInfoCount = (uint32_t)(queue_create_infos.size());
     create_info.pQueueCreateInfos = &queue_create_infos[0];
     create_info.pEnabledFeatures = &device_features;
-    create_info.enabledExtensionCount = (uint32_t)(m_device_extensions.size());
-    create_info.ppEnabledExtensionNames = &m_device_extensions[0];
     create_info.enabledLayerCount = 0;
 
+    VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features = {};
+    present_wait_features.sType = 
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    present_wait_features.presentWait = VK_TRUE;
+
+    VkPhysicalDevicePresentIdFeaturesKHR present_id_features = {};
+    present_id_features.sType = 
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    present_id_features.pNext = &present_wait_features;
+    present_id_features.presentId = VK_TRUE;
+
+    VkPhysicalDeviceFeatures2 device_features2 = {};
+    device_features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    device_features2.pNext = &present_id_features;
+    device_features2.features = device_features;
+
+    if (m_memory_budget_supported)
+    {
+        extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+    }
+
+    if (m_present_wait_supported)
+    {
+        extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+        create_info.pNext = &device_features2;
+        create_info.pEnabledFeatures = nullptr;
+    }
+
+    create_info.enabledExtensionCount = (uint32_t)(extensions.size());
+    create_info.ppEnabledExtensionNames = extensions.empty() ? nullptr : 
+                                                               &extensions[0];
+
     VkResult result = vkCreateDevice(m_physical_device, &create_info, nullptr, &m_device);
 
     if (result != VK_SUCCESS)
         return false;
 
+    if (m_present_wait_supported)
+    {
+        m_wait_for_present = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(
+                                            m_device, "vkWaitForPresentKHR");
+        m_present_wait_supported = (m_wait_for_present != nullptr);
+    }
+
     vkGetDeviceQueue(m_device, m_graphics_family, 0, &m_graphics_queue);
     vkGetDeviceQueue(m_device, m_present_family, 0, &m_present_queue);
+    vkGetDeviceQueue(m_device, m_transfer_family, 0, &m_transfer_queue);
 
     return true;
 }
@@ -373,20 +559,7 @@ bool VulkanContext::createSwapChain()
         }
     }
 
-    VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
-
-    for (VkPresentModeKHR& available_mode : m_present_modes)
-    {
-        if (available_mode == VK_PRESENT_MODE_MAILBOX_KHR)
-        {
-            present_mode = available_mode;
-            break;
-        }
-        else if (available_mode == VK_PRESENT_MODE_IMMEDIATE_KHR)
-        {
-            present_mode = available_mode;
-        }
-    }
+    VkPresentModeKHR present_mode = choosePresentMode();
 
     VkExtent2D image_extent = m_surface_capabilities.currentExtent;
 
@@ -403,13 +576,7 @@ bool VulkanContext::createSwapChain()
         image_extent = actual_extent;
     }
 
-    m_swap_chain_images_count = m_surface_capabilities.minImageCount + 1;
-
-    if (m_surface_capabilities.maxImageCount > 0)
-    {
-        m_swap_chain_images_count = std::min(m_swap_chain_images_count, 
-                                             m_surface_capabilities.maxImageCount);
-    }
+    m_swap_chain_images_count = chooseSwapChainImagesCount();
 
     VkSwapchainCreateInfoKHR create_info = {};
     create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -451,9 +618,48 @@ bool VulkanContext::createSwapChain()
     vkGetSwapchainImagesKHR(m_device, m_swap_chain, &m_swap_chain_images_count, 
                             &m_swap_chain_images[0]);
 
+    m_images_in_flight.clear();
+    m_images_in_flight.resize(m_swap_chain_images_count, VK_NULL_HANDLE);
+
     m_swap_chain_image_format = surface_format.format;
     m_swap_chain_extent = image_extent;
+    m_present_mode = present_mode;
+
+    return createImageViews();
+}
+
+bool VulkanContext::createOffscreenImages()
+{
+    m_swap_chain_images_count = (m_swap_chain_params.images_count > 0) ? 
+                                m_swap_chain_params.images_count : 2;
+    m_swap_chain_image_format = VK_FORMAT_B8G8R8A8_UNORM;
+    m_swap_chain_extent = {m_drawable_width, m_drawable_height};
+
+    for (unsigned int i = 0; i < m_swap_chain_images_count; i++)
+    {
+        VulkanImage* offscreen_image = new VulkanImage(m_swap_chain_image_format,
+                                                       m_drawable_width, 
+                                                       m_drawable_height);
+        m_offscreen_images.push_back(offscreen_image);
+
+        bool success = offscreen_image->createImage(
+                                        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                        VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
 
+        if (!success)
+            return false;
+
+        m_swap_chain_images.push_back(offscreen_image->getImage());
+    }
+
+    m_images_in_flight.clear();
+    m_images_in_flight.resize(m_swap_chain_images_count, VK_NULL_HANDLE);
+
+    return createImageViews();
+}
+
+bool VulkanContext::createImageViews()
+{
     for (unsigned int i = 0; i < m_swap_chain_images.size(); i++)
     {
         VkImageViewCreateInfo create_info = {};
@@ -484,6 +690,79 @@ bool VulkanContext::createSwapChain()
     return true;
 }
 
+VkPresentModeKHR VulkanContext::choosePresentMode()
+{
+    std::vector<VkPresentModeKHR> preferred_modes;
+
+    if (m_swap_chain_params.force_present_mode)
+    {
+        preferred_modes.push_back(m_swap_chain_params.present_mode);
+    }
+
+    // Mailbox doesn't tear and doesn't block, so it has lower latency than
+    // fifo with vsync
+    if (m_swap_chain_params.vsync)
+    {
+        preferred_modes.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+    }
+    else
+    {
+        preferred_modes.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR);
+        preferred_modes.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+        preferred_modes.push_back(VK_PRESENT_MODE_FIFO_RELAXED_KHR);
+    }
+
+    for (VkPresentModeKHR& preferred_mode : preferred_modes)
+    {
+        if (std::find(m_present_modes.begin(), m_present_modes.end(),
+                      preferred_mode) != m_present_modes.end())
+        {
+            return preferred_mode;
+        }
+
+        if (m_swap_chain_params.force_present_mode &&
+            preferred_mode == m_swap_chain_params.present_mode)
+        {
+            printf("Warning: Requested present mode is not supported\n");
+        }
+    }
+
+    // Fifo is always supported
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+unsigned int VulkanContext::chooseSwapChainImagesCount()
+{
+    unsigned int min_count = m_surface_capabilities.minImageCount;
+    unsigned int max_count = m_surface_capabilities.maxImageCount;
+
+    // Every additional image is potentially one more frame of latency
+    unsigned int images_count = m_swap_chain_params.low_latency ? 
+                                min_count : min_count + 1;
+
+    if (m_swap_chain_params.images_count > 0)
+    {
+        images_count = std::max(m_swap_chain_params.images_count, min_count);
+
+        if (max_count > 0)
+        {
+            images_count = std::min(images_count, max_count);
+        }
+
+        if (images_count != m_swap_chain_params.images_count)
+        {
+            printf("Warning: Swap chain images count clamped to %u\n",
+                   images_count);
+        }
+    }
+    else if (max_count > 0)
+    {
+        images_count = std::min(images_count, max_count);
+    }
+
+    return images_count;
+}
+
 bool VulkanContext::createSyncObjects()
 {
     VkSemaphoreCreateInfo semaphore_info = {};
@@ -493,7 +772,7 @@ bool VulkanContext::createSyncObjects()
     fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    for (unsigned int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    for (unsigned int i = 0; i < m_frames_in_flight; i++)
     {
         VkSemaphore image_available_semaphore;
         VkResult result = vkCreateSemaphore(m_device, &semaphore_info, nullptr, 
@@ -520,39 +799,69 @@ bool VulkanContext::createSyncObjects()
         m_in_flight_fences.push_back(in_flight_fence);
     }
 
+    m_frame_numbers.resize(m_frames_in_flight, 0);
+
     return true;
 }
 
-bool VulkanContext::createCommandPool()
+bool VulkanContext::createCommandPools()
 {
     VkCommandPoolCreateInfo pool_info = {};
     pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     pool_info.queueFamilyIndex = m_graphics_family;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     VkResult result = vkCreateCommandPool(m_device, &pool_info, nullptr, 
                                           &m_command_pool);
 
+    if (result != VK_SUCCESS)
+        return false;
+
+    // Frame command buffers are recorded again every frame, so the whole
+    // pool of a frame is reset at once
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    for (unsigned int i = 0; i < m_frames_in_flight; i++)
+    {
+        VkCommandPool command_pool = VK_NULL_HANDLE;
+        result = vkCreateCommandPool(m_device, &pool_info, nullptr, 
+                                     &command_pool);
+
+        if (result != VK_SUCCESS)
+            return false;
+
+        m_command_pools.push_back(command_pool);
+    }
+
+    // Upload command buffers are short lived and freed one by one
+    pool_info.queueFamilyIndex = m_transfer_family;
+
+    result = vkCreateCommandPool(m_device, &pool_info, nullptr, 
+                                 &m_transfer_command_pool);
+
     return (result == VK_SUCCESS);
 }
 
 bool VulkanContext::createCommandBuffers()
 {
-    std::vector<VkCommandBuffer> command_buffers(m_swap_chain_images.size());
+    for (unsigned int i = 0; i < m_frames_in_flight; i++)
+    {
+        VkCommandBufferAllocateInfo alloc_info = {};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.commandPool = m_command_pools[i];
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = 1;
 
-    VkCommandBufferAllocateInfo alloc_info = {};
-    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    alloc_info.commandPool = m_command_pool;
-    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    alloc_info.commandBufferCount = (uint32_t)command_buffers.size();
+        VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+        VkResult result = vkAllocateCommandBuffers(m_device, &alloc_info, 
+                                                   &command_buffer);
 
-    VkResult result = vkAllocateCommandBuffers(m_device, &alloc_info, 
-                                               &command_buffers[0]);
+        if (result != VK_SUCCESS)
+            return false;
+
+        m_command_buffers.push_back(command_buffer);
+    }
 
-    if (result != VK_SUCCESS)
-        return false;
-    
-    m_command_buffers = command_buffers;
-    
     return true;
 }
 
@@ -619,6 +928,90 @@ bool VulkanContext::checkDeviceExtensions(VkPhysicalDevice device)
     return required_extensions.empty();
 }
 
+bool VulkanContext::checkPresentWaitSupport(VkPhysicalDevice device)
+{
+    if (m_headless || !m_properties2_supported)
+        return false;
+
+    uint32_t extension_count;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, nullptr);
+
+    std::vector<VkExtensionProperties> extensions(extension_count);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, 
+                                         &extensions[0]);
+
+    std::set<std::string> required_extensions = {
+                                        VK_KHR_PRESENT_ID_EXTENSION_NAME,
+                                        VK_KHR_PRESENT_WAIT_EXTENSION_NAME};
+
+    for (VkExtensionProperties& extension : extensions)
+    {
+        required_extensions.erase(extension.extensionName);
+    }
+
+    if (!required_extensions.empty())
+        return false;
+
+    PFN_vkGetPhysicalDeviceFeatures2KHR get_features2 = 
+                (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(
+                            m_instance, "vkGetPhysicalDeviceFeatures2KHR");
+
+    if (get_features2 == nullptr)
+        return false;
+
+    VkPhysicalDevicePresentWaitFeaturesKHR present_wait_features = {};
+    present_wait_features.sType = 
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+
+    VkPhysicalDevicePresentIdFeaturesKHR present_id_features = {};
+    present_id_features.sType = 
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    present_id_features.pNext = &present_wait_features;
+
+    VkPhysicalDeviceFeatures2 device_features2 = {};
+    device_features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    device_features2.pNext = &present_id_features;
+
+    get_features2(device, &device_features2);
+
+    return present_id_features.presentId && present_wait_features.presentWait;
+}
+
+bool VulkanContext::checkMemoryBudgetSupport(VkPhysicalDevice device)
+{
+    if (!m_properties2_supported)
+        return false;
+
+    uint32_t extension_count;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, nullptr);
+
+    std::vector<VkExtensionProperties> extensions(extension_count);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count, 
+                                         &extensions[0]);
+
+    for (VkExtensionProperties& extension : extensions)
+    {
+        if (strcmp(extension.extensionName, 
+                   VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool VulkanContext::checkTimestampSupport(VkPhysicalDevice device, 
+                                          uint32_t graphics_family)
+{
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, nullptr);
+
+    std::vector<VkQueueFamilyProperties> queue_families(queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, 
+                                             &queue_families[0]);
+
+    return queue_families[graphics_family].timestampValidBits > 0;
+}
+
 bool VulkanContext::updateSurfaceInformation(VkPhysicalDevice device,
                                              VkSurfaceCapabilitiesKHR* surface_capabilities,
                                              std::vector<VkSurfaceFormatKHR>* surface_formats,
@@ -650,7 +1043,8 @@ bool VulkanContext::updateSurfaceInformation(VkPhysicalDevice device,
 }
 
 bool VulkanContext::findQueueFamilies(VkPhysicalDevice device, uint32_t* graphics_family, 
-                                      uint32_t* present_family)
+                                      uint32_t* present_family,
+                                      uint32_t* transfer_family)
 {
     uint32_t queue_family_count = 0;
     vkGetPhysicalDeviceQueueFamilyProperties(device, &queue_family_count, nullptr);
@@ -664,8 +1058,10 @@ bool VulkanContext::findQueueFamilies(VkPhysicalDevice device, uint32_t* graphic
 
     for (unsigned int i = 0; i < queue_families.size(); i++)
     {
+        // Graphics queue also runs the cluster culling compute pass
         if (queue_families[i].queueCount > 0 &&
-            queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+            queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT &&
+            queue_families[i].queueFlags & VK_QUEUE_COMPUTE_BIT)
         {
             *graphics_family = i;
             found_graphics_family = true;
@@ -673,6 +1069,28 @@ bool VulkanContext::findQueueFamilies(VkPhysicalDevice device, uint32_t* graphic
         }
     }
 
+    // Transfer only family is usually backed by DMA engines, so copies can
+    // run in parallel with rendering. Otherwise uploads use graphics queue.
+    *transfer_family = *graphics_family;
+
+    for (unsigned int i = 0; i < queue_families.size(); i++)
+    {
+        if (queue_families[i].queueCount > 0 &&
+            queue_families[i].queueFlags & VK_QUEUE_TRANSFER_BIT &&
+            !(queue_families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) &&
+            !(queue_families[i].queueFlags & VK_QUEUE_COMPUTE_BIT))
+        {
+            *transfer_family = i;
+            break;
+        }
+    }
+
+    if (m_headless)
+    {
+        *present_family = *graphics_family;
+        return found_graphics_family;
+    }
+
     for (unsigned int i = 0; i < queue_families.size(); i++)
     {
         VkBool32 presentSupport = false;
@@ -693,11 +1111,6 @@ bool VulkanContext::recreateSwapChain(uint32_t drawable_width, uint32_t drawable
 {
     delete m_depth_image;
 
-    vkFreeCommandBuffers(m_device, m_command_pool, (uint32_t)(m_command_buffers.size()), 
-                         &m_command_buffers[0]);
-                         
-    m_command_buffers.clear();
-
     for (VkImageView& image_view : m_swap_chain_image_views)
     {
         vkDestroyImageView(m_device, image_view, nullptr);
@@ -705,11 +1118,32 @@ bool VulkanContext::recreateSwapChain(uint32_t drawable_width, uint32_t drawable
     
     m_swap_chain_image_views.clear();
 
-    vkDestroySwapchainKHR(m_device, m_swap_chain, nullptr);
-
     m_drawable_width = drawable_width;
     m_drawable_height = drawable_height;
 
+    if (m_headless)
+    {
+        for (VulkanImage* offscreen_image : m_offscreen_images)
+        {
+            delete offscreen_image;
+        }
+
+        m_offscreen_images.clear();
+        m_swap_chain_images.clear();
+
+        bool success = createOffscreenImages();
+
+        if (!success)
+            return false;
+
+        return createDepthBuffer();
+    }
+
+    vkDestroySwapchainKHR(m_device, m_swap_chain, nullptr);
+
+    // Present ids are counted per swap chain
+    m_present_id = 0;
+
     bool success = updateSurfaceInformation(m_physical_device, &m_surface_capabilities,
                                             &m_surface_formats, &m_present_modes);
 
@@ -721,12 +1155,7 @@ bool VulkanContext::recreateSwapChain(uint32_t drawable_width, uint32_t drawable
     if (!success)
         return false;
 
-    success = createCommandBuffers();
-
-    if (!success)
-        return false;
-
-    success = createDepthBuffer();
+    success = createDepthBuffer();
 
     if (!success)
         return false;
@@ -737,24 +1166,78 @@ bool VulkanContext::recreateSwapChain(uint32_t drawable_width, uint32_t drawable
 void VulkanContext::waitIdle()
 {
     vkDeviceWaitIdle(m_device);
+    releaseUploads(true);
+    releaseDeferred(true);
+}
+
+void VulkanContext::setFramesInFlight(unsigned int frames_in_flight)
+{
+    // Sync objects and command pools are created once in init()
+    if (m_device != VK_NULL_HANDLE)
+    {
+        printf("Warning: Frames in flight can't be changed after init\n");
+        return;
+    }
+
+    m_frames_in_flight = std::max(frames_in_flight, 1u);
 }
 
 bool VulkanContext::beginFrame()
 {
+    CPU_PROFILER_SCOPE("VulkanContext::beginFrame");
+
     VkFence fence = m_in_flight_fences[m_current_frame];
     vkWaitForFences(m_device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
-    vkResetFences(m_device, 1, &fence);
 
-    VkSemaphore semaphore = m_image_available_semaphores[m_current_frame];
-    VkResult result = vkAcquireNextImageKHR(m_device, m_swap_chain, 
-                                            std::numeric_limits<uint64_t>::max(),
-                                            semaphore, VK_NULL_HANDLE, &m_image_index);
+    // Frames finish in submission order
+    m_finished_frames = std::max(m_finished_frames, 
+                                 m_frame_numbers[m_current_frame]);
+
+    releaseUploads(false);
+    releaseDeferred(false);
+
+    if (m_headless)
+    {
+        m_image_index = (m_image_index + 1) % m_swap_chain_images_count;
+    }
+    else
+    {
+        VkSemaphore semaphore = m_image_available_semaphores[m_current_frame];
+        VkResult result = vkAcquireNextImageKHR(m_device, m_swap_chain, 
+                                        std::numeric_limits<uint64_t>::max(),
+                                        semaphore, VK_NULL_HANDLE, &m_image_index);
+
+        if (result == VK_ERROR_OUT_OF_DATE_KHR)
+            return false;
+    }
+
+    // With more frames in flight than swap chain images, the acquired image
+    // may still be rendered by another frame
+    VkFence image_fence = m_images_in_flight[m_image_index];
+
+    if (image_fence != VK_NULL_HANDLE && image_fence != fence)
+    {
+        vkWaitForFences(m_device, 1, &image_fence, VK_TRUE, 
+                        std::numeric_limits<uint64_t>::max());
+    }
+
+    m_images_in_flight[m_image_index] = fence;
+
+    vkResetCommandPool(m_device, m_command_pools[m_current_frame], 0);
 
-    return (result != VK_ERROR_OUT_OF_DATE_KHR);
+    return true;
 }
 
 bool VulkanContext::endFrame()
 {
+    CPU_PROFILER_SCOPE("VulkanContext::endFrame");
+
+    if (m_headless)
+    {
+        m_current_frame = (m_current_frame + 1) % m_frames_in_flight;
+        return true;
+    }
+
     VkSemaphore semaphores[] = {m_render_finished_semaphores[m_current_frame]};
     VkSwapchainKHR swap_chains[] = {m_swap_chain};
 
@@ -766,7 +1249,19 @@ bool VulkanContext::endFrame()
     present_info.pSwapchains = swap_chains;
     present_info.pImageIndices = &m_image_index;
 
-    m_current_frame = (m_current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+    m_present_id++;
+
+    VkPresentIdKHR present_id = {};
+    present_id.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+    present_id.swapchainCount = 1;
+    present_id.pPresentIds = &m_present_id;
+
+    if (m_present_wait_supported)
+    {
+        present_info.pNext = &present_id;
+    }
+
+    m_current_frame = (m_current_frame + 1) % m_frames_in_flight;
 
     VkResult result = vkQueuePresentKHR(m_present_queue, &present_info);
 
@@ -785,12 +1280,26 @@ bool VulkanContext::submitCommandBuffer()
     submit_info.pWaitSemaphores = wait_semaphores;
     submit_info.pWaitDstStageMask = wait_stages;
     submit_info.commandBufferCount = 1;
-    submit_info.pCommandBuffers = &m_command_buffers[m_image_index];
+    submit_info.pCommandBuffers = &m_command_buffers[m_current_frame];
     submit_info.signalSemaphoreCount = 1;
     submit_info.pSignalSemaphores = signal_semaphores;
 
-    VkResult result = vkQueueSubmit(m_graphics_queue, 1, &submit_info, 
-                                    m_in_flight_fences[m_current_frame]);
+    // Nothing to acquire or present in headless mode
+    if (m_headless)
+    {
+        submit_info.waitSemaphoreCount = 0;
+        submit_info.signalSemaphoreCount = 0;
+    }
+
+    // Fence is reset only when something is going to be submitted, so that
+    // a failed frame doesn't leave it unsignaled
+    VkFence fence = m_in_flight_fences[m_current_frame];
+    vkResetFences(m_device, 1, &fence);
+
+    VkResult result = vkQueueSubmit(m_graphics_queue, 1, &submit_info, fence);
+
+    m_submitted_frames++;
+    m_frame_numbers[m_current_frame] = m_submitted_frames;
 
     return (result == VK_SUCCESS);
 }
@@ -832,7 +1341,8 @@ void VulkanContext::endSingleTimeCommands(VkCommandBuffer command_buffer)
 
 bool VulkanContext::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, 
                                  VkMemoryPropertyFlags properties, VkBuffer& buffer, 
-                                 VkDeviceMemory& buffer_memory)
+                                 VkDeviceMemory& buffer_memory, 
+                                 MemoryCategory category)
 {
     VkBufferCreateInfo buffer_info = {};
     buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -848,11 +1358,27 @@ bool VulkanContext::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
     VkMemoryRequirements mem_requirements;
     vkGetBufferMemoryRequirements(m_device, buffer, &mem_requirements);
 
+    bool success = allocateMemory(mem_requirements, properties, category,
+                                  buffer_memory);
+
+    if (!success)
+        return false;
+
+    vkBindBufferMemory(m_device, buffer, buffer_memory, 0);
+
+    return true;
+}
+
+bool VulkanContext::allocateMemory(const VkMemoryRequirements& requirements,
+                                   VkMemoryPropertyFlags properties,
+                                   MemoryCategory category, 
+                                   VkDeviceMemory& memory)
+{
     VkPhysicalDeviceMemoryProperties mem_properties;
     vkGetPhysicalDeviceMemoryProperties(m_physical_device, &mem_properties);
 
     uint32_t memory_type_index = std::numeric_limits<uint32_t>::max();
-    uint32_t type_filter = mem_requirements.memoryTypeBits;
+    uint32_t type_filter = requirements.memoryTypeBits;
 
     for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++)
     {
@@ -869,27 +1395,614 @@ bool VulkanContext::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
 
     VkMemoryAllocateInfo alloc_info = {};
     alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = mem_requirements.size;
+    alloc_info.allocationSize = requirements.size;
     alloc_info.memoryTypeIndex = memory_type_index;
 
-    result = vkAllocateMemory(m_device, &alloc_info, nullptr, &buffer_memory);
+    VkResult result = vkAllocateMemory(m_device, &alloc_info, nullptr, &memory);
 
     if (result != VK_SUCCESS)
         return false;
 
-    vkBindBufferMemory(m_device, buffer, buffer_memory, 0);
+    MemoryAllocation allocation;
+    allocation.size = requirements.size;
+    allocation.category = category;
+    allocation.heap = mem_properties.memoryTypes[memory_type_index].heapIndex;
+
+    std::lock_guard<std::mutex> lock(m_memory_mutex);
+
+    m_memory_allocations[memory] = allocation;
+
+    MemoryStats& stats = m_memory_stats[category];
+    stats.size += allocation.size;
+    stats.peak_size = std::max(stats.peak_size, stats.size);
+    stats.allocations_count++;
+
+    m_total_memory_stats.size += allocation.size;
+    m_total_memory_stats.peak_size = std::max(m_total_memory_stats.peak_size,
+                                              m_total_memory_stats.size);
+    m_total_memory_stats.allocations_count++;
+
+    if (m_heap_allocated.size() < mem_properties.memoryHeapCount)
+    {
+        m_heap_allocated.resize(mem_properties.memoryHeapCount, 0);
+    }
+
+    m_heap_allocated[allocation.heap] += allocation.size;
+
+    updateMemoryMetrics(category);
 
     return true;
 }
 
-void VulkanContext::copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, 
-                               VkDeviceSize size)
+void VulkanContext::freeMemory(VkDeviceMemory memory)
 {
-    VkCommandBuffer command_buffer = beginSingleTimeCommands();
+    if (memory == VK_NULL_HANDLE)
+        return;
+
+    vkFreeMemory(m_device, memory, nullptr);
+
+    std::lock_guard<std::mutex> lock(m_memory_mutex);
+
+    auto it = m_memory_allocations.find(memory);
+
+    if (it == m_memory_allocations.end())
+        return;
+
+    const MemoryAllocation& allocation = it->second;
+
+    MemoryStats& stats = m_memory_stats[allocation.category];
+    stats.size -= allocation.size;
+    stats.allocations_count--;
+
+    m_total_memory_stats.size -= allocation.size;
+    m_total_memory_stats.allocations_count--;
+
+    m_heap_allocated[allocation.heap] -= allocation.size;
+
+    updateMemoryMetrics(allocation.category);
+
+    m_memory_allocations.erase(it);
+}
+
+// Called with memory mutex locked
+void VulkanContext::updateMemoryMetrics(MemoryCategory category)
+{
+    m_memory_metrics[category]->set((double)m_memory_stats[category].size);
+    m_total_memory_metric->set((double)m_total_memory_stats.size);
+    m_peak_memory_metric->set((double)m_total_memory_stats.peak_size);
+}
+
+MemoryStats VulkanContext::getMemoryStats(MemoryCategory category)
+{
+    std::lock_guard<std::mutex> lock(m_memory_mutex);
+
+    return m_memory_stats[category];
+}
+
+MemoryStats VulkanContext::getTotalMemoryStats()
+{
+    std::lock_guard<std::mutex> lock(m_memory_mutex);
+
+    return m_total_memory_stats;
+}
+
+std::vector<MemoryHeapBudget> VulkanContext::getMemoryBudget()
+{
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget_properties = {};
+    budget_properties.sType = 
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2 mem_properties2 = {};
+    mem_properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    mem_properties2.pNext = &budget_properties;
+
+    PFN_vkGetPhysicalDeviceMemoryProperties2KHR get_memory_properties2 = 
+                                                                    nullptr;
+
+    if (m_memory_budget_supported)
+    {
+        get_memory_properties2 = 
+            (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(
+                        m_instance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+    }
+
+    if (get_memory_properties2 != nullptr)
+    {
+        get_memory_properties2(m_physical_device, &mem_properties2);
+    }
+    else
+    {
+        vkGetPhysicalDeviceMemoryProperties(m_physical_device, 
+                                            &mem_properties2.memoryProperties);
+    }
+
+    const VkPhysicalDeviceMemoryProperties& mem_properties = 
+                                            mem_properties2.memoryProperties;
+
+    std::lock_guard<std::mutex> lock(m_memory_mutex);
+
+    std::vector<MemoryHeapBudget> heaps(mem_properties.memoryHeapCount);
+
+    for (uint32_t i = 0; i < mem_properties.memoryHeapCount; i++)
+    {
+        MemoryHeapBudget& heap = heaps[i];
+        heap.heap_size = mem_properties.memoryHeaps[i].size;
+        heap.device_local = (mem_properties.memoryHeaps[i].flags & 
+                             VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+        heap.allocated = i < m_heap_allocated.size() ? m_heap_allocated[i] : 0;
+
+        if (get_memory_properties2 != nullptr)
+        {
+            heap.budget = budget_properties.heapBudget[i];
+            heap.usage = budget_properties.heapUsage[i];
+        }
+        else
+        {
+            heap.budget = heap.heap_size;
+            heap.usage = heap.allocated;
+        }
+    }
+
+    return heaps;
+}
+
+const char* VulkanContext::getMemoryCategoryName(MemoryCategory category)
+{
+    switch (category)
+    {
+    case MEMORY_CATEGORY_GEOMETRY:
+        return "geometry";
+    case MEMORY_CATEGORY_TEXTURE:
+        return "texture";
+    case MEMORY_CATEGORY_UNIFORM:
+        return "uniform";
+    case MEMORY_CATEGORY_STAGING:
+        return "staging";
+    case MEMORY_CATEGORY_ATTACHMENT:
+        return "attachment";
+    default:
+        return "unknown";
+    }
+}
+
+void VulkanContext::printMemoryReport()
+{
+    const float mb = 1024.0f * 1024.0f;
+
+    MemoryStats total_stats = getTotalMemoryStats();
+
+    printf("GPU memory: %.2f MB in %u allocations (peak %.2f MB)\n",
+           total_stats.size / mb, total_stats.allocations_count,
+           total_stats.peak_size / mb);
+
+    for (unsigned int i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+    {
+        MemoryStats stats = getMemoryStats((MemoryCategory)i);
+
+        printf("    %s: %.2f MB in %u allocations (peak %.2f MB)\n",
+               getMemoryCategoryName((MemoryCategory)i), stats.size / mb, 
+               stats.allocations_count, stats.peak_size / mb);
+    }
+
+    std::vector<MemoryHeapBudget> heaps = getMemoryBudget();
+
+    for (unsigned int i = 0; i < heaps.size(); i++)
+    {
+        printf("    heap %u%s: allocated %.2f MB, usage %.2f MB, "
+               "budget %.2f MB, size %.2f MB\n", i, 
+               heaps[i].device_local ? " (device local)" : "",
+               heaps[i].allocated / mb, heaps[i].usage / mb, 
+               heaps[i].budget / mb, heaps[i].heap_size / mb);
+    }
+}
+
+VkCommandBuffer VulkanContext::beginUploadCommands(VkCommandPool command_pool)
+{
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandPool = command_pool;
+    alloc_info.commandBufferCount = 1;
+
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    VkResult result = vkAllocateCommandBuffers(m_device, &alloc_info, 
+                                               &command_buffer);
+
+    if (result != VK_SUCCESS)
+        return VK_NULL_HANDLE;
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+
+    return command_buffer;
+}
+
+// Copies are already recorded in the command buffer. With a dedicated
+// transfer queue the copy is followed by a release of the resource from the
+// transfer queue family, and a separate command buffer on the graphics queue
+// waits for a semaphore signaled by the copy and acquires the resource with
+// a matching barrier. Later frames are submitted to the graphics queue after
+// the acquire, so nothing waits on CPU.
+bool VulkanContext::submitUpload(VkCommandBuffer command_buffer,
+                                 const VkBufferMemoryBarrier* buffer_barrier,
+                                 const VkImageMemoryBarrier* image_barrier,
+                                 VkPipelineStageFlags dst_stage,
+                                 VkBuffer staging_buffer,
+                                 VkDeviceMemory staging_buffer_memory)
+{
+    PendingUpload upload = {};
+    upload.staging_buffer = staging_buffer;
+    upload.staging_buffer_memory = staging_buffer_memory;
+    upload.transfer_command_buffer = command_buffer;
+
+    uint32_t buffer_barriers_count = (buffer_barrier != nullptr) ? 1 : 0;
+    uint32_t image_barriers_count = (image_barrier != nullptr) ? 1 : 0;
+
+    if (!hasDedicatedTransferQueue())
+    {
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             dst_stage, 0, 0, nullptr, 
+                             buffer_barriers_count, buffer_barrier,
+                             image_barriers_count, image_barrier);
+    }
+    else
+    {
+        // Release ignores the destination access and acquire the source
+        // access, they are on the other queue
+        VkBufferMemoryBarrier buffer_release = {};
+        VkBufferMemoryBarrier buffer_acquire = {};
+        VkImageMemoryBarrier image_release = {};
+        VkImageMemoryBarrier image_acquire = {};
+
+        if (buffer_barrier != nullptr)
+        {
+            buffer_release = *buffer_barrier;
+            buffer_release.dstAccessMask = 0;
+            buffer_acquire = *buffer_barrier;
+            buffer_acquire.srcAccessMask = 0;
+        }
+
+        if (image_barrier != nullptr)
+        {
+            image_release = *image_barrier;
+            image_release.dstAccessMask = 0;
+            image_acquire = *image_barrier;
+            image_acquire.srcAccessMask = 0;
+        }
+
+        vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, 
+                             nullptr, buffer_barriers_count, &buffer_release,
+                             image_barriers_count, &image_release);
+
+        upload.graphics_command_buffer = beginUploadCommands(m_command_pool);
+
+        if (upload.graphics_command_buffer != VK_NULL_HANDLE)
+        {
+            vkCmdPipelineBarrier(upload.graphics_command_buffer, 
+                                 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                                 dst_stage, 0, 0, nullptr, 
+                                 buffer_barriers_count, &buffer_acquire,
+                                 image_barriers_count, &image_acquire);
+            vkEndCommandBuffer(upload.graphics_command_buffer);
+        }
+
+        VkSemaphoreCreateInfo semaphore_info = {};
+        semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        vkCreateSemaphore(m_device, &semaphore_info, nullptr, 
+                          &upload.semaphore);
+    }
+
+    vkEndCommandBuffer(command_buffer);
+
+    VkFenceCreateInfo fence_info = {};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    vkCreateFence(m_device, &fence_info, nullptr, &upload.fence);
+
+    // Added before submitting, so that everything is released on failure
+    m_pending_uploads.push_back(upload);
+
+    if (upload.fence == VK_NULL_HANDLE ||
+        (hasDedicatedTransferQueue() && 
+         (upload.semaphore == VK_NULL_HANDLE ||
+          upload.graphics_command_buffer == VK_NULL_HANDLE)))
+        return false;
+
+    VkSubmitInfo submit_info = {};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+
+    if (!hasDedicatedTransferQueue())
+    {
+        VkResult result = vkQueueSubmit(m_graphics_queue, 1, &submit_info, 
+                                        upload.fence);
+
+        return (result == VK_SUCCESS);
+    }
+
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &upload.semaphore;
+
+    VkResult result = vkQueueSubmit(m_transfer_queue, 1, &submit_info, 
+                                    VK_NULL_HANDLE);
+
+    if (result != VK_SUCCESS)
+        return false;
+
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+    VkSubmitInfo acquire_info = {};
+    acquire_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    acquire_info.waitSemaphoreCount = 1;
+    acquire_info.pWaitSemaphores = &upload.semaphore;
+    acquire_info.pWaitDstStageMask = &wait_stage;
+    acquire_info.commandBufferCount = 1;
+    acquire_info.pCommandBuffers = &upload.graphics_command_buffer;
+
+    result = vkQueueSubmit(m_graphics_queue, 1, &acquire_info, upload.fence);
+
+    return (result == VK_SUCCESS);
+}
+
+// Takes ownership of the staging buffer
+bool VulkanContext::uploadBuffer(VkBuffer staging_buffer, 
+                                 VkDeviceMemory staging_buffer_memory,
+                                 VkBuffer buffer, VkDeviceSize size)
+{
+    VkCommandBuffer command_buffer = beginUploadCommands(
+                                                    m_transfer_command_pool);
+
+    if (command_buffer == VK_NULL_HANDLE)
+    {
+        vkDestroyBuffer(m_device, staging_buffer, nullptr);
+        freeMemory(staging_buffer_memory);
+        return false;
+    }
 
     VkBufferCopy copy_region = {};
     copy_region.size = size;
-    vkCmdCopyBuffer(command_buffer, src_buffer, dst_buffer, 1, &copy_region);
+    vkCmdCopyBuffer(command_buffer, staging_buffer, buffer, 1, &copy_region);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    barrier.srcQueueFamilyIndex = m_transfer_family;
+    barrier.dstQueueFamilyIndex = m_graphics_family;
+    barrier.buffer = buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+
+    // Buffers are read as vertices, indices and by compute shader
+    return submitUpload(command_buffer, &barrier, nullptr, 
+                        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                        staging_buffer, staging_buffer_memory);
+}
+
+// Takes ownership of the staging buffer. Regions cover whole mip levels, so
+// they don't depend on image transfer granularity of the transfer queue.
+bool VulkanContext::uploadImage(VkBuffer staging_buffer, 
+                                VkDeviceMemory staging_buffer_memory,
+                                VkImage image, uint32_t mip_levels,
+                                const std::vector<VkBufferImageCopy>& regions)
+{
+    VkCommandBuffer command_buffer = beginUploadCommands(
+                                                    m_transfer_command_pool);
+
+    if (command_buffer == VK_NULL_HANDLE)
+    {
+        vkDestroyBuffer(m_device, staging_buffer, nullptr);
+        freeMemory(staging_buffer_memory);
+        return false;
+    }
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mip_levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 
+                         0, nullptr, 1, &barrier);
+
+    vkCmdCopyBufferToImage(command_buffer, staging_buffer, image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           (uint32_t)(regions.size()), &regions[0]);
+
+    // Layout transition is a part of the ownership transfer
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = m_transfer_family;
+    barrier.dstQueueFamilyIndex = m_graphics_family;
+
+    return submitUpload(command_buffer, nullptr, &barrier, 
+                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                        staging_buffer, staging_buffer_memory);
+}
+
+void VulkanContext::releaseUploads(bool wait)
+{
+    unsigned int pending_count = 0;
+
+    for (PendingUpload& upload : m_pending_uploads)
+    {
+        if (upload.fence != VK_NULL_HANDLE)
+        {
+            if (wait)
+            {
+                vkWaitForFences(m_device, 1, &upload.fence, VK_TRUE, 
+                                std::numeric_limits<uint64_t>::max());
+            }
+            else if (vkGetFenceStatus(m_device, upload.fence) != VK_SUCCESS)
+            {
+                m_pending_uploads[pending_count++] = upload;
+                continue;
+            }
+
+            vkDestroyFence(m_device, upload.fence, nullptr);
+        }
+
+        if (upload.semaphore != VK_NULL_HANDLE)
+        {
+            vkDestroySemaphore(m_device, upload.semaphore, nullptr);
+        }
+
+        if (upload.graphics_command_buffer != VK_NULL_HANDLE)
+        {
+            vkFreeCommandBuffers(m_device, m_command_pool, 1, 
+                                 &upload.graphics_command_buffer);
+        }
+
+        vkFreeCommandBuffers(m_device, m_transfer_command_pool, 1, 
+                             &upload.transfer_command_buffer);
+
+        vkDestroyBuffer(m_device, upload.staging_buffer, nullptr);
+        freeMemory(upload.staging_buffer_memory);
+    }
+
+    m_pending_uploads.resize(pending_count);
+}
+
+// The frame that is being recorded may use the object too, so it has to wait
+// for one frame more than what was submitted so far
+void VulkanContext::destroyLater(std::function<void()> destroy)
+{
+    DeferredDestroy deferred_destroy;
+    deferred_destroy.frame = m_submitted_frames + 1;
+    deferred_destroy.destroy = destroy;
+
+    m_deferred_destroys.push_back(deferred_destroy);
+}
+
+void VulkanContext::releaseDeferred(bool all)
+{
+    unsigned int pending_count = 0;
+
+    for (DeferredDestroy& deferred_destroy : m_deferred_destroys)
+    {
+        if (!all && deferred_destroy.frame > m_finished_frames)
+        {
+            m_deferred_destroys[pending_count++] = deferred_destroy;
+            continue;
+        }
+
+        deferred_destroy.destroy();
+    }
+
+    m_deferred_destroys.resize(pending_count);
+}
+
+bool VulkanContext::waitForPresent(uint64_t present_id, uint64_t timeout)
+{
+    if (!m_present_wait_supported || present_id == 0)
+        return false;
+
+    VkResult result = m_wait_for_present(m_device, m_swap_chain, present_id,
+                                         timeout);
+
+    return (result == VK_SUCCESS);
+}
+
+bool VulkanContext::readOffscreenImage(unsigned int image_index, 
+                                       std::vector<unsigned char>& data)
+{
+    if (!m_headless || image_index >= m_offscreen_images.size())
+        return false;
+
+    waitIdle();
+
+    VkDeviceSize size = (VkDeviceSize)m_swap_chain_extent.width * 
+                        m_swap_chain_extent.height * 4;
+
+    VkBuffer buffer;
+    VkDeviceMemory buffer_memory;
+
+    bool success = createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                buffer, buffer_memory, 
+                                MEMORY_CATEGORY_STAGING);
+
+    if (!success)
+        return false;
+
+    VkCommandBuffer command_buffer = beginSingleTimeCommands();
+
+    // Render pass already left the image in transfer src layout
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = m_swap_chain_images[image_index];
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    vkCmdPipelineBarrier(command_buffer, 
+                         VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 
+                         0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, 0, 0};
+    region.imageExtent = {m_swap_chain_extent.width, 
+                          m_swap_chain_extent.height, 1};
+
+    vkCmdCopyImageToBuffer(command_buffer, m_swap_chain_images[image_index],
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, 
+                           &region);
 
     endSingleTimeCommands(command_buffer);
+
+    data.resize(size);
+
+    void* mapped_data;
+    vkMapMemory(m_device, buffer_memory, 0, size, 0, &mapped_data);
+    memcpy(&data[0], mapped_data, size);
+    vkUnmapMemory(m_device, buffer_memory);
+
+    vkDestroyBuffer(m_device, buffer, nullptr);
+    freeMemory(buffer_memory);
+
+    return true;
+}
+
+bool VulkanContext::isFormatSupported(VkFormat format, 
+                                      VkFormatFeatureFlags features)
+{
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(m_physical_device, format, &props);
+
+    return (props.optimalTilingFeatures & features) == features;
 }
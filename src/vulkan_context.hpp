@@ -27,8 +27,78 @@
 
 #include "vulkan_image.hpp"
 
+#include <functional>
+#include <map>
+#include <mutex>
 #include <vector>
 
+class Metric;
+
+struct SwapChainParams
+{
+    bool vsync;
+    bool low_latency;
+    bool force_present_mode;
+    VkPresentModeKHR present_mode;
+    unsigned int images_count;
+};
+
+enum MemoryCategory
+{
+    MEMORY_CATEGORY_GEOMETRY = 0,
+    MEMORY_CATEGORY_TEXTURE,
+    MEMORY_CATEGORY_UNIFORM,
+    MEMORY_CATEGORY_STAGING,
+    MEMORY_CATEGORY_ATTACHMENT,
+    MEMORY_CATEGORY_COUNT
+};
+
+struct MemoryAllocation
+{
+    VkDeviceSize size;
+    MemoryCategory category;
+    uint32_t heap;
+};
+
+struct MemoryStats
+{
+    VkDeviceSize size;
+    VkDeviceSize peak_size;
+    unsigned int allocations_count;
+};
+
+// Budget and usage are reported by the driver with VK_EXT_memory_budget and
+// include other processes, otherwise budget is the heap size and usage is
+// what this process allocated
+struct MemoryHeapBudget
+{
+    VkDeviceSize heap_size;
+    VkDeviceSize budget;
+    VkDeviceSize usage;
+    VkDeviceSize allocated;
+    bool device_local;
+};
+
+// Staging buffer and command buffers of an upload are released when its
+// fence is signaled
+struct PendingUpload
+{
+    VkBuffer staging_buffer;
+    VkDeviceMemory staging_buffer_memory;
+    VkCommandBuffer transfer_command_buffer;
+    VkCommandBuffer graphics_command_buffer;
+    VkSemaphore semaphore;
+    VkFence fence;
+};
+
+// Objects that may be used by frames in flight are destroyed when all frames
+// up to the given number are finished
+struct DeferredDestroy
+{
+    uint64_t frame;
+    std::function<void()> destroy;
+};
+
 class VulkanContext
 {
 private:
@@ -36,33 +106,59 @@ private:
     VkSurfaceKHR m_surface;
     VkPhysicalDevice m_physical_device;
     VkDevice m_device;
+    VkPhysicalDeviceProperties m_device_properties;
     std::vector<const char*> m_device_extensions;
     VkSurfaceCapabilitiesKHR m_surface_capabilities;
     std::vector<VkSurfaceFormatKHR> m_surface_formats;
     std::vector<VkPresentModeKHR> m_present_modes;
     VkQueue m_graphics_queue;
     VkQueue m_present_queue;
+    VkQueue m_transfer_queue;
 
+    SwapChainParams m_swap_chain_params;
     VkSwapchainKHR m_swap_chain;
+    VkPresentModeKHR m_present_mode;
     std::vector<VkImage> m_swap_chain_images;
     VkFormat m_swap_chain_image_format;
     VkExtent2D m_swap_chain_extent;
     std::vector<VkImageView> m_swap_chain_image_views;
+    std::vector<VulkanImage*> m_offscreen_images;
+    bool m_headless;
 
     VulkanImage* m_depth_image;
 
     VkCommandPool m_command_pool;
+    VkCommandPool m_transfer_command_pool;
+    std::vector<VkCommandPool> m_command_pools;
     std::vector<VkCommandBuffer> m_command_buffers;
+    std::vector<PendingUpload> m_pending_uploads;
+    std::vector<DeferredDestroy> m_deferred_destroys;
 
     std::vector<VkSemaphore> m_image_available_semaphores;
     std::vector<VkSemaphore> m_render_finished_semaphores;
     std::vector<VkFence> m_in_flight_fences;
+    std::vector<VkFence> m_images_in_flight;
+    std::vector<uint64_t> m_frame_numbers;
+    uint64_t m_submitted_frames;
+    uint64_t m_finished_frames;
+    unsigned int m_frames_in_flight;
     unsigned int m_current_frame;
     unsigned int m_swap_chain_images_count;
     uint32_t m_image_index;
 
     uint32_t m_graphics_family;
     uint32_t m_present_family;
+    uint32_t m_transfer_family;
+    bool m_multi_draw_indirect_supported;
+    bool m_draw_indirect_first_instance_supported;
+    bool m_pipeline_statistics_supported;
+    bool m_properties2_supported;
+    bool m_present_wait_supported;
+    bool m_timestamp_supported;
+    float m_timestamp_period;
+    bool m_memory_budget_supported;
+    uint64_t m_present_id;
+    PFN_vkWaitForPresentKHR m_wait_for_present;
     uint32_t m_drawable_width;
     uint32_t m_drawable_height;
 
@@ -75,6 +171,15 @@ private:
     #error Unsupported system
 #endif
 
+    std::mutex m_memory_mutex;
+    std::map<VkDeviceMemory, MemoryAllocation> m_memory_allocations;
+    MemoryStats m_memory_stats[MEMORY_CATEGORY_COUNT];
+    MemoryStats m_total_memory_stats;
+    std::vector<VkDeviceSize> m_heap_allocated;
+    Metric* m_memory_metrics[MEMORY_CATEGORY_COUNT];
+    Metric* m_total_memory_metric;
+    Metric* m_peak_memory_metric;
+
     static VulkanContext* m_vulkan_context;
 
     bool createInstance();
@@ -82,12 +187,29 @@ private:
     bool findPhysicalDevice();
     bool createDevice();
     bool createSwapChain();
+    bool createOffscreenImages();
+    bool createImageViews();
     bool createSyncObjects();
-    bool createCommandPool();
+    bool createCommandPools();
     bool createCommandBuffers();
     bool createDepthBuffer();
+    VkPresentModeKHR choosePresentMode();
+    unsigned int chooseSwapChainImagesCount();
     bool checkDeviceExtensions(VkPhysicalDevice device);
-    bool findQueueFamilies(VkPhysicalDevice device, uint32_t* graphics_family, uint32_t* present_family);
+    bool checkPresentWaitSupport(VkPhysicalDevice device);
+    bool checkTimestampSupport(VkPhysicalDevice device, uint32_t graphics_family);
+    bool checkMemoryBudgetSupport(VkPhysicalDevice device);
+    void updateMemoryMetrics(MemoryCategory category);
+    bool findQueueFamilies(VkPhysicalDevice device, uint32_t* graphics_family, uint32_t* present_family,
+                           uint32_t* transfer_family);
+    VkCommandBuffer beginUploadCommands(VkCommandPool command_pool);
+    bool submitUpload(VkCommandBuffer command_buffer,
+                      const VkBufferMemoryBarrier* buffer_barrier,
+                      const VkImageMemoryBarrier* image_barrier,
+                      VkPipelineStageFlags dst_stage,
+                      VkBuffer staging_buffer,
+                      VkDeviceMemory staging_buffer_memory);
+    void releaseDeferred(bool all);
     bool updateSurfaceInformation(VkPhysicalDevice device,
                   VkSurfaceCapabilitiesKHR* surface_capabilities,
                   std::vector<VkSurfaceFormatKHR>* surface_formats,
@@ -102,6 +224,8 @@ public:
     #error Unsupported system
 #endif
 
+    // Headless context renders into offscreen images instead of a swap chain
+    VulkanContext(uint32_t drawable_width, uint32_t drawable_height);
     ~VulkanContext();
 
     bool init();
@@ -112,24 +236,64 @@ public:
     bool submitCommandBuffer();
     VkCommandBuffer beginSingleTimeCommands();
     void endSingleTimeCommands(VkCommandBuffer command_buffer);
-    bool createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& buffer_memory);
-    void copyBuffer(VkBuffer src_buffer, VkBuffer dst_buffer, VkDeviceSize size);
+    bool createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& buffer_memory, MemoryCategory category);
+    bool allocateMemory(const VkMemoryRequirements& requirements, 
+                        VkMemoryPropertyFlags properties, 
+                        MemoryCategory category, VkDeviceMemory& memory);
+    void freeMemory(VkDeviceMemory memory);
+    MemoryStats getMemoryStats(MemoryCategory category);
+    MemoryStats getTotalMemoryStats();
+    std::vector<MemoryHeapBudget> getMemoryBudget();
+    void printMemoryReport();
+    bool uploadBuffer(VkBuffer staging_buffer, 
+                      VkDeviceMemory staging_buffer_memory,
+                      VkBuffer buffer, VkDeviceSize size);
+    bool uploadImage(VkBuffer staging_buffer, 
+                     VkDeviceMemory staging_buffer_memory, VkImage image,
+                     uint32_t mip_levels,
+                     const std::vector<VkBufferImageCopy>& regions);
+    void releaseUploads(bool wait);
+    void destroyLater(std::function<void()> destroy);
+    bool isFormatSupported(VkFormat format, VkFormatFeatureFlags features);
+    bool waitForPresent(uint64_t present_id, uint64_t timeout);
+    bool readOffscreenImage(unsigned int image_index, 
+                            std::vector<unsigned char>& data);
+
+    void setSwapChainParams(const SwapChainParams& params) {m_swap_chain_params = params;}
+    void setFramesInFlight(unsigned int frames_in_flight);
+    const SwapChainParams& getSwapChainParams() {return m_swap_chain_params;}
+    VkPresentModeKHR getPresentMode() {return m_present_mode;}
 
     VkDevice getDevice() {return m_device;}
     VkPhysicalDevice getPhysicalDevice() {return m_physical_device;}
+    const VkPhysicalDeviceProperties& getDeviceProperties() {return m_device_properties;}
     VkFormat getSwapChainImageFormat() {return m_swap_chain_image_format;}
     VkExtent2D getSwapChainExtent() {return m_swap_chain_extent;}
     const std::vector<VkImage>& getSwapChainImages() {return m_swap_chain_images;}
     const std::vector<VkImageView>& getSwapChainImageViews() {return m_swap_chain_image_views;}
     unsigned int getSwapChainImagesCount() {return m_swap_chain_images_count;}
-    const std::vector<VkCommandBuffer>& getCommandBuffers() {return m_command_buffers;}
+    VkCommandBuffer getCommandBuffer() {return m_command_buffers[m_current_frame];}
+    unsigned int getFramesInFlight() {return m_frames_in_flight;}
+    unsigned int getCurrentFrame() {return m_current_frame;}
     VkQueue getGraphicsQueue() {return m_graphics_queue;}
     uint32_t getGraphicsFamily() {return m_graphics_family;}
+    uint32_t getTransferFamily() {return m_transfer_family;}
+    bool hasDedicatedTransferQueue() {return m_transfer_family != m_graphics_family;}
     uint32_t getDrawableWidth() {return m_drawable_width;}
     uint32_t getDrawableHeight() {return m_drawable_height;}
     uint32_t getImageIndex() {return m_image_index;}
     VulkanImage* getDepthImage() {return m_depth_image;}
+    bool isMultiDrawIndirectSupported() {return m_multi_draw_indirect_supported;}
+    bool isPipelineStatisticsSupported() {return m_pipeline_statistics_supported;}
+    bool isDrawIndirectFirstInstanceSupported() {return m_draw_indirect_first_instance_supported;}
+    bool isHeadless() {return m_headless;}
+    bool isPresentWaitSupported() {return m_present_wait_supported;}
+    bool isTimestampSupported() {return m_timestamp_supported;}
+    bool isMemoryBudgetSupported() {return m_memory_budget_supported;}
+    float getTimestampPeriod() {return m_timestamp_period;}
+    uint64_t getPresentId() {return m_present_id;}
 
+    static const char* getMemoryCategoryName(MemoryCategory category);
     static VulkanContext* getVulkanContext() {return m_vulkan_context;}
 };
 
@@ -21,7 +21,8 @@
 #include <algorithm>
 #include <cstring>
 
-VulkanImage::VulkanImage(VkFormat format, unsigned int width, unsigned int height)
+VulkanImage::VulkanImage(VkFormat format, unsigned int width, unsigned int height,
+                         unsigned int mip_levels)
 {
     m_vulkan_context = VulkanContext::getVulkanContext();
     m_vulkan_device = m_vulkan_context->getDevice();
@@ -30,13 +31,20 @@ VulkanImage::VulkanImage(VkFormat format, unsigned int width, unsigned int heigh
     m_image_memory = VK_NULL_HANDLE;
     m_image_view = VK_NULL_HANDLE;
     m_sampler = VK_NULL_HANDLE;
+    m_staging_buffer = VK_NULL_HANDLE;
+    m_staging_buffer_memory = VK_NULL_HANDLE;
     m_format = format;
+    m_components = {VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+                    VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY};
     m_width = width;
     m_height = height;
+    m_mip_levels = mip_levels;
 }
 
 VulkanImage::~VulkanImage()
 {
+    destroyStagingBuffer();
+
     if (m_sampler != VK_NULL_HANDLE)
     {
         vkDestroySampler(m_vulkan_device, m_sampler, nullptr);
@@ -54,7 +62,7 @@ VulkanImage::~VulkanImage()
 
     if (m_image_memory != VK_NULL_HANDLE)
     {
-        vkFreeMemory(m_vulkan_device, m_image_memory, nullptr);
+        m_vulkan_context->freeMemory(m_image_memory);
     }
 }
 
@@ -66,7 +74,7 @@ bool VulkanImage::createImage(VkImageUsageFlags usage)
     image_info.extent.width = m_width;
     image_info.extent.height = m_height;
     image_info.extent.depth = 1;
-    image_info.mipLevels = 1;
+    image_info.mipLevels = m_mip_levels;
     image_info.arrayLayers = 1;
     image_info.format = m_format;
     image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -83,35 +91,19 @@ bool VulkanImage::createImage(VkImageUsageFlags usage)
     VkMemoryRequirements mem_requirements;
     vkGetImageMemoryRequirements(m_vulkan_device, m_image, &mem_requirements);
 
-    VkPhysicalDeviceMemoryProperties mem_properties;
-    vkGetPhysicalDeviceMemoryProperties(m_vulkan_context->getPhysicalDevice(), 
-                                        &mem_properties);
-
-    uint32_t memory_type_index = std::numeric_limits<uint32_t>::max();
-    uint32_t type_filter = mem_requirements.memoryTypeBits;
-    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    MemoryCategory category = MEMORY_CATEGORY_TEXTURE;
 
-    for (uint32_t i = 0; i < mem_properties.memoryTypeCount; i++)
+    if (usage & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | 
+                 VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT))
     {
-        if ((type_filter & (1 << i)) &&
-            (mem_properties.memoryTypes[i].propertyFlags & properties) == properties)
-        {
-            memory_type_index = i;
-            break;
-        }
+        category = MEMORY_CATEGORY_ATTACHMENT;
     }
 
-    if (memory_type_index == std::numeric_limits<uint32_t>::max())
-        return false;
+    bool success = m_vulkan_context->allocateMemory(mem_requirements,
+                                        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                        category, m_image_memory);
 
-    VkMemoryAllocateInfo alloc_info = {};
-    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    alloc_info.allocationSize = mem_requirements.size;
-    alloc_info.memoryTypeIndex = memory_type_index;
-
-    result = vkAllocateMemory(m_vulkan_device, &alloc_info, nullptr, &m_image_memory);
-
-    if (result != VK_SUCCESS)
+    if (!success)
         return false;
 
     vkBindImageMemory(m_vulkan_device, m_image, m_image_memory, 0);
@@ -119,46 +111,73 @@ bool VulkanImage::createImage(VkImageUsageFlags usage)
     return true;
 }
 
-bool VulkanImage::createTextureImage(const void* texture_data, unsigned int channels)
+void* VulkanImage::mapStagingBuffer(VkDeviceSize size)
 {
-    assert(channels == 4);
-    
-    VkDeviceSize image_size = m_width * m_height * channels;
-
-    VkBuffer staging_buffer;
-    VkDeviceMemory staging_buffer_memory;
+    destroyStagingBuffer();
 
-    bool success = m_vulkan_context->createBuffer(image_size,
+    bool success = m_vulkan_context->createBuffer(size,
                                         VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                                         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                                         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                                        staging_buffer, staging_buffer_memory);
+                                        m_staging_buffer, m_staging_buffer_memory,
+                                        MEMORY_CATEGORY_STAGING);
 
     if (!success)
+        return nullptr;
+
+    void* data = nullptr;
+    VkResult result = vkMapMemory(m_vulkan_device, m_staging_buffer_memory, 0, 
+                                  size, 0, &data);
+
+    if (result != VK_SUCCESS)
+    {
+        destroyStagingBuffer();
+        return nullptr;
+    }
+
+    return data;
+}
+
+bool VulkanImage::createTextureImageFromStaging(
+                            const std::vector<VkBufferImageCopy>& regions)
+{
+    if (m_staging_buffer == VK_NULL_HANDLE)
         return false;
 
-    void* data;
-    vkMapMemory(m_vulkan_device, staging_buffer_memory, 0, image_size, 0, &data);
-    memcpy(data, texture_data, (size_t)(image_size));
-    vkUnmapMemory(m_vulkan_device, staging_buffer_memory);
+    vkUnmapMemory(m_vulkan_device, m_staging_buffer_memory);
 
-    success = createImage(VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+    bool success = createImage(VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
 
     if (!success)
+    {
+        destroyStagingBuffer();
         return false;
+    }
 
-    transitionImageLayout(VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    // Staging buffer is released by the context when the upload is finished
+    success = m_vulkan_context->uploadImage(m_staging_buffer, 
+                                            m_staging_buffer_memory, m_image,
+                                            m_mip_levels, regions);
 
-    copyBufferToImage(staging_buffer);
+    m_staging_buffer = VK_NULL_HANDLE;
+    m_staging_buffer_memory = VK_NULL_HANDLE;
 
-    transitionImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    return success;
+}
 
-    vkDestroyBuffer(m_vulkan_device, staging_buffer, nullptr);
-    vkFreeMemory(m_vulkan_device, staging_buffer_memory, nullptr);
+void VulkanImage::destroyStagingBuffer()
+{
+    if (m_staging_buffer != VK_NULL_HANDLE)
+    {
+        vkDestroyBuffer(m_vulkan_device, m_staging_buffer, nullptr);
+        m_staging_buffer = VK_NULL_HANDLE;
+    }
 
-    return true;
+    if (m_staging_buffer_memory != VK_NULL_HANDLE)
+    {
+        m_vulkan_context->freeMemory(m_staging_buffer_memory);
+        m_staging_buffer_memory = VK_NULL_HANDLE;
+    }
 }
 
 bool VulkanImage::createImageView(VkImageAspectFlags aspect_flags)
@@ -168,9 +187,10 @@ bool VulkanImage::createImageView(VkImageAspectFlags aspect_flags)
     view_info.image = m_image;
     view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
     view_info.format = m_format;
+    view_info.components = m_components;
     view_info.subresourceRange.aspectMask = aspect_flags;
     view_info.subresourceRange.baseMipLevel = 0;
-    view_info.subresourceRange.levelCount = 1;
+    view_info.subresourceRange.levelCount = m_mip_levels;
     view_info.subresourceRange.baseArrayLayer = 0;
     view_info.subresourceRange.layerCount = 1;
 
@@ -196,6 +216,8 @@ bool VulkanImage::createSampler()
     sampler_info.compareEnable = VK_FALSE;
     sampler_info.compareOp = VK_COMPARE_OP_ALWAYS;
     sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    sampler_info.minLod = 0.0f;
+    sampler_info.maxLod = (float)m_mip_levels;
 
     VkResult result = vkCreateSampler(m_vulkan_device, &sampler_info, nullptr, 
                                       &m_sampler);
@@ -214,7 +236,7 @@ void VulkanImage::transitionImageLayout(VkImageLayout old_layout,
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.image = m_image;
     barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.levelCount = m_mip_levels;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = 1;
 
@@ -276,24 +298,3 @@ void VulkanImage::transitionImageLayout(VkImageLayout old_layout,
 
     m_vulkan_context->endSingleTimeCommands(command_buffer);
 }
-
-void VulkanImage::copyBufferToImage(VkBuffer buffer)
-{
-    VkCommandBuffer command_buffer = m_vulkan_context->beginSingleTimeCommands();
-
-    VkBufferImageCopy region = {};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {m_width, m_height, 1};
-
-    vkCmdCopyBufferToImage(command_buffer, buffer, m_image,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-    m_vulkan_context->endSingleTimeCommands(command_buffer);
-}
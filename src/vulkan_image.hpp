@@ -19,6 +19,8 @@
 
 #include <vulkan/vulkan.h>
 
+#include <vector>
+
 class VulkanContext;
 
 class VulkanImage
@@ -31,25 +33,34 @@ private:
     VkDeviceMemory m_image_memory;
     VkImageView m_image_view;
     VkSampler m_sampler;
+    VkBuffer m_staging_buffer;
+    VkDeviceMemory m_staging_buffer_memory;
     VkFormat m_format;
+    VkComponentMapping m_components;
     unsigned int m_width;
     unsigned int m_height;
+    unsigned int m_mip_levels;
+
+    void destroyStagingBuffer();
 
 public:
-    VulkanImage(VkFormat format, unsigned int width, unsigned int height);
+    VulkanImage(VkFormat format, unsigned int width, unsigned int height,
+                unsigned int mip_levels = 1);
     ~VulkanImage();
 
     bool createImage(VkImageUsageFlags usage);
     bool createImageView(VkImageAspectFlags aspect_flags);
-    bool createTextureImage(const void* texture_data, unsigned int channels);
+    void* mapStagingBuffer(VkDeviceSize size);
+    bool createTextureImageFromStaging(const std::vector<VkBufferImageCopy>& regions);
     bool createSampler();
     void transitionImageLayout(VkImageLayout old_layout, VkImageLayout new_layout);
-    void copyBufferToImage(VkBuffer buffer);
 
     VkImage getImage() {return m_image;}
     VkImageView getImageView() {return m_image_view;}
     VkSampler getSampler() {return m_sampler;}
     VkFormat getFormat() {return m_format;}
+    void setComponentMapping(VkComponentMapping components) {m_components = components;}
+    unsigned int getMipLevels() {return m_mip_levels;}
 };
 
 #endif
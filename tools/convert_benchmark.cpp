@@ -0,0 +1,117 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "image_loader.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// The loop that was used before the conversion got vectorized
+static void convertToRGBAReference(const unsigned char* src, 
+                                   unsigned int src_length, unsigned char* dst)
+{
+    unsigned int pixels = src_length / 3;
+
+    for (unsigned int i = 0; i < pixels; i++)
+    {
+        dst[i*4]   = src[i*3];
+        dst[i*4+1] = src[i*3+1];
+        dst[i*4+2] = src[i*3+2];
+        dst[i*4+3] = 255;
+    }
+}
+
+template<typename F>
+static double measure(F convert, unsigned int iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        convert();
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    std::chrono::duration<double> duration = end - start;
+
+    return duration.count() / iterations;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int size = 2048;
+    unsigned int iterations = 50;
+
+    if (argc > 1)
+    {
+        size = atoi(argv[1]);
+    }
+
+    if (argc > 2)
+    {
+        iterations = atoi(argv[2]);
+    }
+
+    if (size == 0 || iterations == 0)
+    {
+        printf("Usage: %s [size] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    // Odd pixels count to also cover the scalar tail
+    unsigned int pixels = size * size + 7;
+    std::vector<unsigned char> src(pixels * 3);
+    std::vector<unsigned char> dst_reference(pixels * 4);
+    std::vector<unsigned char> dst(pixels * 4);
+
+    srand(1);
+
+    for (unsigned char& value : src)
+    {
+        value = rand() % 256;
+    }
+
+    double reference_time = measure([&]()
+    {
+        convertToRGBAReference(&src[0], src.size(), &dst_reference[0]);
+    }, iterations);
+
+    double time = measure([&]()
+    {
+        ImageLoader::convertToRGBA(&src[0], src.size(), &dst[0]);
+    }, iterations);
+
+    if (memcmp(&dst[0], &dst_reference[0], dst.size()) != 0)
+    {
+        printf("Error: Converted data doesn't match the reference\n");
+        return 1;
+    }
+
+    double megabytes = src.size() / (1024.0 * 1024.0);
+
+    printf("Image: %ux%u, iterations: %u\n", size, size, iterations);
+    printf("Reference: %.3f ms (%.1f MB/s)\n", reference_time * 1000.0,
+           megabytes / reference_time);
+    printf("Optimized: %.3f ms (%.1f MB/s)\n", time * 1000.0,
+           megabytes / time);
+    printf("Speedup: %.2fx\n", reference_time / time);
+
+    return 0;
+}
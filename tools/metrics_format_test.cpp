@@ -0,0 +1,129 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "metrics.hpp"
+
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Returns the family of a line in Prometheus text format, or empty string
+// if it doesn't belong to any of the families
+static std::string getLineFamily(const std::string& line,
+                                 const std::vector<std::string>& families)
+{
+    for (const std::string& family : families)
+    {
+        if (line.compare(0, 7 + family.size() + 1, 
+                         "# HELP " + family + " ") == 0 ||
+            line.compare(0, 7 + family.size() + 1, 
+                         "# TYPE " + family + " ") == 0)
+            return family;
+
+        if (line.compare(0, family.size(), family) != 0)
+            continue;
+
+        std::string suffix = line.substr(family.size());
+
+        if (suffix[0] == '{' || suffix[0] == ' ' ||
+            suffix.compare(0, 7, "_bucket") == 0 ||
+            suffix.compare(0, 4, "_sum") == 0 ||
+            suffix.compare(0, 6, "_count") == 0)
+            return family;
+    }
+
+    return "";
+}
+
+// Families with labels are registered in interleaved order, like startup
+// phases between memory gauges, and every family must still be printed
+// as one block with a single description
+int main(int argc, char* argv[])
+{
+    Metrics metrics;
+
+    metrics.getGauge("startup_seconds{phase=\"scan\"}", "Startup phases");
+    metrics.getGauge("memory_bytes{category=\"texture\"}", "Memory");
+    metrics.getHistogram("frame_seconds{queue=\"graphics\"}", "Frames",
+                         {0.01, 0.02})->observe(0.015);
+    metrics.getGauge("startup_seconds{phase=\"decode\"}", "Startup phases");
+    metrics.getCounter("uploads_total", "Uploads")->add(1);
+    metrics.getGauge("memory_bytes{category=\"geometry\"}", "Memory");
+    metrics.getHistogram("frame_seconds{queue=\"compute\"}", "Frames",
+                         {0.01, 0.02})->observe(0.005);
+    metrics.getGauge("startup_seconds{phase=\"total\"}", "Startup phases");
+
+    std::vector<std::string> families = {"startup_seconds", "memory_bytes",
+                                         "frame_seconds", "uploads_total"};
+    std::map<std::string, unsigned int> samples_count;
+    std::map<std::string, unsigned int> help_count;
+    std::vector<std::string> order;
+
+    std::string text = metrics.format();
+    std::istringstream stream(text);
+    std::string line;
+
+    while (std::getline(stream, line))
+    {
+        std::string family = getLineFamily(line, families);
+
+        if (family.empty())
+        {
+            printf("Error: Unexpected line: %s\n", line.c_str());
+            return 1;
+        }
+
+        if (line.compare(0, 7, "# HELP ") == 0)
+        {
+            help_count[family]++;
+        }
+        else if (line[0] != '#')
+        {
+            samples_count[family]++;
+        }
+
+        if (order.empty() || order.back() != family)
+        {
+            order.push_back(family);
+        }
+    }
+
+    bool success = (order == families);
+
+    // Histograms have 2 buckets, +Inf bucket, sum and count
+    success = success && samples_count["startup_seconds"] == 3 &&
+              samples_count["memory_bytes"] == 2 &&
+              samples_count["frame_seconds"] == 10 &&
+              samples_count["uploads_total"] == 1;
+
+    for (const std::string& family : families)
+    {
+        success = success && help_count[family] == 1;
+    }
+
+    if (!success)
+    {
+        printf("Error: Families are not contiguous:\n%s", text.c_str());
+        return 1;
+    }
+
+    printf("Metric families: %u, all contiguous\n", 
+           (unsigned int)families.size());
+
+    return 0;
+}
@@ -0,0 +1,232 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "cooked_texture.hpp"
+#include "file_manager.hpp"
+#include "image_loader_png.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+struct SourceImage
+{
+    std::string name;
+    std::vector<char> data;
+    uint64_t decoded_hash;
+    size_t decoded_size;
+};
+
+static bool decodeImage(const SourceImage& source, size_t chunk_size,
+                        std::vector<unsigned char>& pixels)
+{
+    ImageAllocator allocator = [&pixels](int width, int height, int channels)
+    {
+        pixels.resize(width * height * channels);
+        return &pixels[0];
+    };
+
+    ImageLoaderPNG loader;
+
+    if (chunk_size == 0)
+        return loader.decode(&source.data[0], source.data.size(), allocator,
+                             true);
+
+    bool success = loader.beginProgressive(allocator, true);
+
+    for (size_t pos = 0; success && pos < source.data.size(); pos += chunk_size)
+    {
+        size_t length = std::min(chunk_size, source.data.size() - pos);
+        success = loader.processData(&source.data[pos], length);
+    }
+
+    return success && loader.isFinished();
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int threads_count = std::thread::hardware_concurrency();
+    unsigned int iterations = 10;
+    size_t chunk_size = 4096;
+
+    if (argc > 1)
+    {
+        threads_count = atoi(argv[1]);
+    }
+
+    if (argc > 2)
+    {
+        iterations = atoi(argv[2]);
+    }
+
+    if (argc > 3)
+    {
+        chunk_size = atoi(argv[3]);
+    }
+
+    if (threads_count == 0 || iterations == 0 || chunk_size == 0)
+    {
+        printf("Usage: %s [threads] [iterations] [chunk_size]\n", argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<FileManager> file_manager(new FileManager());
+    bool success = file_manager->init();
+
+    if (!success)
+    {
+        printf("Error: Couldn't create file manager.\n");
+        return 1;
+    }
+
+    std::vector<SourceImage> sources;
+
+    for (std::string name : file_manager->getAssetsList())
+    {
+        if (file_manager->getExtension(name) != ".png")
+            continue;
+
+        File* file = file_manager->loadFile(name);
+
+        if (file == nullptr)
+            continue;
+
+        SourceImage source;
+        source.name = name;
+        source.data.assign(file->data, file->data + file->length);
+        file_manager->closeFile(file);
+
+        sources.push_back(source);
+    }
+
+    if (sources.empty())
+    {
+        printf("Error: No png files found\n");
+        return 1;
+    }
+
+    // Single threaded decode of complete buffers is the reference
+    auto start = std::chrono::steady_clock::now();
+    size_t decoded_bytes = 0;
+
+    for (SourceImage& source : sources)
+    {
+        std::vector<unsigned char> pixels;
+        success = decodeImage(source, 0, pixels);
+
+        if (!success)
+        {
+            printf("Error: Couldn't decode %s\n", source.name.c_str());
+            return 1;
+        }
+
+        source.decoded_hash = CookedTexture::computeHash((char*)&pixels[0],
+                                                         pixels.size());
+        source.decoded_size = pixels.size();
+        decoded_bytes += pixels.size();
+    }
+
+    std::chrono::duration<double> reference_time = 
+                                    std::chrono::steady_clock::now() - start;
+
+    // Truncated and corrupt files have to fail without taking down the 
+    // process, both when decoded at once and progressively
+    for (const SourceImage& source : sources)
+    {
+        SourceImage truncated;
+        truncated.data.assign(source.data.begin(), 
+                              source.data.begin() + source.data.size() / 2);
+
+        SourceImage corrupt = source;
+
+        for (size_t i = corrupt.data.size() / 2; i < corrupt.data.size() / 2 + 
+             16 && i < corrupt.data.size(); i++)
+        {
+            corrupt.data[i] = ~corrupt.data[i];
+        }
+
+        std::vector<unsigned char> pixels;
+
+        if (decodeImage(truncated, 0, pixels) || 
+            decodeImage(truncated, chunk_size, pixels) ||
+            decodeImage(corrupt, 0, pixels) ||
+            decodeImage(corrupt, chunk_size, pixels))
+        {
+            printf("Error: Damaged %s was decoded\n", source.name.c_str());
+            return 1;
+        }
+    }
+
+    // Every thread decodes all images, alternating between complete buffers
+    // and progressive decoding, and compares results with the reference
+    std::atomic<unsigned int> failed_count(0);
+    std::vector<std::thread> threads;
+
+    start = std::chrono::steady_clock::now();
+
+    for (unsigned int i = 0; i < threads_count; i++)
+    {
+        threads.push_back(std::thread([&, i]()
+        {
+            std::vector<unsigned char> pixels;
+
+            for (unsigned int j = 0; j < iterations; j++)
+            {
+                for (const SourceImage& source : sources)
+                {
+                    size_t chunk = ((i + j) % 2 == 0) ? 0 : chunk_size;
+                    bool success = decodeImage(source, chunk, pixels);
+
+                    if (!success || pixels.size() != source.decoded_size ||
+                        CookedTexture::computeHash((char*)&pixels[0], 
+                                pixels.size()) != source.decoded_hash)
+                    {
+                        failed_count++;
+                    }
+                }
+            }
+        }));
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    std::chrono::duration<double> time = 
+                                    std::chrono::steady_clock::now() - start;
+
+    unsigned int decodes = threads_count * iterations * sources.size();
+    double megabytes = decoded_bytes / (1024.0 * 1024.0) * 
+                       threads_count * iterations;
+
+    printf("Images: %u, threads: %u, iterations: %u, chunk size: %u\n",
+           (unsigned int)sources.size(), threads_count, iterations,
+           (unsigned int)chunk_size);
+    printf("Single thread: %.1f images/s\n", 
+           sources.size() / reference_time.count());
+    printf("All threads: %.1f images/s (%.1f MB/s)\n", 
+           decodes / time.count(), megabytes / time.count());
+    printf("Failed: %u of %u\n", failed_count.load(), decodes);
+
+    return (failed_count == 0) ? 0 : 1;
+}
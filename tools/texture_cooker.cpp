@@ -0,0 +1,192 @@
+//    Vulkan test - Simple Vulkan renderer
+//    Copyright (C) 2019 Dawid Gan <deveee@gmail.com>
+//
+//    This program is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "cooked_texture.hpp"
+#include "file_manager.hpp"
+#include "image_loader.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+static bool isUpToDate(std::string cooked_path, uint64_t source_hash)
+{
+    FileManager* file_manager = FileManager::getFileManager();
+
+    int length = file_manager->getFileLength(cooked_path);
+
+    if (length < (int)sizeof(CookedTextureHeader))
+        return false;
+
+    CookedTextureHeader header;
+    bool success = file_manager->readFile(cooked_path, &header, 
+                                          sizeof(CookedTextureHeader));
+
+    if (!success)
+        return false;
+
+    success = CookedTexture::checkHeader(&header, length);
+
+    return success && header.source_hash == source_hash;
+}
+
+static bool cookTexture(std::string name, std::string cooked_path,
+                        uint64_t source_hash)
+{
+    std::unique_ptr<Image> image = ImageLoader::loadImage(name);
+
+    if (image == nullptr)
+        return false;
+
+    if (image->channels < 1 || image->channels > 4)
+    {
+        printf("Warning: Unsupported channels count in %s\n", name.c_str());
+        return false;
+    }
+
+    unsigned int channels = image->channels;
+    unsigned int width = image->width;
+    unsigned int height = image->height;
+    std::vector<unsigned char> level;
+    level.swap(image->data);
+
+    CookedTextureHeader header = {};
+    header.magic = COOKED_TEXTURE_MAGIC;
+    header.version = COOKED_TEXTURE_VERSION;
+    header.source_hash = source_hash;
+    header.width = width;
+    header.height = height;
+    header.channels = channels;
+    header.mip_levels = CookedTexture::getMipLevelsCount(width, height);
+
+    unsigned int alignment = CookedTexture::getMipAlignment(channels);
+    std::vector<unsigned char> blob(sizeof(CookedTextureHeader));
+
+    for (unsigned int i = 0; i < header.mip_levels; i++)
+    {
+        unsigned int offset = blob.size();
+        offset = (offset + alignment - 1) / alignment * alignment;
+
+        header.mips[i].offset = offset;
+        header.mips[i].size = level.size();
+        header.mips[i].width = width;
+        header.mips[i].height = height;
+
+        blob.resize(offset + level.size());
+        memcpy(&blob[offset], &level[0], level.size());
+
+        if (i + 1 == header.mip_levels)
+            break;
+
+        unsigned int mip_width = std::max(width / 2, 1u);
+        unsigned int mip_height = std::max(height / 2, 1u);
+        std::vector<unsigned char> mip(mip_width * mip_height * channels);
+
+        CookedTexture::generateMip(&level[0], width, height, channels, &mip[0]);
+
+        level.swap(mip);
+        width = mip_width;
+        height = mip_height;
+    }
+
+    memcpy(&blob[0], &header, sizeof(CookedTextureHeader));
+
+    FileManager* file_manager = FileManager::getFileManager();
+    bool success = file_manager->writeFile(cooked_path, &blob[0], blob.size());
+
+    return success;
+}
+
+int main(int argc, char* argv[])
+{
+    bool force = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--force") == 0)
+        {
+            force = true;
+        }
+        else
+        {
+            printf("Usage: %s [--force]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::unique_ptr<FileManager> file_manager(new FileManager());
+    bool success = file_manager->init();
+
+    if (!success)
+    {
+        printf("Error: Couldn't create file manager.\n");
+        return 1;
+    }
+
+    unsigned int cooked_count = 0;
+    unsigned int skipped_count = 0;
+    unsigned int failed_count = 0;
+
+    std::vector<std::string> assets_list = file_manager->getAssetsList();
+
+    for (std::string name : assets_list)
+    {
+        if (file_manager->getExtension(name) != ".png")
+            continue;
+
+        if (name.find("cooked/") == 0)
+            continue;
+
+        File* file = file_manager->loadFile(name);
+
+        if (file == nullptr)
+        {
+            failed_count++;
+            continue;
+        }
+
+        uint64_t source_hash = CookedTexture::computeHash(file->data,
+                                                          file->length);
+        file_manager->closeFile(file);
+
+        std::string cooked_path = CookedTexture::getCookedPath(name);
+
+        if (!force && isUpToDate(cooked_path, source_hash))
+        {
+            skipped_count++;
+            continue;
+        }
+
+        success = cookTexture(name, cooked_path, source_hash);
+
+        if (!success)
+        {
+            printf("Error: Couldn't cook texture: %s\n", name.c_str());
+            failed_count++;
+            continue;
+        }
+
+        printf("Cooked %s -> %s\n", name.c_str(), cooked_path.c_str());
+        cooked_count++;
+    }
+
+    printf("Textures cooked: %u, up to date: %u, failed: %u\n", cooked_count,
+           skipped_count, failed_count);
+
+    return (failed_count == 0) ? 0 : 1;
+}